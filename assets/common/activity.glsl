@@ -0,0 +1,28 @@
+// Maps an invocation to the particle it works on. With SLEEPING defined and awakeOnly set the
+// pass was dispatched indirectly over the awake list written by activity.comp, otherwise
+// invocation i works on particle i. Expects a numParticles uniform.
+
+#ifdef SLEEPING
+layout(std430, binding = 18) restrict readonly buffer Activity {
+    uint dispatchSize[3];
+    uint awakeCount;
+    uint awakeParticles[];
+};
+
+uniform bool awakeOnly;
+#endif
+
+// false for the invocations past the last particle
+bool invocationParticle(uint invocation, out uint particleID) {
+    particleID = invocation;
+#ifdef SLEEPING
+    if (awakeOnly) {
+        if (invocation >= awakeCount) {
+            return false;
+        }
+        particleID = awakeParticles[invocation];
+        return true;
+    }
+#endif
+    return invocation < numParticles;
+}
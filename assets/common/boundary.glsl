@@ -0,0 +1,56 @@
+// Boundary of the fluid domain. Without SDF_BOUNDARY it is the six walls of the size cube,
+// with it a signed distance volume covering the cube, so obstacles of any shape cost one
+// texture fetch per particle. Expects a size uniform.
+
+#ifdef SDF_BOUNDARY
+// xyz is the unit gradient pointing into the fluid, w the distance to the nearest boundary,
+// negative inside solids
+uniform sampler3D boundarySdf;
+
+vec4 sampleBoundary(vec3 p) { return texture(boundarySdf, p / size); }
+#endif
+
+// Put a particle that crossed the border back inside, its velocity into the boundary is
+// reflected and damped
+void collideBoundary(inout vec3 pos, inout vec3 vel, float border) {
+    const float wallDamping = 0.3;
+
+#ifdef SDF_BOUNDARY
+    const vec4 boundary = sampleBoundary(pos);
+    if (boundary.w < border) {
+        const vec3 normal = boundary.xyz;
+        pos += normal * (border - boundary.w);
+        const float normalSpeed = dot(vel, normal);
+        if (normalSpeed < 0) {
+            vel -= (1.0 + wallDamping) * normalSpeed * normal;
+        }
+    }
+
+    // the volume ends at the cube, outside it the texture repeats its edge
+    pos = clamp(pos, vec3(border), vec3(size - border));
+#else
+    if (pos.x < border) {
+        vel.x *= -wallDamping;
+        pos.x = border;
+    } else if (pos.x > size - border) {
+        vel.x *= -wallDamping;
+        pos.x = size - border;
+    }
+
+    if (pos.y < border) {
+        vel.y *= -wallDamping;
+        pos.y = border;
+    } else if (pos.y > size - border) {
+        vel.y *= -wallDamping;
+        pos.y = size - border;
+    }
+
+    if (pos.z < border) {
+        vel.z *= -wallDamping;
+        pos.z = border;
+    } else if (pos.z > size - border) {
+        vel.z *= -wallDamping;
+        pos.z = size - border;
+    }
+#endif
+}
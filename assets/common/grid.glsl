@@ -0,0 +1,33 @@
+// Bin index of a grid coordinate, shared by the sort and fluid shaders.
+// Expects a gridRes uniform, MORTON_INDEXING selects Z-order keys and
+// HASHED_INDEXING, defined as the power of two table size, a spatial hash.
+
+// spread the lower 10 bits of v so there are two zero bits between each
+uint expandBits(uint v) {
+    v &= 0x000003ffu;
+    v = (v | (v << 16)) & 0xff0000ffu;
+    v = (v | (v << 8)) & 0x0300f00fu;
+    v = (v | (v << 4)) & 0x030c30c3u;
+    v = (v | (v << 2)) & 0x09249249u;
+    return v;
+}
+
+uint cellIndex(ivec3 c) {
+#if defined(MORTON_INDEXING)
+    return expandBits(uint(c.x)) | (expandBits(uint(c.y)) << 1) | (expandBits(uint(c.z)) << 2);
+#elif defined(HASHED_INDEXING)
+    return ((uint(c.x) * 73856093u) ^ (uint(c.y) * 19349663u) ^ (uint(c.z) * 83492791u)) &
+           (uint(HASHED_INDEXING) - 1u);
+#else
+    return c.z * gridRes * gridRes + c.y * gridRes + c.x;
+#endif
+}
+
+// Several bins can share a hash slot, so neighbor loops keep only the particles whose own
+// bin is the one being searched. Expects a binSize uniform where it is used.
+#ifdef HASHED_INDEXING
+#define inBin(position, c) \
+    all(equal(clamp(ivec3((position) / binSize), ivec3(0), ivec3(gridRes - 1)), (c)))
+#else
+#define inBin(position, c) true
+#endif
@@ -0,0 +1,10 @@
+// Neighbor list buffers read by the density and update passes when NEIGHBOR_LIST is defined.
+// The lists of particle i are neighborIndices[neighborOffsets[i] .. neighborOffsets[i + 1]).
+
+layout(std430, binding = 11) restrict readonly buffer NeighborOffsets {
+    uint neighborOffsets[];
+};
+
+layout(std430, binding = 12) restrict readonly buffer NeighborIndices {
+    uint neighborIndices[];
+};
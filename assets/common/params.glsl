@@ -0,0 +1,54 @@
+// Parameters shared by every fluid pass, one std140 block matching SimParams in
+// src/core/SimParams.h. The host rewrites it only when a parameter changes. A member that a
+// specialized variant folds into a literal keeps its slot under another name, so every variant
+// has the same layout.
+
+#define SIM_PARAMS
+
+layout(std140, binding = 0) uniform SimParams {
+    vec3 gravity;
+    float size;
+    float binSize;
+#ifdef GRID_RES
+    int specializedGridRes;
+#else
+    int gridRes;
+#endif
+    int numParticles;
+    float particleMass;
+#ifdef KERNEL_RADIUS
+    float specializedKernelRadius;
+#else
+    float kernelRadius;
+#endif
+    float stiffness;
+    float restDensity;
+    float restPressure;
+    float viscosityCoefficient;
+#ifdef POLY6_KERNEL_CONST
+    float specializedPoly6KernelConst;
+#else
+    float poly6KernelConst;
+#endif
+#ifdef SPIKY_KERNEL_CONST
+    float specializedSpikyKernelConst;
+#else
+    float spikyKernelConst;
+#endif
+#ifdef VISCOSITY_KERNEL_CONST
+    float specializedViscosityKernelConst;
+#else
+    float viscosityKernelConst;
+#endif
+    // pressure per unit of density error times dt^2, from a filled prototype neighborhood
+    float pressureDelta;
+    // largest density error relative to the rest density that counts as converged
+    float pressureTolerance;
+    int minPressureIterations;
+    float cflNumber;
+    float forceNumber;
+    float minDt;
+    float maxDt;
+};
+
+#include "./specialize.glsl"
@@ -0,0 +1,31 @@
+// Live particle count of the dynamic particle mode. The buffers hold the live particles at the
+// front and unused capacity behind them. Expects a numParticles or numItems uniform holding the
+// capacity, which only covers the live particles once this is included.
+
+#ifdef DYNAMIC_PARTICLES
+layout(std430, binding = 20) restrict readonly buffer Population {
+    uint populationDispatch[3];
+    uint liveParticles;
+};
+
+// a macro doesn't expand inside itself, so the uniform on the right is still the capacity
+#define numParticles min(numParticles, int(liveParticles))
+#define numItems min(numItems, int(liveParticles))
+
+const int MAX_SINKS = 4;
+uniform int numSinks;
+uniform vec3 sinkMin[MAX_SINKS];
+uniform vec3 sinkMax[MAX_SINKS];
+#endif
+
+// true for particles inside a sink, the sort leaves them out
+bool removed(vec3 p) {
+#ifdef DYNAMIC_PARTICLES
+    for (int i = 0; i < numSinks; i++) {
+        if (all(greaterThanEqual(p, sinkMin[i])) && all(lessThan(p, sinkMax[i]))) {
+            return true;
+        }
+    }
+#endif
+    return false;
+}
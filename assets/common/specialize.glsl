@@ -0,0 +1,33 @@
+// Constants of a fluid that stay fixed after setup. A specialized variant defines them, so the
+// driver folds the literals into the math and the loop bounds. Otherwise they are uniforms, or
+// members of the SimParams block when params.glsl included this.
+
+#ifdef GRID_RES
+const int gridRes = GRID_RES;
+#elif !defined(SIM_PARAMS)
+uniform int gridRes;
+#endif
+
+#ifdef KERNEL_RADIUS
+const float kernelRadius = KERNEL_RADIUS;
+#elif !defined(SIM_PARAMS)
+uniform float kernelRadius;
+#endif
+
+#ifdef POLY6_KERNEL_CONST
+const float poly6KernelConst = POLY6_KERNEL_CONST;
+#elif !defined(SIM_PARAMS)
+uniform float poly6KernelConst;
+#endif
+
+#ifdef SPIKY_KERNEL_CONST
+const float spikyKernelConst = SPIKY_KERNEL_CONST;
+#elif !defined(SIM_PARAMS)
+uniform float spikyKernelConst;
+#endif
+
+#ifdef VISCOSITY_KERNEL_CONST
+const float viscosityKernelConst = VISCOSITY_KERNEL_CONST;
+#elif !defined(SIM_PARAMS)
+uniform float viscosityKernelConst;
+#endif
@@ -0,0 +1,43 @@
+// Cell tiling, one workgroup per bin stages the particles of the 27 surrounding bins through
+// shared memory TILE_SIZE at a time. The neighborhood is walked in NEIGHBORHOOD order so the
+// sums match the per particle loops. Expects counts, offsets, gridRes, NEIGHBORHOOD and
+// cellIndex(), and a workgroup of TILE_SIZE threads dispatched as gridRes^3 groups.
+
+const uint TILE_SIZE = WORK_GROUP_SIZE;
+
+shared uint neighborhoodFirst[27];
+shared uint neighborhoodPrefix[28];
+
+// Store the range of each neighboring bin, returns the number of particles in all of them
+uint loadNeighborhood(ivec3 coord) {
+    if (gl_LocalInvocationIndex == 0) {
+        uint total = 0;
+        for (uint binIndex = 0; binIndex < 27; binIndex++) {
+            const ivec3 nc = coord + NEIGHBORHOOD[binIndex];
+            neighborhoodFirst[binIndex] = 0;
+            neighborhoodPrefix[binIndex] = total;
+
+            // don't go out of bounds
+            if (any(lessThan(nc, ivec3(0))) || any(greaterThanEqual(nc, ivec3(gridRes)))) {
+                continue;
+            }
+
+            const uint index = cellIndex(nc);
+            neighborhoodFirst[binIndex] = offsets[index];
+            total += counts[index];
+        }
+        neighborhoodPrefix[27] = total;
+    }
+    barrier();
+
+    return neighborhoodPrefix[27];
+}
+
+// Particle index of the k-th particle of the neighborhood
+uint neighborhoodParticle(uint k) {
+    uint binIndex = 0;
+    while (neighborhoodPrefix[binIndex + 1] <= k) {
+        binIndex++;
+    }
+    return neighborhoodFirst[binIndex] + k - neighborhoodPrefix[binIndex];
+}
@@ -0,0 +1,21 @@
+// Time step of the passes that integrate, stepSize() is the dt uniform unless ADAPTIVE_TIMESTEP
+// is defined. Then it is read from the buffer below, where the update pass also reduces the
+// largest speed and acceleration as float bits. timestep.comp turns those into the dt of the
+// next step, so the step size never has to travel through the CPU. It also sums the dt of every
+// step into the simulated time, which the CPU reads back through fences.
+
+#ifdef ADAPTIVE_TIMESTEP
+layout(std430, binding = 15) restrict buffer Timestep {
+    float stepDt;
+    uint maxSpeedBits;
+    uint maxAccelerationBits;
+    uint reserved;
+    double simulatedTime;
+};
+
+float stepSize() { return stepDt; }
+#else
+uniform float dt;
+
+float stepSize() { return dt; }
+#endif
@@ -16,19 +16,41 @@ struct Particle {
     float pressure;
 };
 
+#ifdef SOA_LAYOUT
+layout(binding = 0, std430) restrict readonly buffer Positions {
+    vec4 positions[];
+};
+
+layout(binding = 1, std430) restrict readonly buffer Velocities {
+    vec4 velocities[];
+};
+
+layout(binding = 2, std430) restrict readonly buffer Densities {
+    float densities[];
+};
+
+layout(binding = 3, std430) restrict readonly buffer Pressures {
+    float pressures[];
+};
+
+Particle getParticle(uint i) {
+    return Particle(positions[i].xyz, densities[i], velocities[i].xyz, pressures[i]);
+}
+#else
 layout(binding = 0, std430) restrict readonly buffer Particles {
     Particle particles[];
 };
 
+Particle getParticle(uint i) { return particles[i]; }
+#endif
+
 uniform mat4 ciModelViewProjection;
 uniform mat4 ciViewMatrix;
 uniform int renderMode;
-uniform float size;
-uniform float binSize;
-uniform int gridRes;
+#include "../common/params.glsl"
 
 void main() {
-	Particle p = particles[gl_VertexID];
+	Particle p = getParticle(gl_VertexID);
     vPosition = p.position;
     bool invalid;
 
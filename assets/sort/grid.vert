@@ -18,17 +18,19 @@ layout(std430, binding = 2) restrict buffer Offsets {
 
 uniform mat4 ciModelViewProjection;
 uniform float binSize;
-uniform int gridRes;
+#include "../common/specialize.glsl"
 uniform float size;
 uniform int numItems;
 
+#include "../common/grid.glsl"
+
 vec3 coordToPoint(ivec3 c) {
     return (vec3(c) / float(gridRes)) * size;
 } 
 
 void main() {
     const ivec3 coord = grid[gridID].xyz;
-    const uint index = coord.z * gridRes * gridRes + coord.y * gridRes + coord.x;
+    const uint index = cellIndex(coord);
 
     const uint count = counts[index];
     const uint offset = offsets[index];
@@ -1,6 +1,8 @@
 #include <Windows.h>
 #include <string>
 
+#include <chrono>
+
 #include "cinder/Easing.h"
 #include "cinder/Utilities.h"
 #include "cinder/app/App.h"
@@ -10,24 +12,37 @@
 
 #include "./core/Fluid.h"
 #include "./core/Scene.h"
+#include "./core/SimulationClock.h"
 
 using namespace std;
 using namespace ci;
 using namespace ci::app;
 using namespace core;
 
+namespace {
+
+const int MAX_SUBSTEPS = 8;
+const char* CHECKPOINT_PATH = "fluid.wcck";
+
+} // namespace
+
 class WaterCubeApp : public App {
 public:
+    // kept across resets, unlike the state setup() initializes
+    WaterCubeApp() : pipelined_(false), restart_(false), dynamic_(false) {}
+
     void setup() override;
     void update() override;
     void draw() override;
     void keyDown(KeyEvent event) override;
     void mouseMove(MouseEvent event) override;
+    void cleanup() override;
 
 private:
     Ray getMouseRay();
+    void setThroughputMode(bool enabled);
 
-    bool run_once_, running_, reset_;
+    bool run_once_, running_, reset_, pipelined_, restart_, dynamic_;
     double prev_time_;
     float size_;
 
@@ -36,6 +51,7 @@ private:
     CameraPersp cam_;
     SceneRef scene_;
     FluidRef fluid_;
+    SimulationClockRef clock_;
 };
 
 void WaterCubeApp::setup() {
@@ -49,6 +65,13 @@ void WaterCubeApp::setup() {
     vec3 camera_pos = vec3(-size_, size_ / 3.0f, size_ * 2);
     cam_.lookAt(camera_pos, vec3(0, 0, 0));
 
+    if (!clock_) {
+        clock_ = SimulationClock::create()
+                     ->fixedStep(1.0 / 120.0)
+                     ->timeBudget(12.0)
+                     ->maxSubsteps(MAX_SUBSTEPS);
+    }
+
     gl::enableDepthWrite();
     gl::enableDepthRead();
 
@@ -56,7 +79,25 @@ void WaterCubeApp::setup() {
     scene_ = Scene::create();
 
     fluid_ = Fluid::create("fluid");
+    fluid_->pipelined(pipelined_);
+    if (restart_) {
+        fluid_->checkpoint(CHECKPOINT_PATH);
+        restart_ = false;
+    }
+    if (dynamic_) {
+        // a drain in one corner of the floor and a steady pour from above, the interval is in
+        // simulated seconds so at the default time scale a batch comes every 30 steps
+        fluid_->sink(vec3(0), vec3(0.2f, 0.05f, 0.2f));
+        fluid_->inflow(Emitter::box(vec3(0.4f, 0.8f, 0.4f), vec3(0.6f, 0.9f, 0.6f))
+                           ->velocity(vec3(0, -1.0f, 0)),
+                       0.003f);
+    }
+    // every substep is a profiler frame, keep enough slots for all of a rendered frame's steps
+    fluid_->getProfiler()->ringSize(4 * MAX_SUBSTEPS);
     fluid_->setup();
+    // bound to whichever fluid the app holds when clicked, the same file k saves
+    fluid_->getParams()->addButton("Save Checkpoint",
+                                   [this]() { fluid_->saveCheckpoint(CHECKPOINT_PATH); });
     fluid_->setCameraPosition(camera_pos);
     fluid_->setLightPosition(vec3(0, size_ / 2.0f, size_));
 
@@ -88,14 +129,19 @@ void WaterCubeApp::update() {
         return;
     }
 
-    if (step > 1) {
-        // better luck next time
-        return;
-    }
-
     fluid_->setMouseRay(getMouseRay());
 
-    scene_->update(step);
+    const int substeps = clock_->beginFrame(step);
+    const auto start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < substeps; i++) {
+        scene_->update(clock_->getFixedStep());
+    }
+    const auto end = std::chrono::high_resolution_clock::now();
+
+    // the GPU steps run asynchronously, their cost shows up in the profiler instead
+    const double cpu_ms = std::chrono::duration<double, std::milli>(end - start).count();
+    const double gpu_ms = fluid_->getProfiler()->getAverage("GPU Frame");
+    clock_->endFrame(substeps, substeps > 0 ? std::max(cpu_ms / substeps, gpu_ms) : 0.0);
 
     if (run_once_) {
         running_ = false;
@@ -115,6 +161,23 @@ void WaterCubeApp::draw() {
     std::string font = "Ariel";
     gl::drawString(toString(static_cast<int>(getAverageFps())) + " fps",
                    vec2(window.x - 64.0f, 20.0f), Color("black"), Font(font, 20));
+    gl::drawString(toString(clock_->getSubsteps()) + " steps",
+                   vec2(window.x - 64.0f, 40.0f), Color("black"), Font(font, 20));
+}
+
+/**
+ * Throughput mode runs a batch of steps per frame and lifts the vsync and frame rate caps so
+ * the simulation isn't held back by the display
+ */
+void WaterCubeApp::setThroughputMode(bool enabled) {
+    clock_->setMode(enabled ? SimulationClock::THROUGHPUT_CLOCK
+                            : SimulationClock::REAL_TIME_CLOCK);
+    gl::enableVerticalSync(!enabled);
+    if (enabled) {
+        disableFrameRate();
+    } else {
+        setFrameRate(60.0f);
+    }
 }
 
 void WaterCubeApp::keyDown(KeyEvent event) {
@@ -125,10 +188,40 @@ void WaterCubeApp::keyDown(KeyEvent event) {
     case 'r':
         running_ = false;
         reset_ = true;
+        break;
+    case 't':
+        setThroughputMode(clock_->getMode() != SimulationClock::THROUGHPUT_CLOCK);
+        break;
+    case 'k':
+        fluid_->saveCheckpoint(CHECKPOINT_PATH);
+        break;
+    case 'l':
+        running_ = false;
+        reset_ = true;
+        restart_ = true;
+        break;
+    case 'd':
+        // the population is created at setup, so switching restarts the simulation
+        dynamic_ = !dynamic_;
+        running_ = false;
+        reset_ = true;
+        break;
+    case 'i':
+        fluid_->inject(Emitter::sphere(vec3(0.5f, 0.7f, 0.5f), 0.1f));
+        break;
+    case 'p':
+        // the snapshot buffer is created at setup, so switching restarts the simulation
+        pipelined_ = !pipelined_;
+        running_ = false;
+        reset_ = true;
+        break;
     }
 }
 
 void WaterCubeApp::mouseMove(MouseEvent event) { mouse_position_ = event.getPos(); }
 
+// the cached programs have to go while the context is still current
+void WaterCubeApp::cleanup() { ShaderCache::get()->clear(); }
+
 CINDER_APP(WaterCubeApp, RendererGl,
            [](App::Settings* settings) { settings->setWindowSize(1920, 1080); })
@@ -0,0 +1,286 @@
+/**
+ * Headless GPU benchmark - steps the compute shader solver in a hidden window over a sweep of
+ * scenarios, particle counts, grid resolutions and solver modes, then writes one CSV row per
+ * configuration with steps per second, the mean time of each profiled pass and the buffer
+ * memory. Quits once the sweep is done.
+ */
+#include <Windows.h>
+#include <chrono>
+#include <cstdio>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "cinder/app/App.h"
+#include "cinder/app/RendererGl.h"
+#include "cinder/gl/gl.h"
+
+#include "../core/Fluid.h"
+#include "../core/Scenario.h"
+
+using namespace std;
+using namespace ci;
+using namespace ci::app;
+using namespace core;
+
+namespace {
+
+// passes timed by Fluid and Sort, in the order they run
+const char* PASSES[] = {"Count",    "Scan",     "Reorder", "Neighbors", "Copy",
+                        "Activity", "Density",  "Pairs",   "Pressure",  "Update",
+                        "Timestep", "GPU Frame"};
+
+// particle counts swept unless --particles picks others
+const std::vector<int> DEFAULT_PARTICLES = {10000, 50000, 200000, 500000, 1000000, 2000000};
+
+/**
+ * Every list option runs the full cross product of its values with the other lists
+ */
+struct Options {
+    Options()
+        : scenarios({scenario::DAM_BREAK}), particles(DEFAULT_PARTICLES), grid_res({21}),
+          indexing({grid::ROW_MAJOR_INDEXING}), pairs({false}), steps(200), warmup(20), seed(0),
+          neighbor_lists(false), cell_tiling(false), adaptive_timestep(false), sdf_boundary(false),
+          sleeping(false), fused_sort(true), pressure_solver(STATE_EQUATION_PRESSURE),
+          time_scale(0.012f), out("gpu_bench.csv") {}
+    std::vector<int> scenarios;
+    std::vector<int> particles;
+    std::vector<int> grid_res;
+    std::vector<int> indexing;
+    std::vector<bool> pairs;
+    int steps;
+    int warmup;
+    unsigned seed;
+    bool neighbor_lists;
+    bool cell_tiling;
+    bool adaptive_timestep;
+    bool sdf_boundary;
+    bool sleeping;
+    bool fused_sort;
+    int pressure_solver;
+    float time_scale;
+    std::string out;
+};
+
+std::vector<std::string> splitList(const std::string& value) {
+    std::vector<std::string> items;
+    std::stringstream stream(value);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        if (!item.empty()) {
+            items.push_back(item);
+        }
+    }
+    return items;
+}
+
+std::vector<int> parseInts(const std::string& value) {
+    std::vector<int> values;
+    for (const std::string& item : splitList(value)) {
+        values.push_back(std::atoi(item.c_str()));
+    }
+    return values;
+}
+
+int indexingFromName(const std::string& name) {
+    for (int indexing : {grid::ROW_MAJOR_INDEXING, grid::MORTON_INDEXING,
+                         grid::HASHED_INDEXING}) {
+        if (grid::indexingName(indexing) == name) {
+            return indexing;
+        }
+    }
+    return -1;
+}
+
+Options parseOptions(const std::vector<std::string>& args) {
+    Options options;
+    for (size_t i = 1; i + 1 < args.size(); i += 2) {
+        const std::string& name = args[i];
+        const std::string& value = args[i + 1];
+        const int number = std::atoi(value.c_str());
+        if (name == "--scenario") {
+            options.scenarios.clear();
+            for (const std::string& item : splitList(value)) {
+                const int s = scenario::fromName(item);
+                if (s < 0) {
+                    util::log("unknown scenario %s", item.c_str());
+                } else {
+                    options.scenarios.push_back(s);
+                }
+            }
+        } else if (name == "--particles") {
+            options.particles = parseInts(value);
+        } else if (name == "--grid-res") {
+            options.grid_res = parseInts(value);
+        } else if (name == "--indexing") {
+            options.indexing.clear();
+            for (const std::string& item : splitList(value)) {
+                const int indexing = indexingFromName(item);
+                if (indexing < 0) {
+                    util::log("unknown indexing %s", item.c_str());
+                } else {
+                    options.indexing.push_back(indexing);
+                }
+            }
+        } else if (name == "--pairs") {
+            options.pairs.clear();
+            for (const std::string& item : splitList(value)) {
+                options.pairs.push_back(item == "symmetric");
+            }
+        } else if (name == "--steps") {
+            options.steps = number;
+        } else if (name == "--warmup") {
+            options.warmup = number;
+        } else if (name == "--seed") {
+            options.seed = unsigned(number);
+        } else if (name == "--neighbor-lists") {
+            options.neighbor_lists = number != 0;
+        } else if (name == "--cell-tiling") {
+            options.cell_tiling = number != 0;
+        } else if (name == "--adaptive-timestep") {
+            options.adaptive_timestep = number != 0;
+        } else if (name == "--sdf-boundary") {
+            options.sdf_boundary = number != 0;
+        } else if (name == "--sleeping") {
+            options.sleeping = number != 0;
+        } else if (name == "--fused-sort") {
+            options.fused_sort = number != 0;
+        } else if (name == "--pressure-solver") {
+            options.pressure_solver = value == "pcisph" ? PCISPH_PRESSURE : STATE_EQUATION_PRESSURE;
+        } else if (name == "--time-scale") {
+            options.time_scale = float(std::atof(value.c_str()));
+        } else if (name == "--out") {
+            options.out = value;
+        } else {
+            util::log("unknown option %s", name.c_str());
+        }
+    }
+    return options;
+}
+
+} // namespace
+
+class GpuBenchApp : public App {
+public:
+    void setup() override;
+    void update() override;
+    void draw() override {}
+
+private:
+    void runConfig(int scenario, int particles, int grid_res, int cell_indexing,
+                   bool symmetric_pairs);
+
+    Options options_;
+    FILE* csv_;
+};
+
+void GpuBenchApp::setup() {
+    getWindow()->hide();
+    options_ = parseOptions(getCommandLineArgs());
+
+    csv_ = std::fopen(options_.out.c_str(), "w");
+    if (!csv_) {
+        util::log("could not open %s", options_.out.c_str());
+        quit();
+        return;
+    }
+
+    std::fprintf(csv_, "scenario,indexing,pairs,particles,grid_res,steps_per_sec,memory_mb,"
+                       "pressure_iterations,awake_particles,setup_ms,shaders_compiled,"
+                       "shaders_loaded,dispatches,barriers");
+    for (const char* pass : PASSES) {
+        std::fprintf(csv_, ",%s ms", pass);
+    }
+    std::fprintf(csv_, "\n");
+}
+
+/**
+ * Runs the whole sweep in the first frame, nothing is drawn
+ */
+void GpuBenchApp::update() {
+    if (!csv_) {
+        return;
+    }
+
+    for (int scenario : options_.scenarios) {
+        for (int particles : options_.particles) {
+            for (int grid_res : options_.grid_res) {
+                for (bool symmetric_pairs : options_.pairs) {
+                    for (int cell_indexing : options_.indexing) {
+                        runConfig(scenario, particles, grid_res, cell_indexing, symmetric_pairs);
+                    }
+                }
+            }
+        }
+    }
+
+    std::fclose(csv_);
+    csv_ = nullptr;
+    util::log("wrote %s", options_.out.c_str());
+    ShaderCache::get()->clear();
+    quit();
+}
+
+void GpuBenchApp::runConfig(int scenario, int particles, int grid_res, int cell_indexing,
+                            bool symmetric_pairs) {
+    FluidRef fluid = Fluid::create("fluid")
+                         ->scenario(scenario)
+                         ->seed(options_.seed)
+                         ->numParticles(particles)
+                         ->gridRes(grid_res)
+                         ->cellIndexing(cell_indexing)
+                         ->symmetricPairs(symmetric_pairs)
+                         ->neighborLists(options_.neighbor_lists)
+                         ->cellTiling(options_.cell_tiling)
+                         ->adaptiveTimestep(options_.adaptive_timestep)
+                         ->sdfBoundary(options_.sdf_boundary)
+                         ->sleeping(options_.sleeping)
+                         ->fusedSort(options_.fused_sort)
+                         ->pressureSolver(options_.pressure_solver)
+                         ->timeScale(options_.time_scale);
+    // the first config of a run shows the cold start, later ones reuse or load the programs
+    const auto setup_start = std::chrono::high_resolution_clock::now();
+    fluid->setup();
+    const double setup_ms = std::chrono::duration<double, std::milli>(
+                                std::chrono::high_resolution_clock::now() - setup_start)
+                                .count();
+    ShaderCacheRef shader_cache = ShaderCache::get();
+
+    // fixed step so every run integrates the same simulated time, unless it is adaptive
+    const double time_step = 1.0 / 60.0;
+    for (int i = 0; i < options_.warmup; i++) {
+        fluid->update(time_step);
+    }
+
+    ProfilerRef profiler = fluid->getProfiler();
+    profiler->finish();
+    profiler->resetTotals();
+
+    glFinish();
+    const auto start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < options_.steps; i++) {
+        fluid->update(time_step);
+    }
+    glFinish();
+    const auto end = std::chrono::high_resolution_clock::now();
+    const double seconds = std::chrono::duration<double>(end - start).count();
+    profiler->finish();
+
+    std::fprintf(csv_, "%s,%s,%s,%d,%d,%.3f,%.1f,%d,%d,%.1f,%d,%d,%d,%d",
+                 scenario::name(scenario).c_str(), grid::indexingName(cell_indexing).c_str(),
+                 symmetric_pairs ? "symmetric" : "gather", particles, grid_res,
+                 double(options_.steps) / seconds, double(fluid->memoryUsage()) / (1 << 20),
+                 fluid->getPressureIterations(), fluid->getAwakeParticles(), setup_ms,
+                 shader_cache->numCompiled(), shader_cache->numLoaded(),
+                 fluid->getStepDispatches(), fluid->getStepBarriers());
+    for (const char* pass : PASSES) {
+        std::fprintf(csv_, ",%.4f", profiler->getMean(pass));
+    }
+    std::fprintf(csv_, "\n");
+    std::fflush(csv_);
+}
+
+CINDER_APP(GpuBenchApp, RendererGl, [](App::Settings* settings) {
+    settings->setWindowSize(64, 64);
+    settings->setConsoleWindowEnabled();
+})
@@ -0,0 +1,526 @@
+/**
+ * Headless CPU benchmark - sweeps scenarios, particle counts, grid resolutions, cell indexing
+ * modes, neighbor kernel instruction sets and gathered vs symmetric pair evaluation. Prints one
+ * CSV row per configuration to stdout. With --kernels 1 it instead times the scalar and SIMD
+ * neighbor kernels alone on the same sorted particles.
+ */
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "CpuSolver.h"
+#include "Scenario.h"
+#include "grid.h"
+
+using namespace core;
+
+namespace {
+
+const double PI = 3.14159265358979323846;
+const int PAGE_SIZE = 4096;
+const float PARTICLE_RADIUS = 0.01f;
+// particle counts swept unless --particles picks others
+const std::vector<int> DEFAULT_PARTICLES = {10000, 50000, 200000, 500000, 1000000, 2000000};
+
+/**
+ * Every list option runs the full cross product of its values with the other lists
+ */
+struct Options {
+    Options()
+        : scenarios({scenario::DAM_BREAK}), particles(DEFAULT_PARTICLES), grid_res({21}),
+          indexing({grid::ROW_MAJOR_INDEXING, grid::MORTON_INDEXING, grid::HASHED_INDEXING}),
+          pairs({false, true}), isas({simd::AUTO_KERNELS}), threads({0}), steps(50), warmup(5),
+          seed(0), access_stats(true), kernels(false) {}
+    std::vector<int> scenarios;
+    std::vector<int> particles;
+    std::vector<int> grid_res;
+    std::vector<int> indexing;
+    std::vector<bool> pairs;
+    std::vector<int> isas;
+    // 0 uses every hardware thread
+    std::vector<int> threads;
+    int steps;
+    int warmup;
+    unsigned seed;
+    // the neighbor access statistics walk every particle's neighborhood once per row
+    bool access_stats;
+    // kernel microbenchmark instead of whole steps
+    bool kernels;
+};
+
+/**
+ * One point of the sweep
+ */
+struct Config {
+    int scenario;
+    int particles;
+    int grid_res;
+    int cell_indexing;
+    bool symmetric_pairs;
+    int isa;
+    int threads;
+};
+
+/**
+ * Cache behaviour of the neighbor loops for one sorted particle state
+ */
+struct NeighborStats {
+    NeighborStats() : stride_bytes(0), runs(0), pages(0) {}
+    // mean distance between a particle and the start of each neighbor bin
+    double stride_bytes;
+    // mean number of contiguous particle ranges read per particle
+    double runs;
+    // mean number of distinct 4KB pages read per particle
+    double pages;
+};
+
+/**
+ * Same derived constants as Fluid::setup with its default parameters
+ */
+SolverParams defaultParams(int grid_res, int cell_indexing) {
+    SolverParams params;
+    params.size = 1.0f;
+    params.grid_res = grid_res;
+    params.cell_indexing = cell_indexing;
+    params.bin_size = params.size / float(grid_res);
+    params.kernel_radius = PARTICLE_RADIUS * 4.0f;
+    params.particle_mass = PARTICLE_RADIUS * 8.0f;
+    params.stiffness = 100.0f;
+    params.rest_density = 500.0f;
+    params.rest_pressure = 0.0f;
+    params.viscosity_coefficient = 200.0f;
+    params.gravity = glm::vec3(0, -900.0f, 0);
+    params.dt = (1.0f / 60.0f) * 0.012f;
+    params.poly6_kernel_const =
+        float(315.0 / (64.0 * PI * std::pow(double(params.kernel_radius), 9)));
+    params.spiky_kernel_const = float(-45.0 / (PI * std::pow(double(params.kernel_radius), 6)));
+    params.viscosity_kernel_const = float(45.0 / (PI * std::pow(double(params.kernel_radius), 6)));
+    // point the mouse ray away from the container
+    params.mouse_origin = glm::vec3(-10.0f);
+    params.mouse_direction = glm::vec3(-1, 0, 0);
+    return params;
+}
+
+NeighborStats measureNeighborAccess(const std::vector<Particle>& sorted,
+                                    const std::vector<uint32_t>& counts,
+                                    const std::vector<uint32_t>& offsets,
+                                    const SolverParams& params) {
+    const int n = int(sorted.size());
+    const int64_t particle_size = sizeof(Particle);
+    const int num_bins = int(counts.size());
+    NeighborStats stats;
+
+    std::vector<std::pair<uint32_t, uint32_t>> ranges;
+    std::vector<int64_t> pages;
+
+    for (int i = 0; i < n; i++) {
+        const glm::ivec3 coord =
+            glm::clamp(glm::ivec3(sorted[i].position / params.bin_size), glm::ivec3(0),
+                       glm::ivec3(params.grid_res - 1));
+
+        ranges.clear();
+        for (int dz = -1; dz <= 1; dz++) {
+            for (int dy = -1; dy <= 1; dy++) {
+                for (int dx = -1; dx <= 1; dx++) {
+                    const glm::ivec3 nc = coord + glm::ivec3(dx, dy, dz);
+                    if (nc.x < 0 || nc.y < 0 || nc.z < 0 || nc.x >= params.grid_res ||
+                        nc.y >= params.grid_res || nc.z >= params.grid_res) {
+                        continue;
+                    }
+
+                    const uint32_t index = grid::cellIndex(nc, params.grid_res,
+                                                           params.cell_indexing, num_bins);
+                    if (counts[index] == 0) {
+                        continue;
+                    }
+
+                    ranges.push_back(
+                        std::make_pair(offsets[index], offsets[index] + counts[index]));
+                    stats.stride_bytes += std::abs(int64_t(offsets[index]) - i) * particle_size;
+                }
+            }
+        }
+
+        // merge adjacent ranges into contiguous runs
+        std::sort(ranges.begin(), ranges.end());
+        int runs = 0;
+        uint32_t run_end = 0;
+        pages.clear();
+        for (const auto& range : ranges) {
+            if (runs == 0 || range.first != run_end) {
+                runs++;
+            }
+            run_end = range.second;
+
+            const int64_t first_page = range.first * particle_size / PAGE_SIZE;
+            const int64_t last_page = (range.second * particle_size - 1) / PAGE_SIZE;
+            for (int64_t page = first_page; page <= last_page; page++) {
+                pages.push_back(page);
+            }
+        }
+        std::sort(pages.begin(), pages.end());
+
+        stats.runs += runs;
+        stats.pages += double(std::unique(pages.begin(), pages.end()) - pages.begin());
+    }
+
+    stats.stride_bytes /= std::max(1.0, stats.runs);
+    stats.runs /= std::max(n, 1);
+    stats.pages /= std::max(n, 1);
+    return stats;
+}
+
+void runConfig(const Options& options, const Config& config) {
+    SolverParams params = defaultParams(config.grid_res, config.cell_indexing);
+    params.symmetric_pairs = config.symmetric_pairs;
+
+    CpuSolverRef solver = CpuSolver::create()->kernelIsa(config.isa);
+    if (config.threads > 0) {
+        solver = solver->numThreads(config.threads);
+    }
+    solver->setup(config.particles, config.grid_res, config.cell_indexing);
+
+    std::vector<Particle> particles = scenario::generate(
+        config.scenario, config.particles, params.size, PARTICLE_RADIUS, options.seed);
+    for (int i = 0; i < options.warmup; i++) {
+        solver->step(particles, params);
+    }
+
+    const uint64_t warmup_pairs = solver->numPairEvaluations();
+    solver->resetTimings();
+    TaskSchedulerRef scheduler = solver->getScheduler();
+    scheduler->resetStats();
+    const auto start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < options.steps; i++) {
+        solver->step(particles, params);
+    }
+    const auto end = std::chrono::high_resolution_clock::now();
+    const double seconds = std::chrono::duration<double>(end - start).count();
+
+    const SolverTimings& timings = solver->getTimings();
+    const double steps = std::max(timings.steps, 1);
+    const double utilization = scheduler->meanUtilization();
+    const double min_utilization = scheduler->minUtilization();
+    const double steals_per_step = double(scheduler->numSteals()) / steps;
+    const double memory_mb =
+        double(particles.capacity() * sizeof(Particle) + solver->memoryUsage()) / (1 << 20);
+
+    // the gathering loops see every pair from both sides, symmetric evaluation once
+    const double pairs_per_step =
+        double(solver->numPairEvaluations() - warmup_pairs) / std::max(options.steps, 1);
+    const double saved_per_step = config.symmetric_pairs ? pairs_per_step : 0.0;
+
+    NeighborStats stats;
+    if (options.access_stats) {
+        std::vector<Particle> sorted;
+        solver->sort(particles, sorted, params);
+        stats = measureNeighborAccess(sorted, solver->getCounts(), solver->getOffsets(), params);
+    }
+
+    std::printf("%s,%s,%s,%s,%d,%d,%d,%d,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.1f,%.0f,%.0f,%.1f,"
+                "%.2f,%.2f\n",
+                scenario::name(config.scenario).c_str(),
+                grid::indexingName(config.cell_indexing).c_str(),
+                config.symmetric_pairs ? "symmetric" : "gather",
+                simd::name(solver->kernelIsa()).c_str(), config.particles, config.grid_res,
+                int(solver->getCounts().size()), solver->numThreads(),
+                double(options.steps) / seconds, utilization, min_utilization, steals_per_step,
+                timings.sort_ms / steps, timings.density_ms / steps, timings.update_ms / steps,
+                memory_mb, pairs_per_step, saved_per_step, stats.stride_bytes, stats.runs,
+                stats.pages);
+    std::fflush(stdout);
+}
+
+/**
+ * Neighbor bins of every particle, gathered up front so the kernel timings leave out the grid
+ * lookups
+ */
+struct KernelCall {
+    uint32_t i;
+    uint32_t first;
+    uint32_t last;
+    glm::ivec3 bin;
+};
+
+/**
+ * Times each supported kernel instruction set single threaded over the same sorted particles,
+ * reports its speedup over the scalar kernels and the largest difference from their results
+ * relative to the largest scalar value
+ */
+void runKernels(const Options& options, const Config& config) {
+    const SolverParams params = defaultParams(config.grid_res, config.cell_indexing);
+    const simd::KernelParams k = CpuSolver::kernelParams(params);
+
+    CpuSolverRef solver = CpuSolver::create()->numThreads(1);
+    solver->setup(config.particles, config.grid_res, config.cell_indexing);
+
+    // a few steps so the velocities, densities and pressures are not all uniform
+    std::vector<Particle> particles = scenario::generate(
+        config.scenario, config.particles, params.size, PARTICLE_RADIUS, options.seed);
+    for (int i = 0; i < options.warmup; i++) {
+        solver->step(particles, params);
+    }
+
+    std::vector<Particle> sorted;
+    solver->sort(particles, sorted, params);
+    solver->computeDensity(sorted, params);
+
+    const int n = int(sorted.size());
+    simd::Streams streams;
+    streams.resize(n);
+    streams.assign(sorted, 0, n);
+
+    const std::vector<uint32_t>& counts = solver->getCounts();
+    const std::vector<uint32_t>& offsets = solver->getOffsets();
+    std::vector<KernelCall> calls;
+    uint64_t candidates = 0;
+    for (int i = 0; i < n; i++) {
+        const glm::ivec3 coord =
+            glm::clamp(glm::ivec3(sorted[i].position / params.bin_size), glm::ivec3(0),
+                       glm::ivec3(params.grid_res - 1));
+        for (int dz = -1; dz <= 1; dz++) {
+            for (int dy = -1; dy <= 1; dy++) {
+                for (int dx = -1; dx <= 1; dx++) {
+                    KernelCall call;
+                    call.bin = coord + glm::ivec3(dx, dy, dz);
+                    const glm::ivec3& c = call.bin;
+                    if (c.x < 0 || c.y < 0 || c.z < 0 || c.x >= params.grid_res ||
+                        c.y >= params.grid_res || c.z >= params.grid_res) {
+                        continue;
+                    }
+
+                    const uint32_t index = grid::cellIndex(
+                        c, params.grid_res, params.cell_indexing, int(counts.size()));
+                    call.i = uint32_t(i);
+                    call.first = offsets[index];
+                    call.last = offsets[index] + counts[index];
+                    candidates += call.last - call.first;
+                    calls.push_back(call);
+                }
+            }
+        }
+    }
+
+    typedef std::chrono::high_resolution_clock Clock;
+    const int repeats = std::max(options.steps, 1);
+    double scalar_density_ms = 0;
+    double scalar_forces_ms = 0;
+    std::vector<float> scalar_densities;
+    std::vector<glm::vec3> scalar_forces;
+
+    for (int isa = simd::SCALAR_KERNELS; isa < simd::NUM_KERNEL_ISAS; isa++) {
+        if (!simd::supported(isa)) {
+            continue;
+        }
+        const simd::Kernels kernels = simd::kernels(isa);
+
+        std::vector<float> densities(n);
+        auto start = Clock::now();
+        for (int r = 0; r < repeats; r++) {
+            std::fill(densities.begin(), densities.end(), 0.0f);
+            for (const KernelCall& call : calls) {
+                densities[call.i] +=
+                    kernels.density(streams, k, call.i, call.first, call.last, call.bin);
+            }
+        }
+        const double density_ms =
+            std::chrono::duration<double, std::milli>(Clock::now() - start).count() / repeats;
+
+        std::vector<glm::vec3> pressure_forces(n);
+        std::vector<glm::vec3> viscosity_forces(n);
+        uint64_t pairs = 0;
+        start = Clock::now();
+        for (int r = 0; r < repeats; r++) {
+            std::fill(pressure_forces.begin(), pressure_forces.end(), glm::vec3(0));
+            std::fill(viscosity_forces.begin(), viscosity_forces.end(), glm::vec3(0));
+            pairs = 0;
+            for (const KernelCall& call : calls) {
+                pairs += kernels.forces(streams, k, call.i, call.first, call.last, call.bin,
+                                        pressure_forces[call.i], viscosity_forces[call.i]);
+            }
+        }
+        const double forces_ms =
+            std::chrono::duration<double, std::milli>(Clock::now() - start).count() / repeats;
+
+        std::vector<glm::vec3> forces(n);
+        for (int i = 0; i < n; i++) {
+            forces[i] = pressure_forces[i] + viscosity_forces[i] * params.viscosity_coefficient;
+        }
+        if (isa == simd::SCALAR_KERNELS) {
+            scalar_density_ms = density_ms;
+            scalar_forces_ms = forces_ms;
+            scalar_densities = densities;
+            scalar_forces = forces;
+        }
+
+        double density_error = 0, density_scale = 0;
+        double force_error = 0, force_scale = 0;
+        for (int i = 0; i < n; i++) {
+            density_error = std::max(density_error,
+                                     double(std::abs(densities[i] - scalar_densities[i])));
+            density_scale = std::max(density_scale, double(std::abs(scalar_densities[i])));
+            force_error = std::max(force_error, double(glm::length(forces[i] - scalar_forces[i])));
+            force_scale = std::max(force_scale, double(glm::length(scalar_forces[i])));
+        }
+
+        std::printf("%s,%s,%d,%d,%s,%llu,%llu,%.3f,%.3f,%.2f,%.2f,%.2e,%.2e\n",
+                    scenario::name(config.scenario).c_str(),
+                    grid::indexingName(config.cell_indexing).c_str(), config.particles,
+                    config.grid_res, simd::name(isa).c_str(), (unsigned long long)candidates,
+                    (unsigned long long)pairs, density_ms, forces_ms,
+                    scalar_density_ms / density_ms, scalar_forces_ms / forces_ms,
+                    density_error / std::max(density_scale, 1e-30),
+                    force_error / std::max(force_scale, 1e-30));
+        std::fflush(stdout);
+    }
+}
+
+std::vector<std::string> splitList(const std::string& value) {
+    std::vector<std::string> items;
+    std::stringstream stream(value);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        if (!item.empty()) {
+            items.push_back(item);
+        }
+    }
+    return items;
+}
+
+std::vector<int> parseInts(const std::string& value) {
+    std::vector<int> values;
+    for (const std::string& item : splitList(value)) {
+        values.push_back(std::atoi(item.c_str()));
+    }
+    return values;
+}
+
+/**
+ * Maps each comma separated name through parse, skipping the ones it rejects with -1
+ */
+template <typename T, typename F>
+std::vector<T> parseNames(const std::string& option, const std::string& value, F parse) {
+    std::vector<T> values;
+    for (const std::string& item : splitList(value)) {
+        const int parsed = parse(item);
+        if (parsed < 0) {
+            std::fprintf(stderr, "unknown %s value %s\n", option.c_str(), item.c_str());
+            continue;
+        }
+        values.push_back(T(parsed));
+    }
+    return values;
+}
+
+int indexingFromName(const std::string& name) {
+    for (int indexing : {grid::ROW_MAJOR_INDEXING, grid::MORTON_INDEXING,
+                         grid::HASHED_INDEXING}) {
+        if (grid::indexingName(indexing) == name) {
+            return indexing;
+        }
+    }
+    return -1;
+}
+
+int pairsFromName(const std::string& name) {
+    if (name == "gather") {
+        return 0;
+    }
+    return name == "symmetric" ? 1 : -1;
+}
+
+// auto is resolved here since parseNames treats -1 as unknown
+int isaFromName(const std::string& name) {
+    const int isa = simd::fromName(name);
+    return isa == simd::AUTO_KERNELS ? simd::detect() : isa;
+}
+
+Options parseOptions(int argc, char** argv) {
+    Options options;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        const std::string name = argv[i];
+        const std::string value = argv[i + 1];
+        const int number = std::atoi(value.c_str());
+        if (name == "--scenario") {
+            options.scenarios = parseNames<int>(name, value, scenario::fromName);
+        } else if (name == "--particles") {
+            options.particles = parseInts(value);
+        } else if (name == "--grid-res") {
+            options.grid_res = parseInts(value);
+        } else if (name == "--indexing") {
+            options.indexing = parseNames<int>(name, value, indexingFromName);
+        } else if (name == "--pairs") {
+            options.pairs = parseNames<bool>(name, value, pairsFromName);
+        } else if (name == "--simd") {
+            options.isas = parseNames<int>(name, value, isaFromName);
+        } else if (name == "--steps") {
+            options.steps = number;
+        } else if (name == "--warmup") {
+            options.warmup = number;
+        } else if (name == "--threads") {
+            options.threads = parseInts(value);
+        } else if (name == "--seed") {
+            options.seed = unsigned(number);
+        } else if (name == "--access-stats") {
+            options.access_stats = number != 0;
+        } else if (name == "--kernels") {
+            options.kernels = number != 0;
+        } else {
+            std::fprintf(stderr, "unknown option %s\n", name.c_str());
+        }
+    }
+    return options;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    const Options options = parseOptions(argc, argv);
+
+    if (options.kernels) {
+        std::printf("scenario,indexing,particles,grid_res,kernels,candidates,pairs,density_ms,"
+                    "forces_ms,density_speedup,forces_speedup,density_error,force_error\n");
+    } else {
+        std::printf("scenario,indexing,pairs,kernels,particles,grid_res,bins,threads,"
+                    "steps_per_sec,utilization,min_utilization,steals_per_step,sort_ms,density_ms,"
+                    "update_ms,memory_mb,pair_evals_per_step,"
+                    "pair_evals_saved_per_step,neighbor_stride_bytes,runs_per_particle,"
+                    "pages_per_particle\n");
+    }
+
+    Config config;
+    for (int scenario : options.scenarios) {
+        for (int particles : options.particles) {
+            for (int grid_res : options.grid_res) {
+                for (int cell_indexing : options.indexing) {
+                    config.scenario = scenario;
+                    config.particles = particles;
+                    config.grid_res = grid_res;
+                    config.cell_indexing = cell_indexing;
+                    if (options.kernels) {
+                        runKernels(options, config);
+                        continue;
+                    }
+
+                    for (bool symmetric_pairs : options.pairs) {
+                        for (int isa : options.isas) {
+                            for (int threads : options.threads) {
+                                config.symmetric_pairs = symmetric_pairs;
+                                config.isa = isa;
+                                config.threads = threads;
+                                runConfig(options, config);
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+    return 0;
+}
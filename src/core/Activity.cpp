@@ -0,0 +1,270 @@
+#include "./Activity.h"
+
+#include <algorithm>
+
+using namespace core;
+
+namespace {
+
+// awake count copies in flight before the oldest one is read back
+const int COUNT_RING = 4;
+// the awake count follows the indirect dispatch size
+const GLintptr AWAKE_COUNT_OFFSET = 3 * sizeof(uint32_t);
+
+} // namespace
+
+Activity::Activity()
+    : num_items_(0), grid_res_(1), cell_indexing_(grid::ROW_MAJOR_INDEXING),
+      particle_layout_(AOS_LAYOUT), num_bins_(1), sleep_steps_(30), num_awake_(0),
+      count_slot_(0), bin_size_(1), sleep_speed_(0.05f), wake_radius_(0),
+      dynamic_particles_(false), specialize_(false), activity_buffer_(0), calm_buffer_(0),
+      count_buffer_(0) {}
+
+Activity::~Activity() {
+    for (GLsync fence : count_fences_) {
+        if (fence) {
+            glDeleteSync(fence);
+        }
+    }
+    glDeleteBuffers(1, &activity_buffer_);
+    glDeleteBuffers(1, &calm_buffer_);
+    glDeleteBuffers(1, &count_buffer_);
+}
+
+ActivityRef Activity::numItems(int n) {
+    num_items_ = n;
+    return thisRef();
+}
+
+ActivityRef Activity::gridRes(int r) {
+    grid_res_ = r;
+    return thisRef();
+}
+
+ActivityRef Activity::binSize(float s) {
+    bin_size_ = s;
+    return thisRef();
+}
+
+ActivityRef Activity::cellIndexing(int i) {
+    cell_indexing_ = i;
+    return thisRef();
+}
+
+ActivityRef Activity::particleLayout(int l) {
+    particle_layout_ = l;
+    return thisRef();
+}
+
+ActivityRef Activity::sleepSpeed(float s) {
+    sleep_speed_ = s;
+    return thisRef();
+}
+
+ActivityRef Activity::sleepSteps(int n) {
+    sleep_steps_ = n;
+    return thisRef();
+}
+
+ActivityRef Activity::wakeRadius(float r) {
+    wake_radius_ = r;
+    return thisRef();
+}
+
+ActivityRef Activity::dynamicParticles(bool enabled) {
+    dynamic_particles_ = enabled;
+    return thisRef();
+}
+
+ActivityRef Activity::specialize(bool enabled) {
+    specialize_ = enabled;
+    return thisRef();
+}
+
+/**
+ * Prepares shared memory buffers, every particle starts awake
+ */
+void Activity::prepareBuffers() {
+    util::log("preparing activity buffers");
+    num_bins_ = grid::numCells(grid_res_, cell_indexing_, num_items_);
+
+    // until the first update the dispatch covers every particle
+    std::vector<uint32_t> activity(4 + num_items_);
+    activity[0] = uint32_t((num_items_ + WORK_GROUP_SIZE - 1) / WORK_GROUP_SIZE);
+    activity[1] = 1;
+    activity[2] = 1;
+    activity[3] = uint32_t(num_items_);
+    for (int i = 0; i < num_items_; i++) {
+        activity[4 + i] = uint32_t(i);
+    }
+    glCreateBuffers(1, &activity_buffer_);
+    glNamedBufferStorage(activity_buffer_, activity.size() * sizeof(uint32_t), activity.data(),
+                         0);
+
+    const std::vector<uint32_t> zeros(std::max(num_bins_, COUNT_RING), 0);
+    glCreateBuffers(1, &calm_buffer_);
+    glNamedBufferStorage(calm_buffer_, num_bins_ * sizeof(uint32_t), zeros.data(), 0);
+
+    glCreateBuffers(1, &count_buffer_);
+    glNamedBufferStorage(count_buffer_, COUNT_RING * sizeof(uint32_t), zeros.data(), 0);
+    count_fences_.assign(COUNT_RING, nullptr);
+    num_awake_ = num_items_;
+}
+
+/**
+ * Compiles and prepares shader programs
+ */
+void Activity::compileShaders() {
+    util::log("compiling activity shaders");
+    std::vector<std::string> defines = {grid::indexingDefine(cell_indexing_, num_bins_),
+                                        layout::layoutDefine(particle_layout_)};
+    if (dynamic_particles_) {
+        defines.push_back("DYNAMIC_PARTICLES");
+    }
+    if (specialize_) {
+        defines.push_back(util::constantDefine("GRID_RES", grid_res_));
+    }
+
+    util::log("\tcompiling activity cell shader");
+    defines.push_back("ACTIVITY_CELLS");
+    cell_prog_ = util::compileComputeShader("fluid/activity.comp", defines);
+
+    util::log("\tcompiling activity particle shader");
+    defines.back() = "ACTIVITY_PARTICLES";
+    particle_prog_ = util::compileComputeShader("fluid/activity.comp", defines);
+
+    util::log("\tcompiling activity dispatch shader");
+    defines.back() = "ACTIVITY_DISPATCH";
+    dispatch_prog_ = util::compileComputeShader("fluid/activity.comp", defines);
+}
+
+/**
+ * Bind the particle positions and velocities, the whole buffer for the AOS layout
+ */
+void Activity::bindParticles(GLuint particle_buffer) {
+    if (particle_layout_ == SOA_LAYOUT) {
+        util::bindParticleStream(0, particle_buffer, POSITION_STREAM, num_items_);
+        util::bindParticleStream(3, particle_buffer, VELOCITY_STREAM, num_items_);
+    } else {
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, particle_buffer);
+    }
+}
+
+/**
+ * Run the per bin calm step count
+ */
+void Activity::runCellProg(GLuint particle_buffer, GLuint count_buffer, GLuint offset_buffer) {
+    gl::ScopedGlslProg prog(cell_prog_);
+    bindParticles(particle_buffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, count_buffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, offset_buffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 18, activity_buffer_);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 19, calm_buffer_);
+
+    cell_prog_->uniform("numBins", num_bins_);
+    cell_prog_->uniform("sleepSpeed", sleep_speed_);
+    cell_prog_->uniform("sleepSteps", uint32_t(sleep_steps_));
+
+    util::runProg(int(ceil(float(num_bins_) / float(WORK_GROUP_SIZE))));
+    util::memoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+/**
+ * Run the per particle wake check, appends the awake particles to the list
+ */
+void Activity::runParticleProg(GLuint particle_buffer, vec3 mouse_origin,
+                               vec3 mouse_direction) {
+    gl::ScopedGlslProg prog(particle_prog_);
+    bindParticles(particle_buffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 18, activity_buffer_);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 19, calm_buffer_);
+
+    particle_prog_->uniform("binSize", bin_size_);
+    particle_prog_->uniform("gridRes", grid_res_);
+    particle_prog_->uniform("numParticles", num_items_);
+    particle_prog_->uniform("sleepSteps", uint32_t(sleep_steps_));
+    particle_prog_->uniform("cameraPosition", mouse_origin);
+    particle_prog_->uniform("mouseRayDirection", mouse_direction);
+    particle_prog_->uniform("wakeRadius", wake_radius_);
+
+    util::runProg(int(ceil(float(num_items_) / float(WORK_GROUP_SIZE))));
+    util::memoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+/**
+ * Size the indirect dispatch by the awake count
+ */
+void Activity::runDispatchProg() {
+    gl::ScopedGlslProg prog(dispatch_prog_);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 18, activity_buffer_);
+
+    util::runProg(1);
+    util::memoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+}
+
+/**
+ * main logic - rebuild the awake list from the sorted particles and their grid
+ */
+void Activity::update(GLuint particle_buffer, GLuint count_buffer, GLuint offset_buffer,
+                      vec3 mouse_origin, vec3 mouse_direction) {
+    runCellProg(particle_buffer, count_buffer, offset_buffer);
+    runParticleProg(particle_buffer, mouse_origin, mouse_direction);
+    runDispatchProg();
+
+    readAwakeCount();
+
+    // a slot still pending after a full ring of steps is dropped
+    const int slot = count_slot_;
+    if (count_fences_[slot]) {
+        glDeleteSync(count_fences_[slot]);
+    }
+    glCopyNamedBufferSubData(activity_buffer_, count_buffer_, AWAKE_COUNT_OFFSET,
+                             slot * sizeof(uint32_t), sizeof(uint32_t));
+    count_fences_[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    count_slot_ = (slot + 1) % COUNT_RING;
+}
+
+/**
+ * Read the awake count copies whose fence has passed, oldest first, without waiting
+ */
+void Activity::readAwakeCount() {
+    for (int i = 0; i < COUNT_RING; i++) {
+        const int slot = (count_slot_ + i) % COUNT_RING;
+        GLsync& fence = count_fences_[slot];
+        if (!fence) {
+            continue;
+        }
+        if (glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED) {
+            break;
+        }
+
+        uint32_t count = 0;
+        glGetNamedBufferSubData(count_buffer_, slot * sizeof(uint32_t), sizeof(uint32_t), &count);
+        glDeleteSync(fence);
+        fence = nullptr;
+        num_awake_ = int(count);
+    }
+}
+
+/**
+ * Forget every calm step, for changes that move all of the fluid like rotating gravity
+ */
+void Activity::wakeAll() {
+    const uint32_t zero = 0;
+    glClearNamedBufferData(calm_buffer_, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+    util::memoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+}
+
+/**
+ * Bind the awake list for the density and update passes
+ */
+void Activity::bindAwake() {
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 18, activity_buffer_);
+}
+
+void Activity::dispatch() { util::runProgIndirect(activity_buffer_); }
+
+size_t Activity::memoryUsage() {
+    return util::bufferSize(activity_buffer_) + util::bufferSize(calm_buffer_) +
+           util::bufferSize(count_buffer_);
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <Windows.h>
+#include <memory>
+#include <vector>
+
+#include "cinder/app/App.h"
+#include "cinder/gl/Shader.h"
+#include "cinder/gl/gl.h"
+
+#include "./grid.h"
+#include "./util.h"
+
+using namespace ci;
+using namespace ci::app;
+
+namespace core {
+
+typedef std::shared_ptr<class Activity> ActivityRef;
+
+/**
+ * Puts fluid at rest to sleep. A bin is calm while all of its particles are slower than the
+ * sleep speed, and a particle sleeps once every bin of its neighborhood has been calm for the
+ * sleep steps. The awake particles are compacted into a list every step and the density and
+ * update passes are dispatched indirectly over it.
+ */
+class Activity {
+public:
+    Activity();
+    ~Activity();
+
+    ActivityRef numItems(int n);
+    ActivityRef gridRes(int r);
+    ActivityRef binSize(float s);
+    ActivityRef cellIndexing(int i);
+    ActivityRef particleLayout(int l);
+    ActivityRef sleepSpeed(float s);
+    ActivityRef sleepSteps(int n);
+    ActivityRef wakeRadius(float r);
+    // only the live particles at the front of the buffers are checked
+    ActivityRef dynamicParticles(bool enabled);
+    // fold gridRes into the shader variants instead of passing it as a uniform
+    ActivityRef specialize(bool enabled);
+
+    void prepareBuffers();
+    void compileShaders();
+    // find the awake particles of the sorted particles and their grid
+    void update(GLuint particle_buffer, GLuint count_buffer, GLuint offset_buffer,
+                vec3 mouse_origin, vec3 mouse_direction);
+    void wakeAll();
+    void bindAwake();
+    // run the bound program over the awake particles of the last update
+    void dispatch();
+
+    // awake particles of a recent step, read back without stalling
+    int numAwake() { return num_awake_; }
+    size_t memoryUsage();
+
+    static ActivityRef create() { return std::make_shared<Activity>(); }
+
+protected:
+    void bindParticles(GLuint particle_buffer);
+    void runCellProg(GLuint particle_buffer, GLuint count_buffer, GLuint offset_buffer);
+    void runParticleProg(GLuint particle_buffer, vec3 mouse_origin, vec3 mouse_direction);
+    void runDispatchProg();
+    void readAwakeCount();
+
+    ActivityRef thisRef() { return std::make_shared<Activity>(*this); }
+
+    int num_items_, grid_res_, cell_indexing_, particle_layout_, num_bins_;
+    int sleep_steps_, num_awake_, count_slot_;
+    float bin_size_, sleep_speed_, wake_radius_;
+    bool dynamic_particles_;
+    bool specialize_;
+
+    gl::GlslProgRef cell_prog_, particle_prog_, dispatch_prog_;
+
+    GLuint activity_buffer_, calm_buffer_;
+    // copies of the awake count, read back once their fence has passed
+    GLuint count_buffer_;
+    std::vector<GLsync> count_fences_;
+};
+
+} // namespace core
@@ -0,0 +1,174 @@
+#include "./Checkpoint.h"
+
+#include <cstdio>
+#include <cstring>
+
+#include "./util.h"
+
+using namespace core;
+
+Checkpoint::Checkpoint()
+    : file_(INVALID_HANDLE_VALUE), mapping_(nullptr), view_(nullptr), staging_buffer_(0),
+      staging_data_(nullptr), staging_fence_(nullptr), written_(false) {}
+
+/**
+ * Waits for the writer, only at exit
+ */
+Checkpoint::~Checkpoint() {
+    close();
+    if (writer_.joinable()) {
+        writer_.join();
+    }
+}
+
+/**
+ * Map the file read only and check the header and the ranges it points at
+ */
+bool Checkpoint::open(const std::string& path) {
+    close();
+
+    file_ = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                        FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file_ == INVALID_HANDLE_VALUE) {
+        util::log("could not open %s", path.c_str());
+        return false;
+    }
+
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file_, &file_size) || uint64_t(file_size.QuadPart) < sizeof(Header)) {
+        util::log("%s is too small to be a checkpoint", path.c_str());
+        close();
+        return false;
+    }
+
+    mapping_ = CreateFileMappingA(file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping_) {
+        view_ = static_cast<const uint8_t*>(MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0));
+    }
+    if (!view_) {
+        util::log("could not map %s", path.c_str());
+        close();
+        return false;
+    }
+
+    const Header& h = header();
+    const uint64_t bytes = uint64_t(file_size.QuadPart);
+    if (std::memcmp(h.magic, "WCCK", sizeof(h.magic)) != 0 || h.version != VERSION) {
+        util::log("%s is not a version %u checkpoint", path.c_str(), VERSION);
+        close();
+        return false;
+    }
+    if (h.particle_offset + h.particle_bytes > bytes || h.offset_offset + h.offset_bytes > bytes ||
+        h.offset_bytes != uint64_t(h.num_bins) * sizeof(uint32_t)) {
+        util::log("%s is truncated", path.c_str());
+        close();
+        return false;
+    }
+    return true;
+}
+
+void Checkpoint::close() {
+    if (view_) {
+        UnmapViewOfFile(view_);
+        view_ = nullptr;
+    }
+    if (mapping_) {
+        CloseHandle(mapping_);
+        mapping_ = nullptr;
+    }
+    if (file_ != INVALID_HANDLE_VALUE) {
+        CloseHandle(file_);
+        file_ = INVALID_HANDLE_VALUE;
+    }
+}
+
+/**
+ * Copy the particles and offsets into one mapped staging buffer and fence the copy, the file is
+ * written once update() sees the fence pass
+ */
+bool Checkpoint::save(const std::string& path, Header header, GLuint particle_buffer,
+                      GLuint offset_buffer) {
+    if (isSaving()) {
+        util::log("a checkpoint is still being saved, skipping %s", path.c_str());
+        return false;
+    }
+
+    layOut(header, uint64_t(util::bufferSize(particle_buffer)));
+
+    const GLsizeiptr size = GLsizeiptr(header.particle_bytes + header.offset_bytes);
+    const GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glCreateBuffers(1, &staging_buffer_);
+    glNamedBufferStorage(staging_buffer_, size, nullptr, flags | GL_CLIENT_STORAGE_BIT);
+    staging_data_ = static_cast<const uint8_t*>(
+        glMapNamedBufferRange(staging_buffer_, 0, size, flags));
+
+    glCopyNamedBufferSubData(particle_buffer, staging_buffer_, 0, 0,
+                             GLsizeiptr(header.particle_bytes));
+    glCopyNamedBufferSubData(offset_buffer, staging_buffer_, 0,
+                             GLintptr(header.particle_bytes), GLsizeiptr(header.offset_bytes));
+    staging_fence_ = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+    save_path_ = path;
+    save_header_ = header;
+    written_ = false;
+    util::log("saving checkpoint of %u particles to %s", header.num_particles, path.c_str());
+    return true;
+}
+
+void Checkpoint::update() {
+    if (!isSaving()) {
+        return;
+    }
+
+    if (staging_fence_) {
+        if (glClientWaitSync(staging_fence_, 0, 0) == GL_TIMEOUT_EXPIRED) {
+            return;
+        }
+        glDeleteSync(staging_fence_);
+        staging_fence_ = nullptr;
+        writer_ = std::thread(&Checkpoint::writeFile, this);
+        return;
+    }
+
+    if (written_) {
+        writer_.join();
+        glUnmapNamedBuffer(staging_buffer_);
+        glDeleteBuffers(1, &staging_buffer_);
+        staging_buffer_ = 0;
+        staging_data_ = nullptr;
+    }
+}
+
+void Checkpoint::layOut(Header& header, uint64_t particle_bytes) {
+    std::memcpy(header.magic, "WCCK", sizeof(header.magic));
+    header.version = VERSION;
+    header.particle_bytes = particle_bytes;
+    header.offset_bytes = uint64_t(header.num_bins) * sizeof(uint32_t);
+    header.particle_offset = sizeof(Header);
+    header.offset_offset = header.particle_offset + header.particle_bytes;
+    header.reserved[0] = header.reserved[1] = 0;
+}
+
+bool Checkpoint::write(const std::string& path, const Header& header, const void* data) {
+    std::FILE* file = std::fopen(path.c_str(), "wb");
+    if (!file) {
+        util::log("could not open %s", path.c_str());
+        return false;
+    }
+    const size_t data_bytes = size_t(header.particle_bytes + header.offset_bytes);
+    const bool written = std::fwrite(&header, sizeof(header), 1, file) == 1 &&
+                         std::fwrite(data, 1, data_bytes, file) == data_bytes;
+    if (std::fclose(file) != 0 || !written) {
+        util::log("could not write %s", path.c_str());
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Writer thread, the staging buffer already holds the particles followed by the offsets
+ */
+void Checkpoint::writeFile(Checkpoint* checkpoint) {
+    write(checkpoint->save_path_, checkpoint->save_header_, checkpoint->staging_data_);
+    checkpoint->written_ = true;
+}
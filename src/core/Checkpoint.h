@@ -0,0 +1,106 @@
+#pragma once
+
+#include <Windows.h>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "cinder/app/App.h"
+#include "cinder/gl/gl.h"
+
+using namespace ci;
+using namespace ci::app;
+
+namespace core {
+
+typedef std::shared_ptr<class Checkpoint> CheckpointRef;
+
+/**
+ * Snapshot of a running fluid to restart from. Loading maps the file and hands the mapped bytes
+ * straight to glNamedBufferStorage, so a restart costs one read of the file. Saving copies the
+ * buffers into a mapped staging buffer behind a fence and a thread writes the file once the
+ * copy is done, so neither the GPU nor the disk is waited on.
+ *
+ * File layout, little endian:
+ *   Header
+ *   the raw particle buffer in its layout, at particle_offset
+ *   the sort offset of every bin, at offset_offset
+ */
+class Checkpoint {
+public:
+    struct Header {
+        char magic[4]; // WCCK
+        uint32_t version;
+        uint32_t num_particles;
+        uint32_t particle_layout;
+        uint32_t grid_res;
+        uint32_t cell_indexing;
+        uint32_t num_bins;
+        uint32_t pressure_solver;
+        float size;
+        float particle_radius;
+        float viscosity_coefficient;
+        float stiffness;
+        float rest_density;
+        float rest_pressure;
+        float gravity_strength;
+        float time_scale;
+        float gravity_direction[4];
+        double simulated_time;
+        uint64_t particle_offset;
+        uint64_t particle_bytes;
+        uint64_t offset_offset;
+        uint64_t offset_bytes;
+        // keeps the particles 16 byte aligned
+        uint32_t reserved[2];
+    };
+
+    static const uint32_t VERSION = 1;
+
+    Checkpoint();
+    ~Checkpoint();
+
+    // map the file, false unless it is a checkpoint of this version
+    bool open(const std::string& path);
+    void close();
+    bool isOpen() { return view_ != nullptr; }
+    const Header& header() { return *reinterpret_cast<const Header*>(view_); }
+    const void* particles() { return view_ + header().particle_offset; }
+    const uint32_t* offsets() {
+        return reinterpret_cast<const uint32_t*>(view_ + header().offset_offset);
+    }
+
+    // the buffer sizes and offsets of the header are filled in here
+    bool save(const std::string& path, Header header, GLuint particle_buffer,
+              GLuint offset_buffer);
+    // start the writer once the copy is done and release it once it finished, never waits
+    void update();
+    bool isSaving() { return staging_buffer_ != 0; }
+
+    // fill in the magic, the version and where the particles and offsets go after the header
+    static void layOut(Header& header, uint64_t particle_bytes);
+    // the header followed by data, which holds the particles and then the offsets
+    static bool write(const std::string& path, const Header& header, const void* data);
+
+    static CheckpointRef create() { return std::make_shared<Checkpoint>(); }
+
+protected:
+    static void writeFile(Checkpoint* checkpoint);
+
+    // open checkpoint
+    HANDLE file_, mapping_;
+    const uint8_t* view_;
+
+    // checkpoint being saved
+    std::string save_path_;
+    Header save_header_;
+    GLuint staging_buffer_;
+    const uint8_t* staging_data_;
+    GLsync staging_fence_;
+    std::thread writer_;
+    std::atomic<bool> written_;
+};
+
+} // namespace core
@@ -0,0 +1,663 @@
+#include "./CpuSolver.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <thread>
+
+using namespace core;
+
+namespace {
+
+const float MAX_SPEED = 50.0f;
+const float WALL_DAMPING = 0.3f;
+const float BORDER = 0.001f;
+// tasks per thread in each pass, more give the scheduler more to balance with
+const int TASKS_PER_THREAD = 8;
+
+// neighborhood coordinate offsets, same order as the shaders
+const glm::ivec3 NEIGHBORHOOD[27] = {
+    glm::ivec3(-1, -1, -1), glm::ivec3(-1, -1, 0), glm::ivec3(-1, -1, 1),
+    glm::ivec3(-1, 0, -1),  glm::ivec3(-1, 0, 0),  glm::ivec3(-1, 0, 1),
+    glm::ivec3(-1, 1, -1),  glm::ivec3(-1, 1, 0),  glm::ivec3(-1, 1, 1),
+    glm::ivec3(0, -1, -1),  glm::ivec3(0, -1, 0),  glm::ivec3(0, -1, 1),
+    glm::ivec3(0, 0, -1),   glm::ivec3(0, 0, 0),   glm::ivec3(0, 0, 1),
+    glm::ivec3(0, 1, -1),   glm::ivec3(0, 1, 0),   glm::ivec3(0, 1, 1),
+    glm::ivec3(1, -1, -1),  glm::ivec3(1, -1, 0),  glm::ivec3(1, -1, 1),
+    glm::ivec3(1, 0, -1),   glm::ivec3(1, 0, 0),   glm::ivec3(1, 0, 1),
+    glm::ivec3(1, 1, -1),   glm::ivec3(1, 1, 0),   glm::ivec3(1, 1, 1)};
+
+// the 13 neighbors after the center bin in z, y, x order, each bin pair is visited once
+const glm::ivec3 HALF_SHELL[13] = {
+    glm::ivec3(1, 0, 0),   glm::ivec3(-1, 1, 0), glm::ivec3(0, 1, 0),  glm::ivec3(1, 1, 0),
+    glm::ivec3(-1, -1, 1), glm::ivec3(0, -1, 1), glm::ivec3(1, -1, 1), glm::ivec3(-1, 0, 1),
+    glm::ivec3(0, 0, 1),   glm::ivec3(1, 0, 1),  glm::ivec3(-1, 1, 1), glm::ivec3(0, 1, 1),
+    glm::ivec3(1, 1, 1)};
+
+bool inGrid(const glm::ivec3& c, int grid_res) {
+    return c.x >= 0 && c.y >= 0 && c.z >= 0 && c.x < grid_res && c.y < grid_res &&
+           c.z < grid_res;
+}
+
+} // namespace
+
+CpuSolver::CpuSolver()
+    : num_bins_(0), cell_indexing_(grid::ROW_MAJOR_INDEXING), num_pair_evaluations_(0) {
+    scheduler_ = TaskScheduler::create(int(std::thread::hardware_concurrency()));
+    kernel_isa_ = simd::detect();
+    kernels_ = simd::kernels(kernel_isa_);
+}
+
+CpuSolverRef CpuSolver::numThreads(int n) {
+    scheduler_ = TaskScheduler::create(n);
+    return thisRef();
+}
+
+CpuSolverRef CpuSolver::kernelIsa(int isa) {
+    kernel_isa_ = simd::resolve(isa);
+    kernels_ = simd::kernels(kernel_isa_);
+    return thisRef();
+}
+
+/**
+ * Allocate grid and scratch storage
+ */
+void CpuSolver::setup(int num_particles, int grid_res, int cell_indexing) {
+    cell_indexing_ = cell_indexing;
+    num_bins_ = grid::numCells(grid_res, cell_indexing, num_particles);
+    counts_.assign(num_bins_, 0);
+    offsets_.assign(num_bins_, 0);
+    cell_ids_.assign(num_particles, 0);
+    sorted_.assign(num_particles, Particle());
+    pair_forces_.assign(num_particles, glm::vec3(0));
+    streams_.resize(num_particles);
+    num_pair_evaluations_ = 0;
+}
+
+/**
+ * Split [0, n) into equal ranges, a few per thread, and run func(begin, end) on each
+ */
+template <typename F> void CpuSolver::parallelFor(int n, F func) {
+    const int num_tasks = std::min(scheduler_->numThreads() * TASKS_PER_THREAD, std::max(n, 1));
+    if (num_tasks == 1) {
+        func(0, n);
+        return;
+    }
+
+    scheduler_->run(num_tasks, [&](int task, int) {
+        func(int(int64_t(n) * task / num_tasks), int(int64_t(n) * (task + 1) / num_tasks));
+    });
+}
+
+/**
+ * One contiguous range of particles per thread, for passes that keep state per range
+ */
+int CpuSolver::numThreadChunks(int n) {
+    return std::min(scheduler_->numThreads(), std::max(n, 1));
+}
+
+/**
+ * Split [0, n) into numThreadChunks(n) equal ranges and run func(chunk, begin, end) on each
+ */
+template <typename F> void CpuSolver::parallelForThreadChunks(int n, F func) {
+    const int num_chunks = numThreadChunks(n);
+    scheduler_->run(num_chunks, [&](int chunk, int) {
+        func(chunk, int(int64_t(n) * chunk / num_chunks),
+             int(int64_t(n) * (chunk + 1) / num_chunks));
+    });
+}
+
+/**
+ * Run func(begin, end) on the bin chunks of the last sort. Falls back to equal ranges for
+ * particles that sort didn't produce.
+ */
+template <typename F> void CpuSolver::parallelForCells(int n, F func) {
+    if (cell_chunks_.size() < 2 || int(cell_chunks_.back()) != n) {
+        parallelFor(n, func);
+        return;
+    }
+
+    scheduler_->run(int(cell_chunks_.size()) - 1, [&](int task, int) {
+        func(int(cell_chunks_[task]), int(cell_chunks_[task + 1]));
+    });
+}
+
+/**
+ * Group consecutive bins into chunks of about n / tasks particles. A bin is never split, so a
+ * crowded bin makes a chunk of its own and the scheduler balances what remains.
+ */
+void CpuSolver::buildCellChunks(int n) {
+    const int num_tasks = scheduler_->numThreads() * TASKS_PER_THREAD;
+    const uint32_t target = uint32_t(std::max(1, n / num_tasks));
+
+    cell_chunks_.assign(1, 0);
+    uint32_t chunk_size = 0;
+    for (int b = 0; b < num_bins_; b++) {
+        chunk_size += counts_[b];
+        if (chunk_size >= target) {
+            cell_chunks_.push_back(offsets_[b] + counts_[b]);
+            chunk_size = 0;
+        }
+    }
+    if (cell_chunks_.back() != uint32_t(n)) {
+        cell_chunks_.push_back(uint32_t(n));
+    }
+}
+
+glm::ivec3 CpuSolver::cellCoord(const glm::vec3& p, const SolverParams& params) {
+    return glm::clamp(glm::ivec3(p / params.bin_size), glm::ivec3(0),
+                      glm::ivec3(params.grid_res - 1));
+}
+
+uint32_t CpuSolver::cellIndex(const glm::ivec3& c, const SolverParams& params) {
+    return grid::cellIndex(c, params.grid_res, params.cell_indexing, num_bins_);
+}
+
+/**
+ * Mirrors inBin() in common/grid.glsl, bins sharing a hash slot are told apart by coordinate
+ */
+bool CpuSolver::inBin(const glm::vec3& p, const glm::ivec3& c, const SolverParams& params) {
+    return params.cell_indexing != grid::HASHED_INDEXING || cellCoord(p, params) == c;
+}
+
+/**
+ * Constants the neighbor kernels need for one step
+ */
+simd::KernelParams CpuSolver::kernelParams(const SolverParams& params) {
+    simd::KernelParams k;
+    k.particle_mass = params.particle_mass;
+    k.kernel_radius = params.kernel_radius;
+    k.poly6_kernel_const = params.poly6_kernel_const;
+    k.spiky_kernel_const = params.spiky_kernel_const;
+    k.viscosity_kernel_const = params.viscosity_kernel_const;
+    k.check_bin = params.cell_indexing == grid::HASHED_INDEXING;
+    k.bin_size = params.bin_size;
+    k.grid_res = params.grid_res;
+    return k;
+}
+
+/**
+ * Copy the sorted particles into the per component streams read by the neighbor kernels
+ */
+void CpuSolver::fillStreams(const std::vector<Particle>& particles) {
+    if (streams_.size() != int(particles.size())) {
+        streams_.resize(int(particles.size()));
+    }
+    parallelFor(int(particles.size()),
+                [&](int begin, int end) { streams_.assign(particles, begin, end); });
+}
+
+// Equation (10) from Harada
+float CpuSolver::poly6Kernel(float r, const SolverParams& params) {
+    const float h = params.kernel_radius;
+    return std::pow(h * h - r * r, 3.0f) * params.poly6_kernel_const;
+}
+
+// Equation (8) from Harada
+glm::vec3 CpuSolver::spikyKernel(const glm::vec3& r, float d, const SolverParams& params) {
+    return std::pow(params.kernel_radius - d, 2.0f) * (r / d) * params.spiky_kernel_const;
+}
+
+// Equation (9) from Harada
+float CpuSolver::viscosityKernel(float r, const SolverParams& params) {
+    return (params.kernel_radius - r) * params.viscosity_kernel_const;
+}
+
+/**
+ * Mirrors wallDensity() in density.comp, including its z wall test
+ */
+float CpuSolver::wallDensity(const glm::vec3& p, const SolverParams& params) {
+    const float h = params.kernel_radius;
+    const float size = params.size;
+    const float m = params.particle_mass;
+    float density = 0;
+
+    if (p.x < h) {
+        density += m * poly6Kernel(p.x, params);
+    } else if (p.x > size - h) {
+        density += m * poly6Kernel(size - p.x, params);
+    }
+
+    if (p.y < h) {
+        density += m * poly6Kernel(p.y, params);
+    } else if (p.y > size - h) {
+        density += m * poly6Kernel(size - p.y, params);
+    }
+
+    if (p.z < h) {
+        density += m * poly6Kernel(p.z, params);
+    } else if (p.y > size - h) {
+        density += m * poly6Kernel(size - p.z, params);
+    }
+
+    return density * 4;
+}
+
+/**
+ * Mirrors wallForces() in update.comp. The shader weights each wall with
+ * r.length(), which is the vector's component count, so 3 is used here.
+ */
+glm::vec3 CpuSolver::wallForces(const glm::vec3& p, const SolverParams& params) {
+    const float h = params.kernel_radius;
+    const float size = params.size;
+    const float d = 3.0f;
+    glm::vec3 force(0);
+
+    if (p.x < h) {
+        force += spikyKernel(glm::vec3(0, p.y, p.z) - p, d, params);
+    } else if (p.x > size - h) {
+        force += spikyKernel(glm::vec3(size, p.y, p.z) - p, d, params);
+    }
+
+    if (p.y < h) {
+        force += spikyKernel(glm::vec3(p.x, 0, p.z) - p, d, params);
+    } else if (p.y > size - h) {
+        force += spikyKernel(glm::vec3(p.x, size, p.z) - p, d, params);
+    }
+
+    if (p.z < h) {
+        force += spikyKernel(glm::vec3(p.x, p.y, 0) - p, d, params);
+    } else if (p.z > size - h) {
+        force += spikyKernel(glm::vec3(p.x, p.y, size) - p, d, params);
+    }
+
+    return force * 0.01f;
+}
+
+/**
+ * Mirrors mouseForce() in update.comp - repel particles from the mouse ray
+ */
+glm::vec3 CpuSolver::mouseForce(const Particle& p, const SolverParams& params) {
+    const glm::vec3 origin = params.mouse_origin;
+    const glm::vec3 dir = params.mouse_direction;
+
+    // slab intersection with the container
+    const glm::vec3 t_min = (glm::vec3(0) - origin) / dir;
+    const glm::vec3 t_max = (glm::vec3(params.size) - origin) / dir;
+    const glm::vec3 t1 = glm::min(t_min, t_max);
+    const glm::vec3 t2 = glm::max(t_min, t_max);
+    const float t_near = std::max(std::max(t1.x, t1.y), t1.z);
+    const float t_far = std::min(std::min(t2.x, t2.y), t2.z);
+    if (t_near > t_far) {
+        return glm::vec3(0);
+    }
+
+    const glm::vec3 to_mouse = p.position - origin;
+    const float distance_to_ray = glm::length(glm::cross(dir, to_mouse));
+    if (distance_to_ray > params.kernel_radius) {
+        return glm::vec3(0);
+    }
+
+    return -params.particle_mass * p.pressure *
+           spikyKernel(to_mouse, distance_to_ray + 1e-16f, params) * 0.00001f;
+}
+
+/**
+ * Counting sort of particles by grid bin, stable so an already sorted input keeps its order.
+ * Every thread counts a contiguous chunk of particles into its own histogram, the histograms
+ * are scanned bin by bin into a cursor per chunk and every chunk scatters its particles in
+ * order, so the result is the same for any number of threads.
+ */
+void CpuSolver::sort(const std::vector<Particle>& in, std::vector<Particle>& out,
+                     const SolverParams& params) {
+    const int n = int(in.size());
+    out.resize(n);
+    cell_ids_.resize(n);
+
+    const int num_chunks = numThreadChunks(n);
+    const size_t bins = size_t(num_bins_);
+    chunk_counts_.assign(num_chunks * bins, 0);
+
+    parallelForThreadChunks(n, [&](int chunk, int begin, int end) {
+        uint32_t* counts = &chunk_counts_[chunk * bins];
+        for (int i = begin; i < end; i++) {
+            cell_ids_[i] = cellIndex(cellCoord(in[i].position, params), params);
+            counts[cell_ids_[i]]++;
+        }
+    });
+
+    parallelFor(num_bins_, [&](int begin, int end) {
+        for (int b = begin; b < end; b++) {
+            uint32_t count = 0;
+            for (int chunk = 0; chunk < num_chunks; chunk++) {
+                count += chunk_counts_[chunk * bins + b];
+            }
+            counts_[b] = count;
+        }
+    });
+
+    uint32_t prefix = 0;
+    for (int b = 0; b < num_bins_; b++) {
+        offsets_[b] = prefix;
+        prefix += counts_[b];
+    }
+
+    // the counts of each chunk become the first slot its particles of that bin go to
+    parallelFor(num_bins_, [&](int begin, int end) {
+        for (int b = begin; b < end; b++) {
+            uint32_t cursor = offsets_[b];
+            for (int chunk = 0; chunk < num_chunks; chunk++) {
+                const uint32_t count = chunk_counts_[chunk * bins + b];
+                chunk_counts_[chunk * bins + b] = cursor;
+                cursor += count;
+            }
+        }
+    });
+
+    parallelForThreadChunks(n, [&](int chunk, int begin, int end) {
+        uint32_t* cursors = &chunk_counts_[chunk * bins];
+        for (int i = begin; i < end; i++) {
+            out[cursors[cell_ids_[i]]++] = in[i];
+        }
+    });
+
+    buildCellChunks(n);
+}
+
+/**
+ * Mirrors density.comp
+ */
+void CpuSolver::computeDensity(std::vector<Particle>& particles, const SolverParams& params) {
+    const int n = int(particles.size());
+    const float m = params.particle_mass;
+    const simd::KernelParams k = kernelParams(params);
+    fillStreams(particles);
+
+    parallelForCells(n, [&](int begin, int end) {
+        for (int i = begin; i < end; i++) {
+            Particle& p = particles[i];
+            const glm::ivec3 coord = cellCoord(p.position, params);
+
+            float density = m * poly6Kernel(0, params);
+
+            for (int bin = 0; bin < 27; bin++) {
+                const glm::ivec3 nc = coord + NEIGHBORHOOD[bin];
+                if (!inGrid(nc, params.grid_res)) {
+                    continue;
+                }
+
+                const uint32_t index = cellIndex(nc, params);
+                const uint32_t first = offsets_[index];
+                density += kernels_.density(streams_, k, uint32_t(i), first,
+                                            first + counts_[index], nc);
+            }
+
+            p.density = density + wallDensity(p.position, params);
+            p.pressure = params.rest_pressure +
+                         params.stiffness * (std::pow(density / params.rest_density, 3.0f) - 1);
+        }
+    });
+}
+
+/**
+ * Mirrors the neighbor loop of update.comp - pressure and viscosity forces on particle i
+ */
+glm::vec3 CpuSolver::gatherForces(const std::vector<Particle>& in, int i,
+                                  const SolverParams& params, uint64_t& num_pairs) {
+    const simd::KernelParams k = kernelParams(params);
+    const glm::ivec3 coord = cellCoord(in[i].position, params);
+
+    glm::vec3 pressure_force(0);
+    glm::vec3 viscosity_force(0);
+
+    for (int bin = 0; bin < 27; bin++) {
+        const glm::ivec3 nc = coord + NEIGHBORHOOD[bin];
+        if (!inGrid(nc, params.grid_res)) {
+            continue;
+        }
+
+        const uint32_t index = cellIndex(nc, params);
+        const uint32_t first = offsets_[index];
+        num_pairs += kernels_.forces(streams_, k, uint32_t(i), first, first + counts_[index], nc,
+                                     pressure_force, viscosity_force);
+    }
+
+    return pressure_force + viscosity_force * params.viscosity_coefficient;
+}
+
+/**
+ * Mirrors pairs.comp - evaluates the kernels once per interacting pair over the half shell
+ * and scatters the contribution to both particles. Harada's terms divide by the density of
+ * the other particle so the two sides are scaled separately. Occupied bins are processed in z
+ * layers, a layer only writes to itself and the next one, so even and odd layers run in two
+ * phases.
+ */
+void CpuSolver::computePairForces(const std::vector<Particle>& in, const SolverParams& params) {
+    const float m = params.particle_mass;
+    const float h = params.kernel_radius;
+    const int grid_res = params.grid_res;
+    pair_forces_.assign(in.size(), glm::vec3(0));
+    std::atomic<uint64_t> num_pairs(0);
+
+    // scatter one pair, i is the particle in the center bin
+    auto addPair = [&](uint32_t i, uint32_t j, uint64_t& count) {
+        const Particle& p = in[i];
+        const Particle& other = in[j];
+        const glm::vec3 r = p.position - other.position;
+        const float dist = glm::length(r);
+        if (dist >= h) {
+            return;
+        }
+        count++;
+
+        glm::vec3 force_on_p(0);
+        glm::vec3 force_on_other(0);
+
+        // Equation (6) from Harada, the spiky gradient flips sign with r
+        const float pressure_sum = p.pressure + other.pressure;
+        if (pressure_sum > 0) {
+            const glm::vec3 weight =
+                m * pressure_sum * 0.5f * spikyKernel(r, dist + 1e-16f, params);
+            force_on_p -= weight / other.density;
+            force_on_other += weight / p.density;
+        }
+
+        // Equation (7) from Harada
+        const glm::vec3 velocity_diff = (other.velocity - p.velocity) * m *
+                                        viscosityKernel(dist, params) *
+                                        params.viscosity_coefficient;
+        force_on_p += velocity_diff / other.density;
+        force_on_other -= velocity_diff / p.density;
+
+        pair_forces_[i] += force_on_p;
+        pair_forces_[j] += force_on_other;
+    };
+
+    // occupied bins of each z layer in y, x order, so empty space costs nothing. Every thread
+    // lists the bins of its particles, the particles of a bin are sorted next to each other
+    // so only the first of them adds it
+    const int n = int(in.size());
+    chunk_layer_cells_.resize(numThreadChunks(n));
+    parallelForThreadChunks(n, [&](int chunk, int begin, int end) {
+        std::vector<std::vector<int64_t>>& layers = chunk_layer_cells_[chunk];
+        layers.resize(grid_res);
+        for (auto& layer : layers) {
+            layer.clear();
+        }
+        for (int i = begin; i < end; i++) {
+            const glm::ivec3 c = cellCoord(in[i].position, params);
+            std::vector<int64_t>& layer = layers[c.z];
+            const int64_t key = int64_t(c.y) * grid_res + c.x;
+            if (layer.empty() || layer.back() != key) {
+                layer.push_back(key);
+            }
+        }
+    });
+
+    layer_cells_.resize(grid_res);
+    parallelFor(grid_res, [&](int begin, int end) {
+        for (int z = begin; z < end; z++) {
+            std::vector<int64_t>& layer = layer_cells_[z];
+            layer.clear();
+            for (const auto& layers : chunk_layer_cells_) {
+                layer.insert(layer.end(), layers[z].begin(), layers[z].end());
+            }
+            std::sort(layer.begin(), layer.end());
+            layer.erase(std::unique(layer.begin(), layer.end()), layer.end());
+        }
+    });
+
+    for (int phase = 0; phase < 2; phase++) {
+        const int num_layers = (grid_res - phase + 1) / 2;
+
+        parallelFor(num_layers, [&](int begin, int end) {
+            uint64_t count = 0;
+            for (int layer = begin; layer < end; layer++) {
+                const int z = layer * 2 + phase;
+                for (const int64_t key : layer_cells_[z]) {
+                    const glm::ivec3 coord(int(key % grid_res), int(key / grid_res), z);
+                    const uint32_t index = cellIndex(coord, params);
+                    const uint32_t first = offsets_[index];
+                    const uint32_t last = first + counts_[index];
+
+                    for (uint32_t i = first; i < last; i++) {
+                        if (!inBin(in[i].position, coord, params)) {
+                            continue;
+                        }
+
+                        // pairs inside the center bin
+                        for (uint32_t j = i + 1; j < last; j++) {
+                            if (inBin(in[j].position, coord, params)) {
+                                addPair(i, j, count);
+                            }
+                        }
+
+                        for (int bin = 0; bin < 13; bin++) {
+                            const glm::ivec3 nc = coord + HALF_SHELL[bin];
+                            if (!inGrid(nc, grid_res)) {
+                                continue;
+                            }
+
+                            const uint32_t other_index = cellIndex(nc, params);
+                            const uint32_t other_first = offsets_[other_index];
+                            const uint32_t other_last = other_first + counts_[other_index];
+                            for (uint32_t j = other_first; j < other_last; j++) {
+                                if (inBin(in[j].position, nc, params)) {
+                                    addPair(i, j, count);
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+            num_pairs += count;
+        });
+    }
+
+    num_pair_evaluations_ += num_pairs;
+}
+
+/**
+ * Mirrors the end of update.comp - add external forces and integrate
+ */
+Particle CpuSolver::integrate(Particle p, const glm::vec3& force, const SolverParams& params) {
+    const float dt = params.dt;
+    const float size = params.size;
+
+    glm::vec3 external_forces = params.gravity * p.density;
+    external_forces += mouseForce(p, params) + wallForces(p.position, params);
+    const glm::vec3 total_force = force + external_forces;
+
+    // find accelaration and integrate
+    const glm::vec3 acceleration = total_force / (p.density + 1e-16f);
+    glm::vec3 vel = glm::clamp(p.velocity + acceleration * dt, glm::vec3(-MAX_SPEED),
+                               glm::vec3(MAX_SPEED));
+    glm::vec3 pos = p.position + vel * dt;
+
+    for (int axis = 0; axis < 3; axis++) {
+        if (pos[axis] < BORDER) {
+            vel[axis] *= -WALL_DAMPING;
+            pos[axis] = BORDER;
+        } else if (pos[axis] > size - BORDER) {
+            vel[axis] *= -WALL_DAMPING;
+            pos[axis] = size - BORDER;
+        }
+    }
+
+    p.velocity = vel;
+    p.position = pos;
+    return p;
+}
+
+/**
+ * Mirrors update.comp - compute forces and integrate from in to out
+ */
+void CpuSolver::computeUpdate(const std::vector<Particle>& in, std::vector<Particle>& out,
+                              const SolverParams& params) {
+    const int n = int(in.size());
+    out.resize(n);
+
+    if (params.symmetric_pairs) {
+        computePairForces(in, params);
+        parallelFor(n, [&](int begin, int end) {
+            for (int i = begin; i < end; i++) {
+                out[i] = integrate(in[i], pair_forces_[i], params);
+            }
+        });
+        return;
+    }
+
+    fillStreams(in);
+    std::atomic<uint64_t> num_pairs(0);
+    parallelForCells(n, [&](int begin, int end) {
+        uint64_t count = 0;
+        for (int i = begin; i < end; i++) {
+            out[i] = integrate(in[i], gatherForces(in, i, params, count), params);
+        }
+        num_pairs += count;
+    });
+    num_pair_evaluations_ += num_pairs;
+}
+
+/**
+ * main logic - sort, compute densities then forces, result is stored back in particles
+ */
+void CpuSolver::step(std::vector<Particle>& particles, const SolverParams& params) {
+    if (int(cell_ids_.size()) != int(particles.size()) || cell_indexing_ != params.cell_indexing ||
+        num_bins_ != grid::numCells(params.grid_res, params.cell_indexing, int(particles.size()))) {
+        setup(int(particles.size()), params.grid_res, params.cell_indexing);
+    }
+
+    typedef std::chrono::high_resolution_clock Clock;
+    auto ms = [](Clock::time_point a, Clock::time_point b) {
+        return std::chrono::duration<double, std::milli>(b - a).count();
+    };
+
+    const auto start = Clock::now();
+    sort(particles, sorted_, params);
+    const auto sorted = Clock::now();
+    computeDensity(sorted_, params);
+    const auto densities = Clock::now();
+    computeUpdate(sorted_, particles, params);
+    const auto end = Clock::now();
+
+    timings_.sort_ms += ms(start, sorted);
+    timings_.density_ms += ms(sorted, densities);
+    timings_.update_ms += ms(densities, end);
+    timings_.steps++;
+}
+
+/**
+ * Bytes held by the grid and scratch storage, not counting the caller's particles
+ */
+size_t CpuSolver::memoryUsage() {
+    size_t bytes = (counts_.capacity() + offsets_.capacity() + cell_ids_.capacity() +
+                    chunk_counts_.capacity() + cell_chunks_.capacity()) *
+                       sizeof(uint32_t) +
+                   sorted_.capacity() * sizeof(Particle) +
+                   pair_forces_.capacity() * sizeof(glm::vec3);
+    for (const auto& layer : layer_cells_) {
+        bytes += layer.capacity() * sizeof(int64_t);
+    }
+    for (const auto& layers : chunk_layer_cells_) {
+        for (const auto& layer : layers) {
+            bytes += layer.capacity() * sizeof(int64_t);
+        }
+    }
+    for (const auto* stream : {&streams_.x, &streams_.y, &streams_.z, &streams_.vx, &streams_.vy,
+                               &streams_.vz, &streams_.density, &streams_.pressure}) {
+        bytes += stream->capacity() * sizeof(float);
+    }
+    return bytes;
+}
@@ -0,0 +1,147 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "./Particle.h"
+#include "./TaskScheduler.h"
+#include "./grid.h"
+#include "./simd.h"
+
+namespace core {
+
+typedef std::shared_ptr<class CpuSolver> CpuSolverRef;
+
+/**
+ * Per step simulation parameters, the CPU counterpart of the shader uniforms
+ */
+struct SolverParams {
+    SolverParams()
+        : size(1), bin_size(1), grid_res(1), cell_indexing(grid::ROW_MAJOR_INDEXING), dt(0),
+          gravity(0), particle_mass(1), kernel_radius(1), stiffness(0), rest_density(1),
+          rest_pressure(0), viscosity_coefficient(0), poly6_kernel_const(0),
+          spiky_kernel_const(0), viscosity_kernel_const(0), mouse_origin(0),
+          mouse_direction(0, 0, -1), symmetric_pairs(false) {}
+    float size;
+    float bin_size;
+    int grid_res;
+    int cell_indexing;
+    float dt;
+    glm::vec3 gravity;
+    float particle_mass;
+    float kernel_radius;
+    float stiffness;
+    float rest_density;
+    float rest_pressure;
+    float viscosity_coefficient;
+    float poly6_kernel_const;
+    float spiky_kernel_const;
+    float viscosity_kernel_const;
+    glm::vec3 mouse_origin;
+    glm::vec3 mouse_direction;
+    // evaluate each interacting pair once and scatter to both particles
+    bool symmetric_pairs;
+};
+
+/**
+ * Wall clock time spent in each pass, summed over the steps since the last reset
+ */
+struct SolverTimings {
+    SolverTimings() : sort_ms(0), density_ms(0), update_ms(0), steps(0) {}
+    double sort_ms;
+    double density_ms;
+    double update_ms;
+    int steps;
+};
+
+/**
+ * Multithreaded CPU implementation of the sort, density and update passes.
+ * Has no GL dependency so it can run headless. The particle passes are split into chunks of
+ * whole bins holding about the same number of particles and run on a work stealing scheduler,
+ * so the crowded bins of a dam break don't leave most threads idle.
+ */
+class CpuSolver {
+public:
+    CpuSolver();
+
+    int numThreads() { return scheduler_->numThreads(); }
+    CpuSolverRef numThreads(int n);
+    TaskSchedulerRef getScheduler() { return scheduler_; }
+    // instruction set of the neighbor kernels, AUTO_KERNELS picks the best supported one
+    CpuSolverRef kernelIsa(int isa);
+    int kernelIsa() { return kernel_isa_; }
+
+    void setup(int num_particles, int grid_res, int cell_indexing = grid::ROW_MAJOR_INDEXING);
+    void step(std::vector<Particle>& particles, const SolverParams& params);
+
+    void sort(const std::vector<Particle>& in, std::vector<Particle>& out,
+              const SolverParams& params);
+    void computeDensity(std::vector<Particle>& particles, const SolverParams& params);
+    void computeUpdate(const std::vector<Particle>& in, std::vector<Particle>& out,
+                       const SolverParams& params);
+
+    const std::vector<uint32_t>& getCounts() { return counts_; }
+    const std::vector<uint32_t>& getOffsets() { return offsets_; }
+    // kernel evaluations of interacting pairs since setup
+    uint64_t numPairEvaluations() { return num_pair_evaluations_; }
+    const SolverTimings& getTimings() { return timings_; }
+    void resetTimings() { timings_ = SolverTimings(); }
+    size_t memoryUsage();
+
+    static simd::KernelParams kernelParams(const SolverParams& params);
+    static CpuSolverRef create() { return std::make_shared<CpuSolver>(); }
+
+protected:
+    template <typename F> void parallelFor(int n, F func);
+    template <typename F> void parallelForCells(int n, F func);
+    int numThreadChunks(int n);
+    template <typename F> void parallelForThreadChunks(int n, F func);
+    void buildCellChunks(int n);
+
+    glm::ivec3 cellCoord(const glm::vec3& p, const SolverParams& params);
+    uint32_t cellIndex(const glm::ivec3& c, const SolverParams& params);
+    bool inBin(const glm::vec3& p, const glm::ivec3& c, const SolverParams& params);
+    void fillStreams(const std::vector<Particle>& particles);
+
+    float poly6Kernel(float r, const SolverParams& params);
+    glm::vec3 spikyKernel(const glm::vec3& r, float d, const SolverParams& params);
+    float viscosityKernel(float r, const SolverParams& params);
+    float wallDensity(const glm::vec3& p, const SolverParams& params);
+    glm::vec3 wallForces(const glm::vec3& p, const SolverParams& params);
+    glm::vec3 mouseForce(const Particle& p, const SolverParams& params);
+    glm::vec3 gatherForces(const std::vector<Particle>& in, int i, const SolverParams& params,
+                           uint64_t& num_pairs);
+    void computePairForces(const std::vector<Particle>& in, const SolverParams& params);
+    Particle integrate(Particle p, const glm::vec3& force, const SolverParams& params);
+
+    CpuSolverRef thisRef() { return std::make_shared<CpuSolver>(*this); }
+
+    int kernel_isa_;
+    int num_bins_;
+    int cell_indexing_;
+    uint64_t num_pair_evaluations_;
+    SolverTimings timings_;
+
+    std::vector<uint32_t> counts_;
+    std::vector<uint32_t> offsets_;
+    std::vector<uint32_t> cell_ids_;
+    // bin histogram of each thread's particles in sort, then the cursors of its scatter
+    std::vector<uint32_t> chunk_counts_;
+    std::vector<Particle> sorted_;
+    std::vector<glm::vec3> pair_forces_;
+    std::vector<std::vector<int64_t>> layer_cells_;
+    // occupied bins of each z layer seen by each thread's particles, merged into layer_cells_
+    std::vector<std::vector<std::vector<int64_t>>> chunk_layer_cells_;
+    // first sorted particle of each bin chunk, followed by the particle count
+    std::vector<uint32_t> cell_chunks_;
+
+    TaskSchedulerRef scheduler_;
+
+    simd::Kernels kernels_;
+    simd::Streams streams_;
+};
+
+} // namespace core
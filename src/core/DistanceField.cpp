@@ -0,0 +1,188 @@
+#include "./DistanceField.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+using namespace core;
+
+namespace {
+
+struct Triangle {
+    glm::vec3 a, b, c;
+};
+
+/**
+ * Closest point on a triangle, from Ericson's Real-Time Collision Detection, Section 5.1.5
+ */
+glm::vec3 closestPoint(const glm::vec3& p, const Triangle& t) {
+    const glm::vec3 ab = t.b - t.a;
+    const glm::vec3 ac = t.c - t.a;
+    const glm::vec3 ap = p - t.a;
+    const float d1 = glm::dot(ab, ap);
+    const float d2 = glm::dot(ac, ap);
+    if (d1 <= 0 && d2 <= 0) {
+        return t.a;
+    }
+
+    const glm::vec3 bp = p - t.b;
+    const float d3 = glm::dot(ab, bp);
+    const float d4 = glm::dot(ac, bp);
+    if (d3 >= 0 && d4 <= d3) {
+        return t.b;
+    }
+
+    const float vc = d1 * d4 - d3 * d2;
+    if (vc <= 0 && d1 >= 0 && d3 <= 0) {
+        return t.a + ab * (d1 / (d1 - d3));
+    }
+
+    const glm::vec3 cp = p - t.c;
+    const float d5 = glm::dot(ab, cp);
+    const float d6 = glm::dot(ac, cp);
+    if (d6 >= 0 && d5 <= d6) {
+        return t.c;
+    }
+
+    const float vb = d5 * d2 - d1 * d6;
+    if (vb <= 0 && d2 >= 0 && d6 <= 0) {
+        return t.a + ac * (d2 / (d2 - d6));
+    }
+
+    const float va = d3 * d6 - d5 * d4;
+    if (va <= 0 && (d4 - d3) >= 0 && (d5 - d6) >= 0) {
+        return t.b + (t.c - t.b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+    }
+
+    const float denom = 1.0f / (va + vb + vc);
+    return t.a + ab * (vb * denom) + ac * (vc * denom);
+}
+
+/**
+ * Moller-Trumbore, true if the ray from origin along direction crosses the triangle
+ */
+bool rayHits(const glm::vec3& origin, const glm::vec3& direction, const Triangle& t) {
+    const glm::vec3 ab = t.b - t.a;
+    const glm::vec3 ac = t.c - t.a;
+    const glm::vec3 p = glm::cross(direction, ac);
+    const float det = glm::dot(ab, p);
+    if (std::abs(det) < 1e-12f) {
+        return false;
+    }
+
+    const float inv_det = 1.0f / det;
+    const glm::vec3 s = origin - t.a;
+    const float u = glm::dot(s, p) * inv_det;
+    if (u < 0 || u > 1) {
+        return false;
+    }
+
+    const glm::vec3 q = glm::cross(s, ab);
+    const float v = glm::dot(direction, q) * inv_det;
+    if (v < 0 || u + v > 1) {
+        return false;
+    }
+    return glm::dot(ac, q) * inv_det > 0;
+}
+
+} // namespace
+
+DistanceField::DistanceField(int resolution, float size)
+    : resolution_(std::max(resolution, 2)), size_(size) {
+    distances_.assign(size_t(resolution_) * resolution_ * resolution_,
+                      std::numeric_limits<float>::max());
+}
+
+DistanceFieldRef DistanceField::box(int resolution, float size) {
+    DistanceFieldRef field = std::make_shared<DistanceField>(resolution, size);
+    const int n = field->resolution_;
+    for (int z = 0; z < n; z++) {
+        for (int y = 0; y < n; y++) {
+            for (int x = 0; x < n; x++) {
+                const glm::vec3 p = field->voxelCenter(x, y, z);
+                const glm::vec3 to_far_wall = glm::vec3(size) - p;
+                field->distances_[field->index(x, y, z)] =
+                    std::min(std::min(std::min(p.x, p.y), p.z),
+                             std::min(std::min(to_far_wall.x, to_far_wall.y), to_far_wall.z));
+            }
+        }
+    }
+    return field;
+}
+
+/**
+ * Brute force over the triangles for every voxel, the sign comes from the parity of the
+ * crossings of a ray leaving the voxel, so the mesh has to be closed
+ */
+void DistanceField::addObstacle(const std::vector<glm::vec3>& positions,
+                                const std::vector<uint32_t>& indices,
+                                TaskSchedulerRef scheduler) {
+    std::vector<Triangle> triangles;
+    for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+        triangles.push_back({positions[indices[i]], positions[indices[i + 1]],
+                             positions[indices[i + 2]]});
+    }
+    if (triangles.empty()) {
+        return;
+    }
+
+    // off axis so the ray doesn't run along the edges of axis aligned meshes
+    const glm::vec3 direction = glm::normalize(glm::vec3(1.0f, 0.0137f, 0.0071f));
+
+    auto slice = [&](int z, int) {
+        for (int y = 0; y < resolution_; y++) {
+            for (int x = 0; x < resolution_; x++) {
+                const glm::vec3 p = voxelCenter(x, y, z);
+                float closest = std::numeric_limits<float>::max();
+                int crossings = 0;
+                for (const Triangle& t : triangles) {
+                    closest = std::min(closest, glm::length(p - closestPoint(p, t)));
+                    crossings += rayHits(p, direction, t) ? 1 : 0;
+                }
+
+                const float d = crossings % 2 == 1 ? -closest : closest;
+                float& distance = distances_[index(x, y, z)];
+                distance = std::min(distance, d);
+            }
+        }
+    };
+
+    if (scheduler) {
+        scheduler->run(resolution_, slice);
+    } else {
+        for (int z = 0; z < resolution_; z++) {
+            slice(z, 0);
+        }
+    }
+}
+
+float DistanceField::distance(int x, int y, int z) {
+    x = std::min(std::max(x, 0), resolution_ - 1);
+    y = std::min(std::max(y, 0), resolution_ - 1);
+    z = std::min(std::max(z, 0), resolution_ - 1);
+    return distances_[index(x, y, z)];
+}
+
+glm::vec3 DistanceField::voxelCenter(int x, int y, int z) {
+    return (glm::vec3(x, y, z) + glm::vec3(0.5f)) * getVoxelSize();
+}
+
+/**
+ * Central differences, one sided at the faces of the volume
+ */
+std::vector<glm::vec4> DistanceField::gradientVolume() {
+    std::vector<glm::vec4> volume(distances_.size());
+    for (int z = 0; z < resolution_; z++) {
+        for (int y = 0; y < resolution_; y++) {
+            for (int x = 0; x < resolution_; x++) {
+                const glm::vec3 gradient(distance(x + 1, y, z) - distance(x - 1, y, z),
+                                         distance(x, y + 1, z) - distance(x, y - 1, z),
+                                         distance(x, y, z + 1) - distance(x, y, z - 1));
+                const float length = glm::length(gradient);
+                const glm::vec3 normal = length > 0 ? gradient / length : glm::vec3(0);
+                volume[index(x, y, z)] = glm::vec4(normal, distances_[index(x, y, z)]);
+            }
+        }
+    }
+    return volume;
+}
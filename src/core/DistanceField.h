@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "./TaskScheduler.h"
+
+namespace core {
+
+typedef std::shared_ptr<class DistanceField> DistanceFieldRef;
+
+/**
+ * Signed distance to the boundary of the fluid domain, sampled at the voxel centers of a
+ * resolution^3 grid over the [0, size]^3 cube. Positive inside the fluid domain and negative
+ * inside solids. Built on the CPU from the container and any number of closed triangle meshes,
+ * then uploaded once as a 3D texture of gradients and distances.
+ */
+class DistanceField {
+public:
+    DistanceField(int resolution, float size);
+
+    // the inside of the container cube
+    static DistanceFieldRef box(int resolution, float size);
+
+    // carve a closed mesh out of the domain, its inside becomes solid. Runs on the scheduler
+    // when one is given.
+    void addObstacle(const std::vector<glm::vec3>& positions,
+                     const std::vector<uint32_t>& indices, TaskSchedulerRef scheduler = nullptr);
+
+    int getResolution() { return resolution_; }
+    float getSize() { return size_; }
+    float getVoxelSize() { return size_ / float(resolution_); }
+    float distance(int x, int y, int z);
+    glm::vec3 voxelCenter(int x, int y, int z);
+
+    // per voxel the unit gradient pointing into the fluid in xyz and the distance in w,
+    // the layout of the boundary texture
+    std::vector<glm::vec4> gradientVolume();
+
+protected:
+    int index(int x, int y, int z) { return (z * resolution_ + y) * resolution_ + x; }
+
+    int resolution_;
+    float size_;
+    std::vector<float> distances_;
+};
+
+} // namespace core
@@ -0,0 +1,248 @@
+#include "./Emitter.h"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+using namespace core;
+
+namespace {
+
+/**
+ * Integer finalizer with low bias, from Chris Wellons' hash prospector
+ */
+uint32_t hash(uint32_t x) {
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+/**
+ * Uniform in [-0.5, 0.5) from a counter, the seed and a point's lattice coordinates
+ */
+float uniform(unsigned seed, int x, int y, int z, uint32_t component) {
+    uint32_t h = hash(seed ^ 0x9e3779b9u);
+    h = hash(h ^ uint32_t(x));
+    h = hash(h ^ uint32_t(y));
+    h = hash(h ^ uint32_t(z));
+    h = hash(h ^ component);
+    return float(h >> 8) / float(1 << 24) - 0.5f;
+}
+
+} // namespace
+
+Emitter::Emitter(int shape)
+    : shape_(shape), seed_(0), spacing_(0.0175f), jitter_(0.5f), min_(0), max_(0), velocity_(0),
+      center_(0), radius_(0), lattice_(0) {}
+
+EmitterRef Emitter::box(glm::vec3 min, glm::vec3 max) {
+    EmitterRef emitter = create(BOX_EMITTER);
+    emitter->min_ = glm::min(min, max);
+    emitter->max_ = glm::max(min, max);
+    return emitter;
+}
+
+EmitterRef Emitter::sphere(glm::vec3 center, float radius) {
+    EmitterRef emitter = create(SPHERE_EMITTER);
+    emitter->center_ = center;
+    emitter->radius_ = std::abs(radius);
+    emitter->min_ = center - glm::vec3(emitter->radius_);
+    emitter->max_ = center + glm::vec3(emitter->radius_);
+    return emitter;
+}
+
+EmitterRef Emitter::mesh(const std::vector<glm::vec3>& positions,
+                         const std::vector<uint32_t>& indices) {
+    EmitterRef emitter = create(MESH_EMITTER);
+    for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+        emitter->triangles_.push_back(
+            {positions[indices[i]], positions[indices[i + 1]], positions[indices[i + 2]]});
+    }
+    if (!positions.empty()) {
+        emitter->min_ = emitter->max_ = positions[0];
+        for (const glm::vec3& p : positions) {
+            emitter->min_ = glm::min(emitter->min_, p);
+            emitter->max_ = glm::max(emitter->max_, p);
+        }
+    }
+    return emitter;
+}
+
+EmitterRef Emitter::spacing(float s) {
+    spacing_ = s;
+    slab_counts_.clear();
+    return thisRef();
+}
+
+EmitterRef Emitter::jitter(float j) {
+    jitter_ = j;
+    return thisRef();
+}
+
+EmitterRef Emitter::velocity(glm::vec3 v) {
+    velocity_ = v;
+    return thisRef();
+}
+
+EmitterRef Emitter::seed(unsigned s) {
+    seed_ = s;
+    return thisRef();
+}
+
+glm::vec3 Emitter::latticePoint(int x, int y, int z) {
+    return min_ + (glm::vec3(x, y, z) + glm::vec3(0.5f)) * spacing_;
+}
+
+glm::vec3 Emitter::jitterOffset(int x, int y, int z) {
+    return glm::vec3(uniform(seed_, x, y, z, 0), uniform(seed_, x, y, z, 1),
+                     uniform(seed_, x, y, z, 2)) *
+           (jitter_ * spacing_);
+}
+
+/**
+ * Boxes keep every point of their lattice, spheres test each point and meshes find where the
+ * row crosses the triangles and keep the points with an odd number of crossings ahead of them
+ */
+void Emitter::insideRow(int y, int z, std::vector<int>& xs) {
+    xs.clear();
+    if (shape_ == BOX_EMITTER) {
+        for (int x = 0; x < lattice_.x; x++) {
+            xs.push_back(x);
+        }
+        return;
+    }
+
+    if (shape_ == SPHERE_EMITTER) {
+        for (int x = 0; x < lattice_.x; x++) {
+            if (glm::length(latticePoint(x, y, z) - center_) <= radius_) {
+                xs.push_back(x);
+            }
+        }
+        return;
+    }
+
+    // nudged off the lattice so the row doesn't run along the edges of axis aligned meshes
+    const glm::vec3 row = latticePoint(0, y, z);
+    const glm::vec2 p = glm::vec2(row.y, row.z) + glm::vec2(0.37f, 0.71f) * (spacing_ * 1e-3f);
+    std::vector<float> crossings;
+    for (const Triangle& t : triangles_) {
+        const glm::vec2 a(t.a.y, t.a.z);
+        const glm::vec2 ab = glm::vec2(t.b.y, t.b.z) - a;
+        const glm::vec2 ac = glm::vec2(t.c.y, t.c.z) - a;
+        const glm::vec2 ap = p - a;
+        const float det = ab.x * ac.y - ab.y * ac.x;
+        if (std::abs(det) < 1e-12f) {
+            continue;
+        }
+
+        const float u = (ap.x * ac.y - ap.y * ac.x) / det;
+        const float v = (ab.x * ap.y - ab.y * ap.x) / det;
+        if (u < 0 || v < 0 || u + v > 1) {
+            continue;
+        }
+        crossings.push_back(t.a.x + u * (t.b.x - t.a.x) + v * (t.c.x - t.a.x));
+    }
+    std::sort(crossings.begin(), crossings.end());
+
+    size_t behind = 0;
+    for (int x = 0; x < lattice_.x; x++) {
+        const float px = latticePoint(x, y, z).x;
+        while (behind < crossings.size() && crossings[behind] <= px) {
+            behind++;
+        }
+        if ((crossings.size() - behind) % 2 == 1) {
+            xs.push_back(x);
+        }
+    }
+}
+
+void Emitter::countSlab(int z) {
+    std::vector<int> xs;
+    int count = 0;
+    for (int y = 0; y < lattice_.y; y++) {
+        insideRow(y, z, xs);
+        count += int(xs.size());
+    }
+    slab_counts_[z] = count;
+}
+
+/**
+ * Write the particles of a slab from index on, in the order count found them
+ */
+void Emitter::emitSlab(int z, int index, int capacity, int particle_layout,
+                       uint8_t* particles) {
+    Particle* structs = reinterpret_cast<Particle*>(particles);
+    glm::vec4 *positions = nullptr, *velocities = nullptr;
+    float *densities = nullptr, *pressures = nullptr;
+    if (particle_layout == SOA_LAYOUT) {
+        positions = reinterpret_cast<glm::vec4*>(
+            particles + layout::streamOffset(POSITION_STREAM, capacity));
+        velocities = reinterpret_cast<glm::vec4*>(
+            particles + layout::streamOffset(VELOCITY_STREAM, capacity));
+        densities =
+            reinterpret_cast<float*>(particles + layout::streamOffset(DENSITY_STREAM, capacity));
+        pressures =
+            reinterpret_cast<float*>(particles + layout::streamOffset(PRESSURE_STREAM, capacity));
+    }
+
+    std::vector<int> xs;
+    for (int y = 0; y < lattice_.y; y++) {
+        insideRow(y, z, xs);
+        for (int x : xs) {
+            const glm::vec3 position = latticePoint(x, y, z) + jitterOffset(x, y, z);
+            if (particle_layout == SOA_LAYOUT) {
+                positions[index] = glm::vec4(position, 0.0f);
+                velocities[index] = glm::vec4(velocity_, 0.0f);
+                densities[index] = 0.0f;
+                pressures[index] = 0.0f;
+            } else {
+                Particle& p = structs[index];
+                p.position = position;
+                p.density = 0.0f;
+                p.velocity = velocity_;
+                p.pressure = 0.0f;
+            }
+            index++;
+        }
+    }
+}
+
+void Emitter::runSlabs(const std::function<void(int, int)>& task, TaskSchedulerRef scheduler) {
+    if (scheduler) {
+        scheduler->run(lattice_.z, task);
+    } else {
+        for (int z = 0; z < lattice_.z; z++) {
+            task(z, 0);
+        }
+    }
+}
+
+int Emitter::count(TaskSchedulerRef scheduler) {
+    if (slab_counts_.empty()) {
+        const glm::vec3 extent = (max_ - min_) / spacing_;
+        lattice_ = glm::max(glm::ivec3(extent), glm::ivec3(1));
+        slab_counts_.assign(lattice_.z, 0);
+        runSlabs([this](int z, int) { countSlab(z); }, scheduler);
+    }
+    return std::accumulate(slab_counts_.begin(), slab_counts_.end(), 0);
+}
+
+void Emitter::emit(void* particles, int first, int capacity, int particle_layout,
+                   TaskSchedulerRef scheduler) {
+    count(scheduler);
+
+    std::vector<int> slab_offsets(slab_counts_.size());
+    int offset = first;
+    for (size_t z = 0; z < slab_counts_.size(); z++) {
+        slab_offsets[z] = offset;
+        offset += slab_counts_[z];
+    }
+
+    uint8_t* bytes = static_cast<uint8_t*>(particles);
+    runSlabs(
+        [&](int z, int) { emitSlab(z, slab_offsets[z], capacity, particle_layout, bytes); },
+        scheduler);
+}
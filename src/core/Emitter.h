@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "./Particle.h"
+#include "./TaskScheduler.h"
+
+namespace core {
+
+typedef std::shared_ptr<class Emitter> EmitterRef;
+
+/**
+ * Volumes an emitter fills
+ */
+enum EmitterShape {
+    BOX_EMITTER = 0,
+    SPHERE_EMITTER = 1,
+    // closed triangle mesh
+    MESH_EMITTER = 2,
+};
+
+/**
+ * Fills a shape with a jittered lattice of particles. The lattice spans the bounds of the shape
+ * and keeps the points inside it. Every z slab of the lattice is a task that is counted first
+ * and then written at the prefix sum of the counts before it. The jitter of a point is hashed
+ * from the seed and its lattice coordinates instead of drawn from a sequence, so the particles
+ * come out the same for any number of threads.
+ */
+class Emitter {
+public:
+    Emitter(int shape);
+
+    // axis aligned box in simulation space
+    static EmitterRef box(glm::vec3 min, glm::vec3 max);
+    static EmitterRef sphere(glm::vec3 center, float radius);
+    // inside by the parity of crossings along each lattice row, so the mesh has to be closed
+    static EmitterRef mesh(const std::vector<glm::vec3>& positions,
+                           const std::vector<uint32_t>& indices);
+
+    EmitterRef spacing(float s);
+    // width of the jitter along each axis as a fraction of the spacing
+    EmitterRef jitter(float j);
+    EmitterRef velocity(glm::vec3 v);
+    EmitterRef seed(unsigned s);
+
+    int getShape() { return shape_; }
+    float getSpacing() { return spacing_; }
+
+    // particles the emitter generates, the lattice is counted once
+    int count(TaskSchedulerRef scheduler = nullptr);
+    // write the particles from index first of a buffer laid out for capacity particles, which
+    // may be mapped GPU storage
+    void emit(void* particles, int first, int capacity, int particle_layout,
+              TaskSchedulerRef scheduler = nullptr);
+
+    static EmitterRef create(int shape) { return std::make_shared<Emitter>(shape); }
+
+protected:
+    struct Triangle {
+        glm::vec3 a, b, c;
+    };
+
+    // lattice x coordinates of the points inside the shape on row y of slab z
+    void insideRow(int y, int z, std::vector<int>& xs);
+    glm::vec3 latticePoint(int x, int y, int z);
+    glm::vec3 jitterOffset(int x, int y, int z);
+    void countSlab(int z);
+    void emitSlab(int z, int first, int capacity, int particle_layout, uint8_t* particles);
+    void runSlabs(const std::function<void(int, int)>& task, TaskSchedulerRef scheduler);
+
+    EmitterRef thisRef() { return std::make_shared<Emitter>(*this); }
+
+    int shape_;
+    unsigned seed_;
+    float spacing_;
+    float jitter_;
+
+    glm::vec3 min_;
+    glm::vec3 max_;
+    glm::vec3 velocity_;
+    glm::vec3 center_;
+    float radius_;
+    std::vector<Triangle> triangles_;
+
+    // lattice points along each axis and the inside points of each slab, once counted
+    glm::ivec3 lattice_;
+    std::vector<int> slab_counts_;
+};
+
+} // namespace core
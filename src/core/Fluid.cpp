@@ -1,17 +1,36 @@
 #include "./Fluid.h"
 
+#include <cstring>
+#include <thread>
 #include <glm/gtx/quaternion.hpp>
 #include <glm/gtx/string_cast.hpp>
 #include <time.h>
 
 using namespace core;
 
+namespace {
+
+// solver state copies in flight before the oldest one is read back
+const int PRESSURE_STATS_RING = 4;
+const GLsizeiptr PRESSURE_STATS_SIZE = 4 * sizeof(uint32_t);
+// the timestep buffer, dt, the two maxima and padding before the simulated time, see timestep.glsl
+const GLsizeiptr TIMESTEP_SIZE = 4 * sizeof(uint32_t) + sizeof(double);
+// timestep copies in flight, the time is a running sum so a dropped copy loses nothing
+const int TIMESTEP_RING = 4;
+const GLuint BOUNDARY_TEXTURE_UNIT = 0;
+// longest the CPU waits for the previous snapshot copy before giving up on it
+const GLuint64 SNAPSHOT_TIMEOUT_NS = 1000000000;
+
+} // namespace
+
 Fluid::Fluid(const std::string& name) : BaseObject(name), position_(0), rotation_(0, 0, 0, 0) {
     size_ = 1.0f;
     position_ = -vec3(size_ / 2.0f);
     num_particles_ = 80000;
     // must be less than (size / kernel_radius - b) where b is a positive int
     grid_res_ = 21;
+    cell_indexing_ = grid::ROW_MAJOR_INDEXING;
+    particle_layout_ = AOS_LAYOUT;
     gravity_strength_ = 900.0f;
     gravity_direction_ = vec3(0, -1, 0);
     particle_radius_ = 0.01f;
@@ -23,7 +42,77 @@ Fluid::Fluid(const std::string& name) : BaseObject(name), position_(0), rotation
     point_scale_ = 300.0f;
     time_scale_ = 0.012f;
     rotate_gravity_ = false;
-    createParams();
+    validate_scan_ = false;
+    use_cpu_solver_ = false;
+    cpu_particles_valid_ = false;
+    validate_cpu_solver_ = false;
+    solver_tolerance_ = 1e-3f;
+    use_neighbor_lists_ = false;
+    neighbor_skin_ = 0.004f;
+    cpu_utilization_ = 0.0f;
+    neighbor_list_rebuilds_ = 0;
+    neighbor_list_steps_ = 0;
+    symmetric_pairs_ = false;
+    cell_tiling_ = false;
+    compare_cell_tiling_ = false;
+    adaptive_timestep_ = false;
+    cfl_number_ = 0.4f;
+    force_number_ = 0.25f;
+    min_timestep_ = 1e-6f;
+    max_timestep_ = 1e-3f;
+    pressure_solver_ = STATE_EQUATION_PRESSURE;
+    pressure_tolerance_ = 0.01f;
+    min_pressure_iterations_ = 3;
+    max_pressure_iterations_ = 20;
+    pressure_iterations_ = 0;
+    pressure_stats_slot_ = 0;
+    timestep_slot_ = 0;
+    pressure_delta_ = 0.0f;
+    pressure_error_ = 0.0f;
+    sdf_boundary_ = false;
+    sdf_resolution_ = 64;
+    use_sleeping_ = false;
+    awake_only_ = false;
+    sleep_speed_ = 0.05f;
+    awake_particles_ = 0;
+    pipelined_ = false;
+    pipeline_waits_ = 0;
+    dynamic_particles_ = false;
+    specialize_shaders_ = true;
+    fused_sort_ = true;
+    live_particles_ = 0;
+    capacity_growths_ = 0;
+    sim_params_uploads_ = 0;
+    step_dispatches_ = 0;
+    step_barriers_ = 0;
+    inflow_interval_ = 0.0f;
+    inflow_seed_ = 0;
+    next_inflow_time_ = 0;
+    snapshot_fence_ = nullptr;
+    pending_barriers_ = 0;
+    scenario_ = scenario::DAM_BREAK;
+    seed_ = 0;
+    particle_buffer1_ = 0;
+    particle_buffer3_ = 0;
+    particle_buffer2_ = 0;
+    debug_buffer_ = 0;
+    pair_force_buffer_ = 0;
+    timestep_buffer_ = 0;
+    timestep_readback_buffer_ = 0;
+    solver_particle_buffer_ = 0;
+    solver_state_buffer_ = 0;
+    pressure_stats_buffer_ = 0;
+    sim_params_buffer_ = 0;
+    boundary_texture_ = 0;
+    profiler_ = Profiler::create();
+    recorder_ = Recorder::create();
+    checkpoint_ = Checkpoint::create();
+    simulated_time_ = 0;
+    fixed_time_ = 0;
+    adaptive_time_ = 0;
+    adaptive_dt_ = 0;
+    adaptive_read_steps_ = 0;
+    adaptive_steps_ = 0;
 }
 
 Fluid::~Fluid() {}
@@ -38,6 +127,16 @@ FluidRef Fluid::gridRes(int r) {
     return thisRef();
 }
 
+FluidRef Fluid::cellIndexing(int i) {
+    cell_indexing_ = i;
+    return thisRef();
+}
+
+FluidRef Fluid::particleLayout(int l) {
+    particle_layout_ = l;
+    return thisRef();
+}
+
 FluidRef Fluid::size(float s) {
     size_ = s;
     return thisRef();
@@ -83,6 +182,156 @@ FluidRef Fluid::gravityStrength(float g) {
     return thisRef();
 }
 
+FluidRef Fluid::cpuSolver(bool enabled) {
+    use_cpu_solver_ = enabled;
+    return thisRef();
+}
+
+FluidRef Fluid::solverTolerance(float t) {
+    solver_tolerance_ = t;
+    return thisRef();
+}
+
+FluidRef Fluid::neighborLists(bool enabled) {
+    use_neighbor_lists_ = enabled;
+    return thisRef();
+}
+
+FluidRef Fluid::neighborSkin(float s) {
+    neighbor_skin_ = s;
+    return thisRef();
+}
+
+FluidRef Fluid::symmetricPairs(bool enabled) {
+    symmetric_pairs_ = enabled;
+    return thisRef();
+}
+
+FluidRef Fluid::cellTiling(bool enabled) {
+    cell_tiling_ = enabled;
+    return thisRef();
+}
+
+FluidRef Fluid::scenario(int s) {
+    scenario_ = s;
+    return thisRef();
+}
+
+FluidRef Fluid::seed(unsigned s) {
+    seed_ = s;
+    return thisRef();
+}
+
+FluidRef Fluid::adaptiveTimestep(bool enabled) {
+    adaptive_timestep_ = enabled;
+    return thisRef();
+}
+
+FluidRef Fluid::cflNumber(float c) {
+    cfl_number_ = c;
+    return thisRef();
+}
+
+FluidRef Fluid::maxTimestep(float dt) {
+    max_timestep_ = dt;
+    return thisRef();
+}
+
+FluidRef Fluid::timeScale(float s) {
+    time_scale_ = s;
+    return thisRef();
+}
+
+FluidRef Fluid::pressureSolver(int s) {
+    pressure_solver_ = s;
+    return thisRef();
+}
+
+FluidRef Fluid::pressureTolerance(float t) {
+    pressure_tolerance_ = t;
+    return thisRef();
+}
+
+FluidRef Fluid::maxPressureIterations(int n) {
+    max_pressure_iterations_ = n;
+    return thisRef();
+}
+
+FluidRef Fluid::sdfBoundary(bool enabled) {
+    sdf_boundary_ = enabled;
+    return thisRef();
+}
+
+FluidRef Fluid::sdfResolution(int r) {
+    sdf_resolution_ = r;
+    return thisRef();
+}
+
+FluidRef Fluid::obstacle(const std::vector<vec3>& positions,
+                         const std::vector<uint32_t>& indices) {
+    const uint32_t first = uint32_t(obstacle_positions_.size());
+    obstacle_positions_.insert(obstacle_positions_.end(), positions.begin(), positions.end());
+    for (uint32_t index : indices) {
+        obstacle_indices_.push_back(first + index);
+    }
+    sdf_boundary_ = true;
+    return thisRef();
+}
+
+FluidRef Fluid::sleeping(bool enabled) {
+    use_sleeping_ = enabled;
+    return thisRef();
+}
+
+FluidRef Fluid::sleepSpeed(float s) {
+    sleep_speed_ = s;
+    return thisRef();
+}
+
+FluidRef Fluid::pipelined(bool enabled) {
+    pipelined_ = enabled;
+    return thisRef();
+}
+
+FluidRef Fluid::checkpoint(const std::string& path) {
+    checkpoint_path_ = path;
+    return thisRef();
+}
+
+FluidRef Fluid::emitter(EmitterRef e) {
+    emitters_.push_back(e);
+    return thisRef();
+}
+
+FluidRef Fluid::dynamicParticles(bool enabled) {
+    dynamic_particles_ = enabled;
+    return thisRef();
+}
+
+FluidRef Fluid::sink(vec3 min, vec3 max) {
+    sink_min_.push_back(min);
+    sink_max_.push_back(max);
+    dynamic_particles_ = true;
+    return thisRef();
+}
+
+FluidRef Fluid::inflow(EmitterRef e, float interval) {
+    inflow_ = e;
+    inflow_interval_ = interval;
+    dynamic_particles_ = true;
+    return thisRef();
+}
+
+FluidRef Fluid::specializeShaders(bool enabled) {
+    specialize_shaders_ = enabled;
+    return thisRef();
+}
+
+FluidRef Fluid::fusedSort(bool enabled) {
+    fused_sort_ = enabled;
+    return thisRef();
+}
+
 /**
  * setup GUI configuration parameters
  */
@@ -96,41 +345,163 @@ void Fluid::createParams() {
     params_->addParam("Rest Pressure", &rest_pressure_, "min=0.0 max=100000.0 step=100.0");
     params_->addParam("Gravity Strength", &gravity_strength_, "min=0.0 max=1000.0 step=10.0");
     params_->addParam("Rotate Gravity", &rotate_gravity_);
+    params_->addParam("Validate Scan", &validate_scan_);
+    params_->addParam("Fused Sort", &fused_sort_);
+    params_->addParam("CPU Solver", &use_cpu_solver_);
+    params_->addParam("Validate CPU Solver", &validate_cpu_solver_);
+    params_->addParam("CPU Utilization", &cpu_utilization_, true);
+    params_->addParam("Cell Tiling", &cell_tiling_);
+    params_->addParam("Compare Cell Tiling", &compare_cell_tiling_);
+    params_->addParam("List Rebuilds", &neighbor_list_rebuilds_, true);
+    params_->addParam("List Steps", &neighbor_list_steps_, true);
+    params_->addParam("CFL Number", &cfl_number_, "min=0.05 max=1.0 step=0.05");
+    params_->addParam("Max Timestep", &max_timestep_, "min=0.0001 max=0.01 step=0.0001");
+    params_->addParam("Pressure Tolerance", &pressure_tolerance_, "min=0.001 max=0.1 step=0.001");
+    params_->addParam("Max Pressure Iterations", &max_pressure_iterations_, "min=3 max=100 step=1");
+    params_->addParam("Pressure Iterations", &pressure_iterations_, true);
+    params_->addParam("Density Error", &pressure_error_, true);
+    params_->addParam("Awake Particles", &awake_particles_, true);
+    params_->addParam("Pipeline Waits", &pipeline_waits_, true);
+    params_->addParam("Live Particles", &live_particles_, true);
+    params_->addParam("Capacity Growths", &capacity_growths_, true);
+    params_->addParam("Param Uploads", &sim_params_uploads_, true);
+    params_->addParam("Step Dispatches", &step_dispatches_, true);
+    params_->addParam("Step Barriers", &step_barriers_, true);
+    profiler_->addParams(params_);
+    recorder_->addParams(params_);
+    ShaderCache::get()->addParams(params_);
 }
 
 /**
- * Generates a vector of particles used as the simulations initial state
+ * Generates a vector of particles used as the simulations initial state. Emitters only count
+ * their particles here, they are written straight into the particle buffer later.
  */
 void Fluid::generateInitialParticles() {
-    srand(0); // (unsigned)time(NULL));
-
-    util::log("creating particles");
-    int n = num_particles_;
-    initial_particles_.assign(n, Particle());
-    float distance = particle_radius_ * 1.75f;
-    int d = int(ceil(std::cbrt(n)));
-
-    float jitter = distance * 0.5f;
-    auto getJitter = [jitter]() { return ((float)rand() / RAND_MAX) * jitter - (jitter / 2.0f); };
-
-    for (int z = 0; z < d; z++) {
-        for (int y = 0; y < d; y++) {
-            for (int x = 0; x < d; x++) {
-                int index = z * d * d + y * d + x;
-                if (index >= n) {
-                    break;
-                }
+    if (!emitters_.empty()) {
+        const int num_threads = std::max(1, int(std::thread::hardware_concurrency()));
+        emitter_scheduler_ = TaskScheduler::create(num_threads);
+        num_particles_ = 0;
+        for (auto& emitter : emitters_) {
+            num_particles_ += emitter->count(emitter_scheduler_);
+        }
+        initial_particles_.clear();
+        util::log("emitting %d particles from %d emitters", num_particles_, int(emitters_.size()));
+        return;
+    }
 
-                // random position
-                // initial_particles_[index].position =
-                //     vec3(getRand() * size_, getRand() * size_, getRand() * size_);
+    util::log("creating %s particles, seed %u", scenario::name(scenario_).c_str(), seed_);
+    initial_particles_ =
+        scenario::generate(scenario_, num_particles_, size_, particle_radius_, seed_);
+}
 
-                // dam break
-                initial_particles_[index].position = vec3(x, y, z) * distance;
-                initial_particles_[index].position += vec3(getJitter(), getJitter(), getJitter());
-            }
-        }
+/**
+ * Map the checkpoint and take over the parameters it was saved with, the particle buffers and
+ * sort offsets are later created straight from the mapped file
+ */
+bool Fluid::loadCheckpoint() {
+    util::log("restarting from %s", checkpoint_path_.c_str());
+    if (!checkpoint_->open(checkpoint_path_)) {
+        return false;
+    }
+
+    const Checkpoint::Header& header = checkpoint_->header();
+    const int num_particles = int(header.num_particles);
+    const int particle_layout = int(header.particle_layout);
+    if (header.particle_bytes != layout::particleBufferSize(num_particles, particle_layout)) {
+        util::log("checkpoint particles don't match their layout, generating particles instead");
+        checkpoint_->close();
+        return false;
+    }
+
+    num_particles_ = num_particles;
+    particle_layout_ = particle_layout;
+    grid_res_ = int(header.grid_res);
+    cell_indexing_ = int(header.cell_indexing);
+    pressure_solver_ = int(header.pressure_solver);
+    size_ = header.size;
+    particle_radius_ = header.particle_radius;
+    viscosity_coefficient_ = header.viscosity_coefficient;
+    stiffness_ = header.stiffness;
+    rest_density_ = header.rest_density;
+    rest_pressure_ = header.rest_pressure;
+    gravity_strength_ = header.gravity_strength;
+    time_scale_ = header.time_scale;
+    gravity_direction_ = vec3(header.gravity_direction[0], header.gravity_direction[1],
+                              header.gravity_direction[2]);
+    simulated_time_ = header.simulated_time;
+    fixed_time_ = simulated_time_;
+    initial_particles_.clear();
+    util::log("restarting %d particles at %f seconds", num_particles_, simulated_time_);
+    return true;
+}
+
+/**
+ * Snapshot the stepped particles, the sort offsets and the parameters they need. The copy goes
+ * through a fenced staging buffer, so saving never waits on the GPU or the disk.
+ */
+bool Fluid::saveCheckpoint(const std::string& path) {
+    if (population_) {
+        util::log("checkpoints need a fixed particle count, skipping %s", path.c_str());
+        return false;
+    }
+
+    Checkpoint::Header header = {};
+    header.num_particles = uint32_t(num_particles_);
+    header.particle_layout = uint32_t(particle_layout_);
+    header.grid_res = uint32_t(grid_res_);
+    header.cell_indexing = uint32_t(cell_indexing_);
+    header.num_bins = uint32_t(num_bins_);
+    header.pressure_solver = uint32_t(pressure_solver_);
+    header.size = size_;
+    header.particle_radius = particle_radius_;
+    header.viscosity_coefficient = viscosity_coefficient_;
+    header.stiffness = stiffness_;
+    header.rest_density = rest_density_;
+    header.rest_pressure = rest_pressure_;
+    header.gravity_strength = gravity_strength_;
+    header.time_scale = time_scale_;
+    header.gravity_direction[0] = gravity_direction_.x;
+    header.gravity_direction[1] = gravity_direction_.y;
+    header.gravity_direction[2] = gravity_direction_.z;
+    header.gravity_direction[3] = 0;
+    header.simulated_time = simulated_time_;
+
+    flushBarriers();
+    return checkpoint_->save(path, header, particle_buffer1_, sort_->getOffsetBuffer());
+}
+
+/**
+ * Map the particle buffer for writing and let the emitters fill it in parallel, each one after
+ * the particles of the emitters before it
+ */
+void Fluid::emitParticles(GLuint particle_buffer) {
+    const auto size = layout::particleBufferSize(num_particles_, particle_layout_);
+    void* data = glMapNamedBufferRange(particle_buffer, 0, size,
+                                       GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    int first = 0;
+    for (auto& emitter : emitters_) {
+        emitter->emit(data, first, num_particles_, particle_layout_, emitter_scheduler_);
+        first += emitter->count();
     }
+    glUnmapNamedBuffer(particle_buffer);
+    emitter_scheduler_ = nullptr;
+}
+
+/**
+ * Create a particle buffer for the current capacity and the vertex array drawing its positions
+ */
+GLuint Fluid::createParticleBuffer(GLuint& vao, const void* data, GLbitfield flags) {
+    const GLsizei stride = particle_layout_ == SOA_LAYOUT ? sizeof(vec4) : sizeof(Particle);
+    GLuint buffer = 0;
+    glCreateBuffers(1, &buffer);
+    glNamedBufferStorage(buffer, layout::particleBufferSize(num_particles_, particle_layout_),
+                         data, GL_DYNAMIC_STORAGE_BIT | flags);
+    glCreateVertexArrays(1, &vao);
+    glEnableVertexArrayAttrib(vao, 0);
+    glVertexArrayVertexBuffer(vao, 0, buffer, 0, stride);
+    glVertexArrayAttribBinding(vao, 0, 0);
+    glVertexArrayAttribFormat(vao, 0, 3, GL_FLOAT, GL_FALSE, 0);
+    return buffer;
 }
 
 /**
@@ -139,30 +510,66 @@ void Fluid::generateInitialParticles() {
 void Fluid::prepareParticleBuffers() {
     util::log("\tcreating particle buffers");
 
-    const auto size = num_particles_ * sizeof(Particle);
+    const auto size = layout::particleBufferSize(num_particles_, particle_layout_);
+    const bool soa = particle_layout_ == SOA_LAYOUT;
+    // a checkpoint holds the buffer in its layout already, so the mapped file is uploaded as is
+    const bool restart = checkpoint_->isOpen();
+    const bool emit = !restart && !emitters_.empty();
+    const void* data = nullptr;
+    if (restart) {
+        data = checkpoint_->particles();
+    } else if (!soa && !emit) {
+        data = initial_particles_.data();
+    }
 
-    // Buffer 1
-    glCreateBuffers(1, &particle_buffer1_);
-    glNamedBufferStorage(particle_buffer1_, size, initial_particles_.data(), 0);
-    glCreateVertexArrays(1, &vao1_);
-    glEnableVertexArrayAttrib(vao1_, 0);
-    glVertexArrayVertexBuffer(vao1_, 0, particle_buffer1_, 0, sizeof(Particle));
-    glVertexArrayAttribBinding(vao1_, 0, 0);
-    glVertexArrayAttribFormat(vao1_, 0, 3, GL_FLOAT, GL_FALSE, 0);
+    // Buffer 1, the emitters write it mapped and the other buffers copy it
+    particle_buffer1_ = createParticleBuffer(vao1_, data, emit ? GL_MAP_WRITE_BIT : 0);
+    if (emit) {
+        emitParticles(particle_buffer1_);
+    }
 
     // Buffer 2
-    glCreateBuffers(1, &particle_buffer2_);
-    glNamedBufferStorage(particle_buffer2_, size, initial_particles_.data(), 0);
-    glCreateVertexArrays(1, &vao2_);
-    glEnableVertexArrayAttrib(vao2_, 0);
-    glVertexArrayVertexBuffer(vao2_, 0, particle_buffer2_, 0, sizeof(Particle));
-    glVertexArrayAttribBinding(vao2_, 0, 0);
-    glVertexArrayAttribFormat(vao2_, 0, 3, GL_FLOAT, GL_FALSE, 0);
+    particle_buffer2_ = createParticleBuffer(vao2_, data, 0);
+
+    // Buffer 3, only drawn from
+    if (pipelined_) {
+        particle_buffer3_ = createParticleBuffer(vao3_, data, 0);
+    }
+
+    if (emit) {
+        glCopyNamedBufferSubData(particle_buffer1_, particle_buffer2_, 0, 0, size);
+        if (pipelined_) {
+            glCopyNamedBufferSubData(particle_buffer1_, particle_buffer3_, 0, 0, size);
+        }
+    } else if (soa && !restart) {
+        util::setParticles(particle_buffer1_, initial_particles_, particle_layout_);
+        util::setParticles(particle_buffer2_, initial_particles_, particle_layout_);
+        if (pipelined_) {
+            util::setParticles(particle_buffer3_, initial_particles_, particle_layout_);
+        }
+    }
+}
 
+/**
+ * Per particle buffers besides the particles themselves, sized for the current capacity
+ */
+void Fluid::prepareScratchBuffers() {
     // debug buffer
     glCreateBuffers(1, &debug_buffer_);
     std::vector<uint32_t> zeros(num_particles_, 0);
     glNamedBufferStorage(debug_buffer_, num_particles_ * sizeof(uint32_t), zeros.data(), 0);
+
+    if (symmetric_pairs_) {
+        util::log("\tcreating pair force buffer");
+        glCreateBuffers(1, &pair_force_buffer_);
+        glNamedBufferStorage(pair_force_buffer_, num_particles_ * sizeof(vec4), nullptr, 0);
+    }
+
+    if (pressure_solver_ == PCISPH_PRESSURE) {
+        glCreateBuffers(1, &solver_particle_buffer_);
+        glNamedBufferStorage(solver_particle_buffer_, num_particles_ * 2 * sizeof(vec4), nullptr,
+                             0);
+    }
 }
 
 /**
@@ -172,8 +579,84 @@ void Fluid::prepareBuffers() {
     util::log("preparing fluid buffers");
 
     prepareParticleBuffers();
+    prepareScratchBuffers();
+
+    util::log("\tcreating simulation parameter buffer");
+    glCreateBuffers(1, &sim_params_buffer_);
+    glNamedBufferStorage(sim_params_buffer_, sizeof(SimParams), nullptr, GL_DYNAMIC_STORAGE_BIT);
+    // the block of a new buffer is written by the next update whatever the last one held
+    sim_params_uploads_ = 0;
+
+    if (adaptive_timestep_) {
+        util::log("\tcreating timestep buffer");
+        const std::vector<uint8_t> zeros(TIMESTEP_SIZE * TIMESTEP_RING, 0);
+        glCreateBuffers(1, &timestep_buffer_);
+        glNamedBufferStorage(timestep_buffer_, TIMESTEP_SIZE, zeros.data(),
+                             GL_DYNAMIC_STORAGE_BIT);
+        // start from the step a 60 fps frame would take
+        resetTimestep(time_scale_ / 60.0f);
+        glCreateBuffers(1, &timestep_readback_buffer_);
+        glNamedBufferStorage(timestep_readback_buffer_, TIMESTEP_SIZE * TIMESTEP_RING,
+                             zeros.data(), 0);
+        timestep_fences_.assign(TIMESTEP_RING, nullptr);
+        timestep_slot_steps_.assign(TIMESTEP_RING, 0);
+        timestep_slot_ = 0;
+    }
+
+    if (pressure_solver_ == PCISPH_PRESSURE) {
+        util::log("\tcreating pressure solver buffers");
+        const std::vector<uint32_t> zeros(4 * PRESSURE_STATS_RING, 0);
+        glCreateBuffers(1, &solver_state_buffer_);
+        glNamedBufferStorage(solver_state_buffer_, PRESSURE_STATS_SIZE, zeros.data(), 0);
+        glCreateBuffers(1, &pressure_stats_buffer_);
+        glNamedBufferStorage(pressure_stats_buffer_, PRESSURE_STATS_SIZE * PRESSURE_STATS_RING,
+                             zeros.data(), 0);
+        pressure_stats_fences_.assign(PRESSURE_STATS_RING, nullptr);
+    }
+
+    if (sdf_boundary_) {
+        prepareBoundary();
+    }
+
+    util::memoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT);
+}
+
+/**
+ * Build the boundary distance field from the container and the obstacles and upload it as a
+ * linearly filtered 3D texture
+ */
+void Fluid::prepareBoundary() {
+    util::log("\tcreating %d^3 boundary distance field", sdf_resolution_);
+    DistanceFieldRef field = DistanceField::box(sdf_resolution_, size_);
+    if (!obstacle_indices_.empty()) {
+        util::log("\tcarving %d obstacle triangles", int(obstacle_indices_.size() / 3));
+        const int num_threads = std::max(1, int(std::thread::hardware_concurrency()));
+        field->addObstacle(obstacle_positions_, obstacle_indices_,
+                           TaskScheduler::create(num_threads));
+    }
 
-    gl::memoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT);
+    const int n = field->getResolution();
+    const std::vector<vec4> volume = field->gradientVolume();
+    glCreateTextures(GL_TEXTURE_3D, 1, &boundary_texture_);
+    glTextureStorage3D(boundary_texture_, 1, GL_RGBA32F, n, n, n);
+    glTextureSubImage3D(boundary_texture_, 0, 0, 0, 0, n, n, n, GL_RGBA, GL_FLOAT, volume.data());
+    glTextureParameteri(boundary_texture_, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTextureParameteri(boundary_texture_, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTextureParameteri(boundary_texture_, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTextureParameteri(boundary_texture_, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTextureParameteri(boundary_texture_, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+}
+
+/**
+ * Bind the boundary distance field for a program compiled with SDF_BOUNDARY
+ */
+void Fluid::bindBoundary(const gl::GlslProgRef& prog) {
+    if (!sdf_boundary_) {
+        return;
+    }
+
+    glBindTextureUnit(BOUNDARY_TEXTURE_UNIT, boundary_texture_);
+    prog->uniform("boundarySdf", int(BOUNDARY_TEXTURE_UNIT));
 }
 
 /**
@@ -181,20 +664,153 @@ void Fluid::prepareBuffers() {
  */
 void Fluid::compileShaders() {
     util::log("compiling fluid shaders");
+    std::vector<std::string> defines = {grid::indexingDefine(cell_indexing_, num_bins_),
+                                        layout::layoutDefine(particle_layout_)};
+    if (use_neighbor_lists_) {
+        defines.push_back("NEIGHBOR_LIST");
+    }
+    if (adaptive_timestep_) {
+        defines.push_back("ADAPTIVE_TIMESTEP");
+    }
+    if (sdf_boundary_) {
+        defines.push_back("SDF_BOUNDARY");
+    }
+    if (use_sleeping_) {
+        defines.push_back("SLEEPING");
+    }
+    if (population_) {
+        defines.push_back("DYNAMIC_PARTICLES");
+    }
+    std::vector<std::string> constants;
+    if (specialize_shaders_) {
+        constants = {util::constantDefine("GRID_RES", grid_res_),
+                     util::constantDefine("KERNEL_RADIUS", kernel_radius_),
+                     util::constantDefine("POLY6_KERNEL_CONST", poly6_kernel_const_),
+                     util::constantDefine("SPIKY_KERNEL_CONST", spiky_kernel_const_),
+                     util::constantDefine("VISCOSITY_KERNEL_CONST", viscosity_kernel_const_)};
+        defines.insert(defines.end(), constants.begin(), constants.end());
+    }
 
     util::log("\tcompiling fluid density compute shader");
-    density_prog_ = util::compileComputeShader("fluid/density.comp");
+    density_prog_ = util::compileComputeShader("fluid/density.comp", defines);
+
+    if (symmetric_pairs_) {
+        util::log("\tcompiling fluid pair force compute shader");
+        pair_prog_ = util::compileComputeShader("fluid/pairs.comp", defines);
+    }
 
     util::log("\tcompiling fluid update compute shader");
-    update_prog_ = util::compileComputeShader("fluid/update.comp");
+    std::vector<std::string> update_defines = defines;
+    if (symmetric_pairs_) {
+        update_defines.push_back("PAIR_FORCES");
+    }
+    update_prog_ = util::compileComputeShader("fluid/update.comp", update_defines);
+
+    // one workgroup per bin variants, the neighbor lists and pair forces don't loop over bins
+    tiled_defines_ = defines;
+    tiled_defines_.push_back("CELL_TILING");
+    density_tiled_prog_ = nullptr;
+    update_tiled_prog_ = nullptr;
+    if (cell_tiling_ || compare_cell_tiling_) {
+        compileTiledShaders();
+    }
 
     util::log("\tcompiling fluid advect compute shader");
-    advect_prog_ = util::compileComputeShader("fluid/advect.comp");
+    std::vector<std::string> advect_defines;
+    if (sdf_boundary_) {
+        advect_defines.push_back("SDF_BOUNDARY");
+    }
+    if (population_) {
+        advect_defines.push_back("DYNAMIC_PARTICLES");
+    }
+    advect_prog_ = util::compileComputeShader("fluid/advect.comp", advect_defines);
+
+    if (adaptive_timestep_) {
+        util::log("\tcompiling fluid timestep compute shader");
+        std::vector<std::string> timestep_defines = {"ADAPTIVE_TIMESTEP"};
+        if (specialize_shaders_) {
+            timestep_defines.push_back(util::constantDefine("KERNEL_RADIUS", kernel_radius_));
+        }
+        timestep_prog_ = util::compileComputeShader("fluid/timestep.comp", timestep_defines);
+    }
+
+    if (pressure_solver_ == PCISPH_PRESSURE) {
+        util::log("\tcompiling fluid pressure solver compute shaders");
+        std::vector<std::string> stage_defines = defines;
+        stage_defines.push_back("PCISPH_PREDICT");
+        pcisph_predict_prog_ = util::compileComputeShader("fluid/pcisph.comp", stage_defines);
+        stage_defines.back() = "PCISPH_CORRECT";
+        pcisph_correct_prog_ = util::compileComputeShader("fluid/pcisph.comp", stage_defines);
+        stage_defines.back() = "PCISPH_PRESSURE";
+        pcisph_pressure_prog_ = util::compileComputeShader("fluid/pcisph.comp", stage_defines);
+    }
 
     util::log("\tcompiling fluid particles shader");
-    render_particles_prog_ = gl::GlslProg::create(gl::GlslProg::Format()
-                                                      .vertex(loadAsset("fluid/particle.vert"))
-                                                      .fragment(loadAsset("fluid/particle.frag")));
+    std::vector<std::string> render_defines = {defines[1]};
+    if (specialize_shaders_) {
+        render_defines.push_back(constants[0]);
+    }
+    render_particles_prog_ =
+        util::compileRenderShader("fluid/particle.vert", "fluid/particle.frag", render_defines);
+}
+
+/**
+ * Create the sorter, neighbor lists and activity for the current particle count
+ */
+void Fluid::prepareSolvers() {
+    util::log("initializing sorter");
+    sort_ = Sort::create()
+                ->numItems(num_particles_)
+                ->gridRes(grid_res_)
+                ->cellIndexing(cell_indexing_)
+                ->particleLayout(particle_layout_)
+                ->binSize(bin_size_)
+                ->profiler(profiler_)
+                ->population(population_)
+                ->specialize(specialize_shaders_);
+    // a checkpoint's offsets only fit the grid they were saved with
+    const bool restore_offsets =
+        checkpoint_->isOpen() && sort_->numBins() == int(checkpoint_->header().num_bins);
+    sort_->prepareBuffers(restore_offsets ? checkpoint_->offsets() : nullptr);
+    sort_->compileShaders();
+
+    if (use_neighbor_lists_) {
+        util::log("initializing neighbor lists");
+        neighbor_list_ = NeighborList::create()
+                             ->numItems(num_particles_)
+                             ->gridRes(grid_res_)
+                             ->binSize(bin_size_)
+                             ->kernelRadius(kernel_radius_)
+                             ->skin(neighbor_skin_)
+                             ->cellIndexing(cell_indexing_)
+                             ->particleLayout(particle_layout_)
+                             ->dynamicParticles(dynamic_particles_)
+                             ->specialize(specialize_shaders_);
+        neighbor_list_->prepareBuffers();
+        if (neighbor_list_->getSkin() <= 0.0f) {
+            util::log("\tbins are too small for a neighbor list skin, disabling neighbor lists");
+            neighbor_list_ = nullptr;
+            use_neighbor_lists_ = false;
+        } else {
+            neighbor_list_->compileShaders();
+        }
+    }
+
+    if (use_sleeping_) {
+        util::log("initializing activity");
+        activity_ = Activity::create()
+                        ->numItems(num_particles_)
+                        ->gridRes(grid_res_)
+                        ->binSize(bin_size_)
+                        ->cellIndexing(cell_indexing_)
+                        ->particleLayout(particle_layout_)
+                        ->sleepSpeed(sleep_speed_)
+                        ->wakeRadius(kernel_radius_ * 2.0f)
+                        ->dynamicParticles(dynamic_particles_)
+                        ->specialize(specialize_shaders_);
+        activity_->prepareBuffers();
+        activity_->compileShaders();
+    }
 }
 
 /**
@@ -202,38 +818,108 @@ void Fluid::compileShaders() {
  */
 FluidRef Fluid::setup() {
     util::log("initializing fluid");
+    // the builders hand out copies, so the members are only bound once the final object is set up
+    createParams();
+    ShaderCache::get()->resetStats();
     first_frame_ = true;
+    simulated_time_ = 0;
+    fixed_time_ = 0;
+    adaptive_time_ = 0;
+    adaptive_dt_ = 0;
+    adaptive_read_steps_ = 0;
+    adaptive_steps_ = 0;
+    const bool restart = !checkpoint_path_.empty() && loadCheckpoint();
+    if (!restart) {
+        generateInitialParticles();
+    }
     num_work_groups_ = int(ceil(float(num_particles_) / float(WORK_GROUP_SIZE)));
-    num_bins_ = int(pow(grid_res_, 3));
+    num_bins_ = grid::numCells(grid_res_, cell_indexing_, num_particles_);
     bin_size_ = size_ / float(grid_res_);
     kernel_radius_ = particle_radius_ * 4.0f;
     particle_mass_ = particle_radius_ * 8.0f;
     util::log("size: %f, numBins: %d, binSize: %f, kernelRadius: %f, particleMass: %f", size_,
               num_bins_, bin_size_, kernel_radius_, particle_mass_);
+    util::log("cell indexing: %s, particle layout: %s",
+              grid::indexingName(cell_indexing_).c_str(), layout::layoutDefine(particle_layout_));
 
     poly6_kernel_const_ = static_cast<float>(315.0 / (64.0 * M_PI * glm::pow(kernel_radius_, 9)));
     spiky_kernel_const_ = static_cast<float>(-45.0 / (M_PI * glm::pow(kernel_radius_, 6)));
     viscosity_kernel_const_ = static_cast<float>(45.0 / (M_PI * glm::pow(kernel_radius_, 6)));
+    pressure_delta_ = pressureDelta();
+    if (pressure_solver_ == PCISPH_PRESSURE) {
+        util::log("pressure solver: pcisph, delta * dt^2: %e", pressure_delta_);
+    }
 
     container_ = Container::create("fluidContainer", size_);
 
-    generateInitialParticles();
-
     ivec3 count = gl::getMaxComputeWorkGroupCount();
     CI_ASSERT(count.x >= num_work_groups_);
 
     prepareBuffers();
+
+    if (dynamic_particles_) {
+        util::log("initializing population");
+        population_ =
+            Population::create()->capacity(num_particles_)->particleLayout(particle_layout_);
+        for (size_t i = 0; i < sink_min_.size(); i++) {
+            population_->sink(sink_min_[i], sink_max_[i]);
+        }
+        population_->prepareBuffers(num_particles_);
+        population_->compileShaders();
+        next_inflow_time_ = 0;
+    }
+    live_particles_ = num_particles_;
+
+    prepareSolvers();
+    checkpoint_->close();
+
+    // the shaders depend on whether the neighbor lists survived their setup
     compileShaders();
 
-    util::log("initializing sorter");
-    sort_ = Sort::create()->numItems(num_particles_)->gridRes(grid_res_)->binSize(bin_size_);
-    sort_->prepareBuffers();
-    sort_->compileShaders();
+    util::log("initializing cpu solver");
+    cpu_solver_ = CpuSolver::create();
+    cpu_solver_->setup(num_particles_, grid_res_, cell_indexing_);
+    cpu_particles_valid_ = false;
+    util::log("\tcpu solver threads: %d", cpu_solver_->numThreads());
+    util::log("\tcpu solver kernels: %s", simd::name(cpu_solver_->kernelIsa()).c_str());
 
+    recorder_->setParticleFormat(num_particles_, particle_layout_);
+
+    ShaderCache::get()->logStats();
     util::log("fluid created");
     return std::make_shared<Fluid>(*this);
 }
 
+/**
+ * Bytes of GPU buffer storage held by the simulation and its sorter and neighbor lists
+ */
+size_t Fluid::memoryUsage() {
+    size_t bytes = util::bufferSize(particle_buffer1_) + util::bufferSize(particle_buffer2_) +
+                   util::bufferSize(particle_buffer3_) +
+                   util::bufferSize(debug_buffer_) + util::bufferSize(pair_force_buffer_) +
+                   util::bufferSize(timestep_buffer_) + util::bufferSize(solver_particle_buffer_) +
+                   util::bufferSize(solver_state_buffer_) +
+                   util::bufferSize(pressure_stats_buffer_) +
+                   util::bufferSize(timestep_readback_buffer_) +
+                   util::bufferSize(sim_params_buffer_);
+    if (boundary_texture_) {
+        bytes += size_t(sdf_resolution_) * sdf_resolution_ * sdf_resolution_ * sizeof(vec4);
+    }
+    if (sort_) {
+        bytes += sort_->memoryUsage();
+    }
+    if (neighbor_list_) {
+        bytes += neighbor_list_->memoryUsage();
+    }
+    if (activity_) {
+        bytes += activity_->memoryUsage();
+    }
+    if (population_) {
+        bytes += population_->memoryUsage();
+    }
+    return bytes;
+}
+
 vec3 Fluid::translateWorldSpacePosition(vec3 p) { return p - position_; }
 
 vec3 Fluid::rotateWorldSpacePosition(vec3 p) {
@@ -259,65 +945,248 @@ Ray Fluid::getRelativeMouseRay() {
 void Fluid::updateGravity() {
     if (rotate_gravity_) {
         gravity_direction_ = rotateWorldSpacePosition(vec3(0, -1, 0));
+        // sleeping particles would float against the new gravity
+        if (activity_) {
+            activity_->wakeAll();
+        }
     }
 }
 
+/**
+ * Write the parameters every pass reads to the SimParams block, with a single upload and only
+ * when one of them changed since the last one, then bind it for the passes of the step
+ */
+void Fluid::updateSimParams() {
+    SimParams params = {};
+    params.gravity = gravity_direction_ * gravity_strength_;
+    params.size = size_;
+    params.bin_size = bin_size_;
+    params.grid_res = grid_res_;
+    params.num_particles = num_particles_;
+    params.particle_mass = particle_mass_;
+    params.kernel_radius = kernel_radius_;
+    params.stiffness = stiffness_;
+    params.rest_density = rest_density_;
+    params.rest_pressure = rest_pressure_;
+    params.viscosity_coefficient = viscosity_coefficient_;
+    params.poly6_kernel_const = poly6_kernel_const_;
+    params.spiky_kernel_const = spiky_kernel_const_;
+    params.viscosity_kernel_const = viscosity_kernel_const_;
+    params.pressure_delta = pressure_delta_;
+    params.pressure_tolerance = pressure_tolerance_;
+    params.min_pressure_iterations = min_pressure_iterations_;
+    params.cfl_number = cfl_number_;
+    params.force_number = force_number_;
+    params.min_dt = min_timestep_;
+    params.max_dt = max_timestep_;
+
+    if (sim_params_uploads_ == 0 || std::memcmp(&params, &sim_params_, sizeof(params)) != 0) {
+        sim_params_ = params;
+        glNamedBufferSubData(sim_params_buffer_, 0, sizeof(params), &params);
+        sim_params_uploads_++;
+    }
+    glBindBufferBase(GL_UNIFORM_BUFFER, SIM_PARAMS_BINDING, sim_params_buffer_);
+}
+
+/**
+ * Compiles the one workgroup per bin variants with the defines of the last compileShaders
+ */
+void Fluid::compileTiledShaders() {
+    util::log("\tcompiling fluid tiled density compute shader");
+    density_tiled_prog_ = util::compileComputeShader("fluid/density.comp", tiled_defines_);
+
+    util::log("\tcompiling fluid tiled update compute shader");
+    update_tiled_prog_ = util::compileComputeShader("fluid/update.comp", tiled_defines_);
+}
+
 /**
  * Run density compute shader
  */
 void Fluid::runDensityProg(GLuint particle_buffer) {
-    gl::ScopedGlslProg prog(density_prog_);
-
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, particle_buffer);
+    ScopedTimer timer(profiler_, "Density");
+    const bool tiled = cell_tiling_ && !neighbor_list_ && !awake_only_ &&
+                       cell_indexing_ != grid::HASHED_INDEXING;
+    const gl::GlslProgRef& density_prog = tiled ? density_tiled_prog_ : density_prog_;
+    gl::ScopedGlslProg prog(density_prog);
+
+    if (particle_layout_ == SOA_LAYOUT) {
+        util::bindParticleStream(0, particle_buffer, POSITION_STREAM, num_particles_);
+        util::bindParticleStream(4, particle_buffer, DENSITY_STREAM, num_particles_);
+        util::bindParticleStream(5, particle_buffer, PRESSURE_STREAM, num_particles_);
+    } else {
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, particle_buffer);
+    }
     glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, sort_->getCountBuffer());
     glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, sort_->getOffsetBuffer());
     glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, debug_buffer_);
+    if (neighbor_list_) {
+        neighbor_list_->bindLists();
+    }
 
-    density_prog_->uniform("size", size_);
-    density_prog_->uniform("binSize", bin_size_);
-    density_prog_->uniform("gridRes", grid_res_);
-    density_prog_->uniform("numParticles", num_particles_);
-    density_prog_->uniform("particleMass", particle_mass_);
-    density_prog_->uniform("kernelRadius", kernel_radius_);
-    density_prog_->uniform("stiffness", stiffness_);
-    density_prog_->uniform("restDensity", rest_density_);
-    density_prog_->uniform("restPressure", rest_pressure_);
-    density_prog_->uniform("poly6KernelConst", poly6_kernel_const_);
+    bindBoundary(density_prog);
+
+    if (tiled) {
+        util::runProg(ivec3(grid_res_));
+    } else {
+        runParticleProg(density_prog);
+    }
+    util::memoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+/**
+ * Run pair force compute shader, sums the symmetric forces into pair_force_buffer_
+ */
+void Fluid::runPairProg(GLuint particle_buffer) {
+    ScopedTimer timer(profiler_, "Pairs");
+    const float zero = 0.0f;
+    glClearNamedBufferData(pair_force_buffer_, GL_R32F, GL_RED, GL_FLOAT, &zero);
+    util::memoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+
+    gl::ScopedGlslProg prog(pair_prog_);
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, sort_->getCountBuffer());
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, sort_->getOffsetBuffer());
+    if (particle_layout_ == SOA_LAYOUT) {
+        util::bindParticleStream(0, particle_buffer, POSITION_STREAM, num_particles_);
+        util::bindParticleStream(3, particle_buffer, VELOCITY_STREAM, num_particles_);
+        util::bindParticleStream(5, particle_buffer, DENSITY_STREAM, num_particles_);
+        util::bindParticleStream(6, particle_buffer, PRESSURE_STREAM, num_particles_);
+    } else {
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, particle_buffer);
+    }
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 10, pair_force_buffer_);
+    if (neighbor_list_) {
+        neighbor_list_->bindLists();
+    }
 
     runProg();
-    gl::memoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+    util::memoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
 }
 
 /**
- * Run update compute shader
+ * Run update compute shader, preceded by the pair force pass when pairs are symmetric
  */
 void Fluid::runUpdateProg(GLuint in_particle_buffer, GLuint out_particle_buffer, float time_step) {
-    gl::ScopedGlslProg prog(update_prog_);
+    if (symmetric_pairs_) {
+        runPairProg(in_particle_buffer);
+    }
+
+    ScopedTimer timer(profiler_, "Update");
+
+    const bool tiled = cell_tiling_ && !neighbor_list_ && !symmetric_pairs_ && !awake_only_ &&
+                       cell_indexing_ != grid::HASHED_INDEXING;
+    const gl::GlslProgRef& update_prog = tiled ? update_tiled_prog_ : update_prog_;
+    gl::ScopedGlslProg prog(update_prog);
 
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, in_particle_buffer);
     glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, sort_->getCountBuffer());
     glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, sort_->getOffsetBuffer());
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, debug_buffer_);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, out_particle_buffer);
+    if (particle_layout_ == SOA_LAYOUT) {
+        const int n = num_particles_;
+        util::bindParticleStream(0, in_particle_buffer, POSITION_STREAM, n);
+        util::bindParticleStream(3, in_particle_buffer, VELOCITY_STREAM, n);
+        util::bindParticleStream(4, out_particle_buffer, POSITION_STREAM, n);
+        util::bindParticleStream(5, in_particle_buffer, DENSITY_STREAM, n);
+        util::bindParticleStream(6, in_particle_buffer, PRESSURE_STREAM, n);
+        util::bindParticleStream(7, out_particle_buffer, VELOCITY_STREAM, n);
+        util::bindParticleStream(8, out_particle_buffer, DENSITY_STREAM, n);
+        util::bindParticleStream(9, out_particle_buffer, PRESSURE_STREAM, n);
+    } else {
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, in_particle_buffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, debug_buffer_);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, out_particle_buffer);
+    }
+    if (neighbor_list_) {
+        neighbor_list_->bindLists();
+        neighbor_list_->bindDisplacement();
+    }
+    if (symmetric_pairs_) {
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 10, pair_force_buffer_);
+    }
+    if (adaptive_timestep_) {
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 15, timestep_buffer_);
+    }
 
     Ray mouse_ray = getRelativeMouseRay();
 
-    update_prog_->uniform("size", size_);
-    update_prog_->uniform("binSize", bin_size_);
-    update_prog_->uniform("gridRes", grid_res_);
-    update_prog_->uniform("dt", time_step * time_scale_);
-    update_prog_->uniform("numParticles", num_particles_);
-    update_prog_->uniform("gravity", gravity_direction_ * gravity_strength_);
-    update_prog_->uniform("particleMass", particle_mass_);
-    update_prog_->uniform("kernelRadius", kernel_radius_);
-    update_prog_->uniform("viscosityCoefficient", viscosity_coefficient_);
-    update_prog_->uniform("cameraPosition", mouse_ray.getOrigin());
-    update_prog_->uniform("mouseRayDirection", mouse_ray.getDirection());
-    update_prog_->uniform("spikyKernelConst", spiky_kernel_const_);
-    update_prog_->uniform("viscosityKernelConst", viscosity_kernel_const_);
+    if (!adaptive_timestep_) {
+        update_prog->uniform("dt", time_step * time_scale_);
+    }
+    update_prog->uniform("cameraPosition", mouse_ray.getOrigin());
+    update_prog->uniform("mouseRayDirection", mouse_ray.getDirection());
+    bindBoundary(update_prog);
+
+    if (awake_only_) {
+        // the sleeping particles are carried over unchanged
+        glCopyNamedBufferSubData(in_particle_buffer, out_particle_buffer, 0, 0,
+                                 layout::particleBufferSize(num_particles_, particle_layout_));
+        util::memoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+    }
 
-    runProg();
-    gl::memoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    if (tiled) {
+        util::runProg(ivec3(grid_res_));
+    } else {
+        runParticleProg(update_prog);
+    }
+
+    if (pipelined_) {
+        // the frame's draw reads the snapshot, so only the next reader has to wait for this
+        pending_barriers_ |= GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT;
+    } else {
+        util::memoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    }
+}
+
+/**
+ * Dispatch the bound per particle program over every particle, only over the live ones in the
+ * dynamic mode
+ */
+void Fluid::runProg() {
+    if (population_) {
+        population_->dispatch();
+    } else {
+        util::runProg(num_work_groups_);
+    }
+}
+
+/**
+ * Issue the barriers deferred by the last update pass
+ */
+void Fluid::flushBarriers() {
+    if (pending_barriers_) {
+        util::memoryBarrier(pending_barriers_);
+        pending_barriers_ = 0;
+    }
+}
+
+/**
+ * Dispatch a per particle program over every particle, or indirectly over the awake ones
+ */
+void Fluid::runParticleProg(const gl::GlslProgRef& prog) {
+    if (!activity_) {
+        runProg();
+        return;
+    }
+
+    prog->uniform("awakeOnly", awake_only_);
+    if (awake_only_) {
+        activity_->bindAwake();
+        activity_->dispatch();
+    } else {
+        runProg();
+    }
+}
+
+/**
+ * Find the awake particles of the sorted particles, the next density and update passes only
+ * run over them
+ */
+void Fluid::runActivityProg(GLuint particle_buffer) {
+    ScopedTimer timer(profiler_, "Activity");
+    Ray mouse_ray = getRelativeMouseRay();
+    activity_->update(particle_buffer, sort_->getCountBuffer(), sort_->getOffsetBuffer(),
+                      mouse_ray.getOrigin(), mouse_ray.getDirection());
+    awake_particles_ = activity_->numAwake();
+    awake_only_ = true;
 }
 
 /**
@@ -328,31 +1197,581 @@ void Fluid::runAdvectProg(GLuint particle_buffer, float time_step) {
 
     glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, particle_buffer);
 
-    advect_prog_->uniform("size", size_);
     advect_prog_->uniform("dt", time_step * time_scale_);
-    advect_prog_->uniform("numParticles", num_particles_);
+    bindBoundary(advect_prog_);
 
     runProg();
-    gl::memoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    util::memoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
 }
 
 /**
- * Update simulation logic - run compute shaders
+ * Pick the dt of the next step from the maxima the update pass reduced, all on the GPU so the
+ * next update reads it without waiting for a readback
  */
-void Fluid::update(double time) {
-    updateGravity();
+void Fluid::runTimestepProg() {
+    ScopedTimer timer(profiler_, "Timestep");
+    gl::ScopedGlslProg prog(timestep_prog_);
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 15, timestep_buffer_);
+
+    util::runProg(1);
+    // the copy of trackTimestep reads what the pass wrote
+    util::memoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+    adaptive_steps_++;
+    trackTimestep();
+}
+
+/**
+ * Copy the next dt and the adaptive time the timestep pass just wrote into the ring, a slot still
+ * pending after a full ring of steps is dropped
+ */
+void Fluid::trackTimestep() {
+    readTimestep();
+
+    const int slot = timestep_slot_;
+    if (timestep_fences_[slot]) {
+        glDeleteSync(timestep_fences_[slot]);
+    }
+    glCopyNamedBufferSubData(timestep_buffer_, timestep_readback_buffer_, 0,
+                             slot * TIMESTEP_SIZE, TIMESTEP_SIZE);
+    timestep_fences_[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    timestep_slot_steps_[slot] = adaptive_steps_;
+    timestep_slot_ = (slot + 1) % TIMESTEP_RING;
+}
+
+/**
+ * Read the timestep copies whose fence has passed, oldest first, without waiting
+ */
+void Fluid::readTimestep() {
+    for (int i = 0; i < TIMESTEP_RING; i++) {
+        const int slot = (timestep_slot_ + i) % TIMESTEP_RING;
+        GLsync& fence = timestep_fences_[slot];
+        if (!fence) {
+            continue;
+        }
+        if (glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED) {
+            break;
+        }
+
+        uint8_t timestep[TIMESTEP_SIZE];
+        glGetNamedBufferSubData(timestep_readback_buffer_, slot * TIMESTEP_SIZE, TIMESTEP_SIZE,
+                                timestep);
+        glDeleteSync(fence);
+        fence = nullptr;
+
+        std::memcpy(&adaptive_dt_, timestep, sizeof(adaptive_dt_));
+        std::memcpy(&adaptive_time_, timestep + 4 * sizeof(uint32_t), sizeof(adaptive_time_));
+        adaptive_read_steps_ = timestep_slot_steps_[slot];
+    }
+}
+
+/**
+ * Overwrite the adaptive dt and clear the reduced maxima
+ */
+void Fluid::resetTimestep(float dt) {
+    // dt followed by the float bits of the largest speed and acceleration
+    uint32_t timestep[3] = {0, 0, 0};
+    std::memcpy(&timestep[0], &dt, sizeof(dt));
+    glNamedBufferSubData(timestep_buffer_, 0, sizeof(timestep), timestep);
+    util::memoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+}
+
+/**
+ * PCISPH scaling factor from Solenthaler and Pajarola (2009), Equation (8), for a prototype
+ * particle with a full lattice of neighbors at the rest spacing of the scenarios. The dt^2 of
+ * beta is left to the shader so the factor holds for any step size. The pair pressure of
+ * Harada's Equation (6) is half the one the paper derives it with, so beta loses its factor 2.
+ */
+float Fluid::pressureDelta() {
+    const float spacing = particle_radius_ * 1.75f;
+    const int extent = int(ceil(kernel_radius_ / spacing));
+    vec3 gradient_sum(0);
+    float gradient_dot = 0;
+    for (int x = -extent; x <= extent; x++) {
+        for (int y = -extent; y <= extent; y++) {
+            for (int z = -extent; z <= extent; z++) {
+                const vec3 r = -vec3(x, y, z) * spacing;
+                const float d = glm::length(r);
+                if (d <= 0 || d >= kernel_radius_) {
+                    continue;
+                }
+
+                const vec3 gradient =
+                    spiky_kernel_const_ * (kernel_radius_ - d) * (kernel_radius_ - d) * (r / d);
+                gradient_sum += gradient;
+                gradient_dot += glm::dot(gradient, gradient);
+            }
+        }
+    }
+
+    const float beta = (particle_mass_ / rest_density_) * (particle_mass_ / rest_density_);
+    return 1.0f / (beta * (glm::dot(gradient_sum, gradient_sum) + gradient_dot));
+}
+
+/**
+ * Bind the buffers and uniforms of one pressure solver stage and run it
+ */
+void Fluid::runPressureProg(const gl::GlslProgRef& prog, GLuint particle_buffer, int iteration,
+                            float time_step) {
+    gl::ScopedGlslProg scoped_prog(prog);
+
+    if (particle_layout_ == SOA_LAYOUT) {
+        const int n = num_particles_;
+        util::bindParticleStream(0, particle_buffer, POSITION_STREAM, n);
+        util::bindParticleStream(3, particle_buffer, VELOCITY_STREAM, n);
+        util::bindParticleStream(5, particle_buffer, DENSITY_STREAM, n);
+        util::bindParticleStream(6, particle_buffer, PRESSURE_STREAM, n);
+    } else {
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, particle_buffer);
+    }
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, sort_->getCountBuffer());
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, sort_->getOffsetBuffer());
+    if (neighbor_list_) {
+        neighbor_list_->bindLists();
+    }
+    if (adaptive_timestep_) {
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 15, timestep_buffer_);
+    }
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 16, solver_particle_buffer_);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 17, solver_state_buffer_);
+
+    prog->uniform("iteration", iteration);
+    if (!adaptive_timestep_) {
+        prog->uniform("dt", time_step * time_scale_);
+    }
+    bindBoundary(prog);
+
+    runProg();
+    util::memoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+/**
+ * Replace the equation of state pressures of the density pass with PCISPH pressures. Every
+ * iteration up to the cap is issued, the stages return at once after convergence, so the
+ * number of iterations is decided on the GPU and only reported back later.
+ */
+void Fluid::runPressureSolver(GLuint particle_buffer, float time_step) {
+    {
+        ScopedTimer timer(profiler_, "Pressure");
+        const int max_iterations = std::max(max_pressure_iterations_, min_pressure_iterations_);
+        for (int iteration = 0; iteration < max_iterations; iteration++) {
+            runPressureProg(pcisph_predict_prog_, particle_buffer, iteration, time_step);
+            runPressureProg(pcisph_correct_prog_, particle_buffer, iteration, time_step);
+            runPressureProg(pcisph_pressure_prog_, particle_buffer, iteration, time_step);
+        }
+    }
+
+    readPressureStats();
+
+    // a slot still pending after a full ring of steps is dropped
+    const int slot = pressure_stats_slot_;
+    if (pressure_stats_fences_[slot]) {
+        glDeleteSync(pressure_stats_fences_[slot]);
+    }
+    glCopyNamedBufferSubData(solver_state_buffer_, pressure_stats_buffer_, 0,
+                             slot * PRESSURE_STATS_SIZE, PRESSURE_STATS_SIZE);
+    pressure_stats_fences_[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    pressure_stats_slot_ = (slot + 1) % PRESSURE_STATS_RING;
+}
+
+/**
+ * Read the solver state copies whose fence has passed, oldest first, without waiting
+ */
+void Fluid::readPressureStats() {
+    for (int i = 0; i < PRESSURE_STATS_RING; i++) {
+        const int slot = (pressure_stats_slot_ + i) % PRESSURE_STATS_RING;
+        GLsync& fence = pressure_stats_fences_[slot];
+        if (!fence) {
+            continue;
+        }
+        if (glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED) {
+            break;
+        }
 
+        // error bits of both parities, then the iteration count
+        uint32_t state[4];
+        glGetNamedBufferSubData(pressure_stats_buffer_, slot * PRESSURE_STATS_SIZE,
+                                PRESSURE_STATS_SIZE, state);
+        glDeleteSync(fence);
+        fence = nullptr;
+
+        pressure_iterations_ = int(state[2]);
+        float error = 0;
+        std::memcpy(&error, &state[(state[2] + 1) & 1], sizeof(error));
+        pressure_error_ = error / rest_density_;
+    }
+}
+
+/**
+ * Collect the simulation parameters for the CPU solver
+ */
+SolverParams Fluid::getSolverParams(float time_step) {
+    SolverParams params;
+    Ray mouse_ray = getRelativeMouseRay();
+
+    params.size = size_;
+    params.bin_size = bin_size_;
+    params.grid_res = grid_res_;
+    params.cell_indexing = cell_indexing_;
+    params.dt = time_step * time_scale_;
+    params.gravity = gravity_direction_ * gravity_strength_;
+    params.particle_mass = particle_mass_;
+    params.kernel_radius = kernel_radius_;
+    params.stiffness = stiffness_;
+    params.rest_density = rest_density_;
+    params.rest_pressure = rest_pressure_;
+    params.viscosity_coefficient = viscosity_coefficient_;
+    params.poly6_kernel_const = poly6_kernel_const_;
+    params.spiky_kernel_const = spiky_kernel_const_;
+    params.viscosity_kernel_const = viscosity_kernel_const_;
+    params.mouse_origin = mouse_ray.getOrigin();
+    params.mouse_direction = mouse_ray.getDirection();
+    params.symmetric_pairs = symmetric_pairs_;
+    return params;
+}
+
+/**
+ * Sort, compute densities and integrate with compute shaders
+ */
+void Fluid::runGpuSolver(float time_step) {
     // util::printParticles(in_particles, debug_buffer_, 10, bin_size_);
 
+    sort_->setValidateScan(validate_scan_);
     sort_->run(particle_buffer1_, particle_buffer2_);
 
+    if (activity_) {
+        runActivityProg(particle_buffer2_);
+    }
     runDensityProg(particle_buffer2_);
-    runUpdateProg(particle_buffer2_, particle_buffer1_, float(time));
-    // runAdvectProg(out_particles, float(time));
+    if (pressure_solver_ == PCISPH_PRESSURE) {
+        runPressureSolver(particle_buffer2_, time_step);
+    }
+    runUpdateProg(particle_buffer2_, particle_buffer1_, time_step);
+    awake_only_ = false;
+    if (adaptive_timestep_) {
+        flushBarriers();
+        runTimestepProg();
+    }
+    // runAdvectProg(out_particles, time_step);
 
     // util::printParticles(out_particles, debug_buffer_, 10, bin_size_);
 }
 
+/**
+ * Like runGpuSolver but only sorts and rebuilds the neighbor lists once a particle
+ * has moved further than half the skin, otherwise the previous order is kept
+ */
+void Fluid::runNeighborListSolver(float time_step) {
+    if (neighbor_list_->expired()) {
+        sort_->setValidateScan(validate_scan_);
+        sort_->run(particle_buffer1_, particle_buffer2_);
+
+        ScopedTimer timer(profiler_, "Neighbors");
+        neighbor_list_->build(particle_buffer2_, sort_->getCountBuffer(),
+                              sort_->getOffsetBuffer());
+    } else {
+        // update keeps the particle order so the lists still index the copy
+        ScopedTimer timer(profiler_, "Copy");
+        glCopyNamedBufferSubData(particle_buffer1_, particle_buffer2_, 0, 0,
+                                 layout::particleBufferSize(num_particles_, particle_layout_));
+        util::memoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+    }
+
+    if (activity_) {
+        runActivityProg(particle_buffer2_);
+    }
+    runDensityProg(particle_buffer2_);
+    if (pressure_solver_ == PCISPH_PRESSURE) {
+        runPressureSolver(particle_buffer2_, time_step);
+    }
+    runUpdateProg(particle_buffer2_, particle_buffer1_, time_step);
+    neighbor_list_->track();
+    awake_only_ = false;
+    if (adaptive_timestep_) {
+        flushBarriers();
+        runTimestepProg();
+    }
+
+    neighbor_list_rebuilds_ = neighbor_list_->numRebuilds();
+    neighbor_list_steps_ = neighbor_list_->numSteps();
+}
+
+/**
+ * Step the CPU solver and upload the result for rendering
+ */
+void Fluid::runCpuSolver(float time_step) {
+    if (!cpu_particles_valid_) {
+        cpu_particles_ = util::getParticles(particle_buffer1_, num_particles_, particle_layout_);
+        cpu_particles_valid_ = true;
+    }
+
+    TaskSchedulerRef scheduler = cpu_solver_->getScheduler();
+    scheduler->resetStats();
+    cpu_solver_->step(cpu_particles_, getSolverParams(time_step));
+    cpu_utilization_ = float(scheduler->meanUtilization());
+
+    util::setParticles(particle_buffer1_, cpu_particles_, particle_layout_);
+}
+
+/**
+ * Run one GPU step and the CPU solver on the same sorted input,
+ * returns true if the results agree within solver_tolerance_
+ */
+bool Fluid::validateCpuSolver(float time_step) {
+    sort_->run(particle_buffer1_, particle_buffer2_);
+    if (neighbor_list_) {
+        neighbor_list_->build(particle_buffer2_, sort_->getCountBuffer(),
+                              sort_->getOffsetBuffer());
+    }
+    std::vector<Particle> particles =
+        util::getParticles(particle_buffer2_, num_particles_, particle_layout_);
+    if (adaptive_timestep_) {
+        // both solvers have to take the same step
+        resetTimestep(time_step * time_scale_);
+    }
+
+    runDensityProg(particle_buffer2_);
+    runUpdateProg(particle_buffer2_, particle_buffer1_, time_step);
+    flushBarriers();
+    std::vector<Particle> gpu_particles =
+        util::getParticles(particle_buffer1_, num_particles_, particle_layout_);
+
+    // the input is already sorted so the CPU sort keeps the GPU order
+    cpu_solver_->step(particles, getSolverParams(time_step));
+
+    float position_error = 0;
+    float velocity_error = 0;
+    for (int i = 0; i < num_particles_; i++) {
+        const Particle& a = gpu_particles[i];
+        const Particle& b = particles[i];
+        position_error = std::max(position_error, glm::length(a.position - b.position) / size_);
+        velocity_error = std::max(velocity_error, glm::length(a.velocity - b.velocity) /
+                                                      std::max(glm::length(a.velocity), 1.0f));
+    }
+
+    const bool passed = position_error <= solver_tolerance_ && velocity_error <= solver_tolerance_;
+    util::log("cpu solver check %s: position error %e, velocity error %e (tolerance %e)",
+              passed ? "passed" : "FAILED", position_error, velocity_error, solver_tolerance_);
+    return passed;
+}
+
+/**
+ * Run the density and update passes per particle and per bin on the same sorted input,
+ * log their GPU times side by side along with the largest difference of the results
+ */
+void Fluid::compareCellTiling(float time_step) {
+    const bool cell_tiling = cell_tiling_;
+    const int n = num_particles_;
+
+    sort_->run(particle_buffer1_, particle_buffer2_);
+
+    // density only reads positions so both variants can run in place on the same buffer
+    cell_tiling_ = false;
+    const double density_ms = util::timeGpu([&]() { runDensityProg(particle_buffer2_); });
+    std::vector<Particle> densities = util::getParticles(particle_buffer2_, n, particle_layout_);
+
+    cell_tiling_ = true;
+    const double density_tiled_ms = util::timeGpu([&]() { runDensityProg(particle_buffer2_); });
+    std::vector<Particle> tiled_densities =
+        util::getParticles(particle_buffer2_, n, particle_layout_);
+
+    cell_tiling_ = false;
+    const double update_ms =
+        util::timeGpu([&]() { runUpdateProg(particle_buffer2_, particle_buffer1_, time_step); });
+    flushBarriers();
+    std::vector<Particle> updated = util::getParticles(particle_buffer1_, n, particle_layout_);
+
+    cell_tiling_ = true;
+    const double update_tiled_ms =
+        util::timeGpu([&]() { runUpdateProg(particle_buffer2_, particle_buffer1_, time_step); });
+    flushBarriers();
+    std::vector<Particle> tiled_updated =
+        util::getParticles(particle_buffer1_, n, particle_layout_);
+
+    cell_tiling_ = cell_tiling;
+
+    float density_error = 0;
+    float position_error = 0;
+    float velocity_error = 0;
+    for (int i = 0; i < n; i++) {
+        const Particle& a = updated[i];
+        const Particle& b = tiled_updated[i];
+        density_error =
+            std::max(density_error, std::abs(densities[i].density - tiled_densities[i].density) /
+                                        std::max(densities[i].density, 1.0f));
+        position_error = std::max(position_error, glm::length(a.position - b.position) / size_);
+        velocity_error = std::max(velocity_error, glm::length(a.velocity - b.velocity) /
+                                                      std::max(glm::length(a.velocity), 1.0f));
+    }
+
+    util::log("pass     per particle   per bin");
+    util::log("density  %9.3f ms  %9.3f ms  (density error %e)", density_ms, density_tiled_ms,
+              density_error);
+    util::log("update   %9.3f ms  %9.3f ms  (position error %e, velocity error %e)", update_ms,
+              update_tiled_ms, position_error, velocity_error);
+}
+
+/**
+ * Queue the inflow that is due, grow the buffers if the queued particles could overflow them and
+ * append the queue behind the live particles of buffer 1, where the next sort picks them up
+ */
+void Fluid::stepPopulation() {
+    if (inflow_ && simulated_time_ >= next_inflow_time_) {
+        // a new seed each time so consecutive batches don't stack on the same jitter
+        population_->queue(inflow_->seed(inflow_seed_++));
+        next_inflow_time_ = simulated_time_ + inflow_interval_;
+    }
+
+    if (population_->maxLive() > num_particles_) {
+        growCapacity(population_->maxLive());
+    }
+
+    population_->bind();
+    if (population_->numQueued() > 0) {
+        population_->inject(particle_buffer1_);
+        if (neighbor_list_) {
+            neighbor_list_->invalidate();
+        }
+    }
+}
+
+/**
+ * Reallocate the particle buffers and everything sized by them for a larger capacity, at least
+ * doubling it so steady inflow grows them only a logarithmic number of times. The particles are
+ * copied on the GPU, the live count stays where it is.
+ */
+void Fluid::growCapacity(int min_capacity) {
+    const int old_capacity = num_particles_;
+    num_particles_ = std::max(2 * old_capacity, min_capacity);
+    util::log("growing particle capacity from %d to %d", old_capacity, num_particles_);
+    flushBarriers();
+    if (recorder_->isRecording()) {
+        util::log("the frame format changes with the capacity, stopping the recording");
+        recorder_->stop();
+    }
+
+    const GLuint old_buffers[3] = {particle_buffer1_, particle_buffer2_, particle_buffer3_};
+    const GLuint old_vaos[3] = {vao1_, vao2_, vao3_};
+    particle_buffer1_ = createParticleBuffer(vao1_, nullptr, 0);
+    particle_buffer2_ = createParticleBuffer(vao2_, nullptr, 0);
+    util::copyParticles(old_buffers[0], old_capacity, particle_buffer1_, num_particles_,
+                        old_capacity, particle_layout_);
+    if (pipelined_) {
+        // the snapshot keeps the draw arguments it was taken with, so its particles come along
+        particle_buffer3_ = createParticleBuffer(vao3_, nullptr, 0);
+        util::copyParticles(old_buffers[2], old_capacity, particle_buffer3_, num_particles_,
+                            old_capacity, particle_layout_);
+        if (snapshot_fence_) {
+            glDeleteSync(snapshot_fence_);
+            snapshot_fence_ = nullptr;
+        }
+    }
+    util::memoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+    glDeleteBuffers(pipelined_ ? 3 : 2, old_buffers);
+    glDeleteVertexArrays(pipelined_ ? 3 : 2, old_vaos);
+
+    glDeleteBuffers(1, &debug_buffer_);
+    glDeleteBuffers(1, &pair_force_buffer_);
+    glDeleteBuffers(1, &solver_particle_buffer_);
+    debug_buffer_ = pair_force_buffer_ = solver_particle_buffer_ = 0;
+    prepareScratchBuffers();
+
+    num_work_groups_ = int(ceil(float(num_particles_) / float(WORK_GROUP_SIZE)));
+    num_bins_ = grid::numCells(grid_res_, cell_indexing_, num_particles_);
+    population_->setCapacity(num_particles_);
+    prepareSolvers();
+    compileShaders();
+    recorder_->setParticleFormat(num_particles_, particle_layout_);
+    capacity_growths_++;
+}
+
+/**
+ * Queue the emitter's particles for the next step, the count is fixed without the dynamic mode
+ */
+void Fluid::inject(EmitterRef e) {
+    if (!population_) {
+        util::log("injecting particles needs dynamic particles");
+        return;
+    }
+    population_->queue(e);
+}
+
+/**
+ * Update simulation logic - run one step of the selected solver
+ */
+void Fluid::update(double time) {
+    profiler_->nextFrame();
+    util::resetCommandCounts();
+    updateGravity();
+    flushBarriers();
+    if (population_) {
+        stepPopulation();
+    }
+    // after the population step, growing the capacity changes the particle count
+    updateSimParams();
+    sort_->setFused(fused_sort_);
+    if ((cell_tiling_ || compare_cell_tiling_) && !density_tiled_prog_) {
+        util::log("compiling fluid tiled shaders");
+        compileTiledShaders();
+    }
+    const int64_t adaptive_steps = adaptive_steps_;
+
+    if (validate_cpu_solver_ && (sdf_boundary_ || pressure_solver_ == PCISPH_PRESSURE)) {
+        // the CPU solver models neither, the check would compare two different fluids
+        util::log("cpu solver check skipped, the CPU solver has no %s",
+                  sdf_boundary_ ? "SDF boundary" : "PCISPH pressure");
+        validate_cpu_solver_ = false;
+    }
+
+    if (population_) {
+        // the CPU solver and the comparisons step every particle of the capacity
+        if (neighbor_list_) {
+            runNeighborListSolver(float(time));
+        } else {
+            runGpuSolver(float(time));
+        }
+        live_particles_ = population_->numLive();
+    } else if (compare_cell_tiling_) {
+        compareCellTiling(float(time));
+        compare_cell_tiling_ = false;
+        cpu_particles_valid_ = false;
+    } else if (validate_cpu_solver_) {
+        validateCpuSolver(float(time));
+        validate_cpu_solver_ = false;
+        cpu_particles_valid_ = false;
+    } else if (use_cpu_solver_) {
+        runCpuSolver(float(time));
+        if (neighbor_list_) {
+            neighbor_list_->invalidate();
+        }
+    } else if (neighbor_list_) {
+        runNeighborListSolver(float(time));
+        cpu_particles_valid_ = false;
+    } else {
+        runGpuSolver(float(time));
+        cpu_particles_valid_ = false;
+    }
+    if (adaptive_steps_ == adaptive_steps) {
+        // every pass of the step took the dt uniform
+        fixed_time_ += time * time_scale_;
+    }
+    // adaptive steps after the newest copy read back are estimated with its dt
+    simulated_time_ = fixed_time_ + adaptive_time_ +
+                      double(adaptive_steps_ - adaptive_read_steps_) * adaptive_dt_;
+    const CommandCounts counts = util::commandCounts();
+    step_dispatches_ = counts.dispatches;
+    step_barriers_ = counts.barriers;
+
+    if (recorder_->isRecording()) {
+        // the copy reads the stepped particles, so the deferred update barrier has to land first
+        flushBarriers();
+        recorder_->capture(particle_buffer1_, simulated_time_);
+    } else {
+        recorder_->update();
+    }
+    checkpoint_->update();
+}
+
 /**
  * Draw gravity vector
  */
@@ -387,22 +1806,59 @@ void Fluid::drawLight() {
  * render particles
  */
 void Fluid::renderParticles() {
+    ScopedTimer timer(profiler_, "Render");
     const float pointRadius = particle_radius_ * point_scale_;
     gl::pointSize(pointRadius * 2.0f);
 
+    // the pipelined mode draws the snapshot of the previous frame
+    const GLuint particle_buffer = pipelined_ ? particle_buffer3_ : particle_buffer1_;
     gl::ScopedGlslProg render(render_particles_prog_);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, particle_buffer1_);
-    glBindVertexArray(vao1_);
+    if (particle_layout_ == SOA_LAYOUT) {
+        util::bindParticleStream(0, particle_buffer, POSITION_STREAM, num_particles_);
+        util::bindParticleStream(1, particle_buffer, VELOCITY_STREAM, num_particles_);
+        util::bindParticleStream(2, particle_buffer, DENSITY_STREAM, num_particles_);
+        util::bindParticleStream(3, particle_buffer, PRESSURE_STREAM, num_particles_);
+    } else {
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, particle_buffer);
+    }
+    glBindVertexArray(pipelined_ ? vao3_ : vao1_);
 
+    updateSimParams();
     render_particles_prog_->uniform("renderMode", render_mode_);
-    render_particles_prog_->uniform("size", size_);
-    render_particles_prog_->uniform("binSize", bin_size_);
-    render_particles_prog_->uniform("gridRes", grid_res_);
     render_particles_prog_->uniform("lightPos", light_position_);
     render_particles_prog_->uniform("cameraPos", getRelativeCameraPosition());
 
     gl::context()->setDefaultShaderVars();
-    gl::drawArrays(GL_POINTS, 0, num_particles_);
+    if (population_) {
+        population_->draw(pipelined_);
+    } else {
+        gl::drawArrays(GL_POINTS, 0, num_particles_);
+    }
+}
+
+/**
+ * Copy the latest state into the render snapshot after the draw that reads the old one. The
+ * next frame draws it while its own steps run, so the draw never waits on the simulation. If
+ * the GPU hasn't finished the previous copy yet the CPU waits for it, which keeps it at most a
+ * frame ahead.
+ */
+void Fluid::takeSnapshot() {
+    if (snapshot_fence_) {
+        if (glClientWaitSync(snapshot_fence_, 0, 0) == GL_TIMEOUT_EXPIRED) {
+            pipeline_waits_++;
+            glClientWaitSync(snapshot_fence_, GL_SYNC_FLUSH_COMMANDS_BIT, SNAPSHOT_TIMEOUT_NS);
+        }
+        glDeleteSync(snapshot_fence_);
+    }
+
+    ScopedTimer timer(profiler_, "Snapshot");
+    flushBarriers();
+    glCopyNamedBufferSubData(particle_buffer1_, particle_buffer3_, 0, 0,
+                             layout::particleBufferSize(num_particles_, particle_layout_));
+    if (population_) {
+        population_->takeSnapshot();
+    }
+    snapshot_fence_ = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
 }
 
 /**
@@ -422,6 +1878,9 @@ void Fluid::draw() {
     } else {
         renderParticles();
     }
+    if (pipelined_) {
+        takeSnapshot();
+    }
 
     container_->draw();
     // drawGravity();
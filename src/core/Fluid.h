@@ -14,8 +14,20 @@
 #include "cinder/gl/gl.h"
 #include "cinder/params/Params.h"
 
+#include "./Activity.h"
 #include "./BaseObject.h"
+#include "./Checkpoint.h"
 #include "./Container.h"
+#include "./CpuSolver.h"
+#include "./DistanceField.h"
+#include "./Emitter.h"
+#include "./NeighborList.h"
+#include "./Population.h"
+#include "./Profiler.h"
+#include "./Recorder.h"
+#include "./Scenario.h"
+#include "./ShaderCache.h"
+#include "./SimParams.h"
 #include "./Sort.h"
 #include "./util.h"
 
@@ -26,6 +38,17 @@ namespace core {
 
 typedef std::shared_ptr<class Fluid> FluidRef;
 
+/**
+ * How the pressure of each step is found
+ */
+enum PressureSolver {
+    // weakly compressible equation of state evaluated by the density pass
+    STATE_EQUATION_PRESSURE = 0,
+    // predictive-corrective iterations until the density error is within a tolerance
+    PCISPH_PRESSURE = 1,
+    NUM_PRESSURE_SOLVERS,
+};
+
 /**
  * Fluid Simulator class
  */
@@ -37,6 +60,8 @@ public:
     int numParticles() { return num_particles_; }
     FluidRef numParticles(int n);
     FluidRef gridRes(int r);
+    FluidRef cellIndexing(int i);
+    FluidRef particleLayout(int l);
     FluidRef size(float s);
     FluidRef particleRadius(float r);
     FluidRef viscosityCoefficient(float c);
@@ -46,11 +71,66 @@ public:
     FluidRef position(vec3 p);
     FluidRef gravityStrength(float g);
     FluidRef renderMode(int m);
+    FluidRef cpuSolver(bool enabled);
+    FluidRef solverTolerance(float t);
+    FluidRef neighborLists(bool enabled);
+    FluidRef neighborSkin(float s);
+    FluidRef symmetricPairs(bool enabled);
+    FluidRef cellTiling(bool enabled);
+    FluidRef scenario(int s);
+    FluidRef seed(unsigned s);
+    FluidRef adaptiveTimestep(bool enabled);
+    FluidRef cflNumber(float c);
+    FluidRef maxTimestep(float dt);
+    FluidRef timeScale(float s);
+    FluidRef pressureSolver(int s);
+    FluidRef pressureTolerance(float t);
+    FluidRef maxPressureIterations(int n);
+    FluidRef sdfBoundary(bool enabled);
+    FluidRef sdfResolution(int r);
+    // closed triangle mesh in simulation space carved out of the domain, implies sdfBoundary
+    FluidRef obstacle(const std::vector<vec3>& positions, const std::vector<uint32_t>& indices);
+    FluidRef sleeping(bool enabled);
+    FluidRef sleepSpeed(float s);
+    // draw a snapshot of the previous frame's state while the next steps run
+    FluidRef pipelined(bool enabled);
+    // restart from a saved checkpoint, its particles and parameters replace the scenario's
+    FluidRef checkpoint(const std::string& path);
+    // fill a shape instead of the scenario, the particle count becomes the emitters' total
+    FluidRef emitter(EmitterRef e);
+    // let the particle count change while running, the initial count becomes the capacity
+    FluidRef dynamicParticles(bool enabled);
+    // particles entering the box are removed, implies dynamicParticles
+    FluidRef sink(vec3 min, vec3 max);
+    // emit the emitter's particles every interval of simulated seconds, implies dynamicParticles
+    FluidRef inflow(EmitterRef e, float interval);
+    // fold the grid resolution and kernel constants into the shader variants as literals
+    FluidRef specializeShaders(bool enabled);
+    // count with work group histograms and reorder from the ranks the count pass wrote
+    FluidRef fusedSort(bool enabled);
 
     void setCameraPosition(vec3 p) { camera_position_ = p; }
     void setLightPosition(vec3 p) { light_position_ = p; }
     void setMouseRay(Ray r) { mouse_ray_ = r; }
 
+    ProfilerRef getProfiler() { return profiler_; }
+    RecorderRef getRecorder() { return recorder_; }
+    // created by setup
+    params::InterfaceGlRef getParams() { return params_; }
+    // iterations the pressure solver took in a recent step, read back without stalling
+    int getPressureIterations() { return pressure_iterations_; }
+    // awake particles in a recent step, all of them unless sleeping is enabled
+    int getAwakeParticles() { return activity_ ? activity_->numAwake() : num_particles_; }
+    // compute dispatches and memory barriers the last step issued
+    int getStepDispatches() { return step_dispatches_; }
+    int getStepBarriers() { return step_barriers_; }
+    size_t memoryUsage();
+    // add the emitter's particles with the next step, the buffers grow when they run out
+    void inject(EmitterRef e);
+    PopulationRef getPopulation() { return population_; }
+    // written in the background once the GPU copy is done
+    bool saveCheckpoint(const std::string& path);
+
     FluidRef setup();
     void update(double time) override;
     void draw() override;
@@ -61,10 +141,20 @@ public:
 protected:
     void createParams();
     void generateInitialParticles();
+    bool loadCheckpoint();
+    void emitParticles(GLuint particle_buffer);
     void prepareParticleBuffers();
     void prepareBuffers();
+    void prepareScratchBuffers();
+    void prepareSolvers();
+    GLuint createParticleBuffer(GLuint& vao, const void* data, GLbitfield flags);
+    void growCapacity(int min_capacity);
+    void stepPopulation();
 
     void compileShaders();
+    void compileTiledShaders();
+    void prepareBoundary();
+    void bindBoundary(const gl::GlslProgRef& prog);
 
     vec3 translateWorldSpacePosition(vec3 p);
     vec3 rotateWorldSpacePosition(vec3 p);
@@ -73,11 +163,32 @@ protected:
     vec3 getRelativeLightPosition();
     Ray getRelativeMouseRay();
     void updateGravity();
+    void updateSimParams();
 
-    void runProg() { util::runProg(num_work_groups_); }
+    void runProg();
+    void runParticleProg(const gl::GlslProgRef& prog);
+    void runActivityProg(GLuint particle_buffer);
+    void flushBarriers();
+    void takeSnapshot();
     void runDensityProg(GLuint particle_buffer);
+    void runPairProg(GLuint particle_buffer);
     void runUpdateProg(GLuint in_particle_buffer, GLuint out_prticle_buffer, float time_step);
     void runAdvectProg(GLuint particle_buffer, float time_step);
+    void runTimestepProg();
+    void trackTimestep();
+    void readTimestep();
+    void runPressureSolver(GLuint particle_buffer, float time_step);
+    void runPressureProg(const gl::GlslProgRef& prog, GLuint particle_buffer, int iteration,
+                         float time_step);
+    void readPressureStats();
+    float pressureDelta();
+    void resetTimestep(float dt);
+    void runGpuSolver(float time_step);
+    void runNeighborListSolver(float time_step);
+    void runCpuSolver(float time_step);
+    bool validateCpuSolver(float time_step);
+    void compareCellTiling(float time_step);
+    SolverParams getSolverParams(float time_step);
     void drawGravity();
     void drawLight();
     void renderParticles();
@@ -86,9 +197,29 @@ protected:
 
     int num_particles_;
     int grid_res_;
+    int cell_indexing_;
+    int particle_layout_;
     int num_bins_;
     int num_work_groups_;
     int render_mode_;
+    int neighbor_list_rebuilds_;
+    int neighbor_list_steps_;
+    int scenario_;
+    int pressure_solver_;
+    int min_pressure_iterations_;
+    int max_pressure_iterations_;
+    int pressure_iterations_;
+    int pressure_stats_slot_;
+    int timestep_slot_;
+    int sdf_resolution_;
+    int awake_particles_;
+    int pipeline_waits_;
+    int live_particles_;
+    int capacity_growths_;
+    int sim_params_uploads_;
+    int step_dispatches_;
+    int step_barriers_;
+    unsigned seed_;
 
     float size_;
     float bin_size_;
@@ -105,10 +236,51 @@ protected:
     float spiky_kernel_const_;
     float poly6_kernel_const_;
     float viscosity_kernel_const_;
+    float solver_tolerance_;
+    float neighbor_skin_;
+    float cpu_utilization_;
+    float cfl_number_;
+    float force_number_;
+    float min_timestep_;
+    float max_timestep_;
+    float pressure_tolerance_;
+    float pressure_delta_;
+    float pressure_error_;
+    float sleep_speed_;
+    float inflow_interval_;
+
+    // simulated seconds stepped since setup, stamped on recorded frames. The adaptive dt stays
+    // on the GPU, which sums it there, so adaptive steps are only known once read back.
+    double simulated_time_;
+    // time of the steps taken with the dt uniform
+    double fixed_time_;
+    // adaptive time, next dt and adaptive step count of the newest copy read back
+    double adaptive_time_;
+    float adaptive_dt_;
+    int64_t adaptive_read_steps_;
+    int64_t adaptive_steps_;
+    double next_inflow_time_;
 
     bool odd_frame_;
     bool first_frame_;
     bool rotate_gravity_;
+    bool validate_scan_;
+    bool use_cpu_solver_;
+    bool cpu_particles_valid_;
+    bool validate_cpu_solver_;
+    bool use_neighbor_lists_;
+    bool symmetric_pairs_;
+    bool cell_tiling_;
+    bool compare_cell_tiling_;
+    bool adaptive_timestep_;
+    bool sdf_boundary_;
+    bool use_sleeping_;
+    // set while the density and update passes run over the awake list
+    bool awake_only_;
+    bool pipelined_;
+    bool dynamic_particles_;
+    bool specialize_shaders_;
+    bool fused_sort_;
 
     quat rotation_;
 
@@ -120,22 +292,72 @@ protected:
     Ray mouse_ray_;
 
     ContainerRef container_;
+    // mapped during setup when restarting, and saving in the background
+    CheckpointRef checkpoint_;
+    std::string checkpoint_path_;
 
     std::vector<Particle> initial_particles_;
+    std::vector<EmitterRef> emitters_;
+    // runs the emitters during setup
+    TaskSchedulerRef emitter_scheduler_;
+    EmitterRef inflow_;
+    unsigned inflow_seed_;
+    std::vector<vec3> sink_min_;
+    std::vector<vec3> sink_max_;
     std::vector<Plane> boundaries_;
     std::vector<ivec4> grid_particles_;
+    std::vector<vec3> obstacle_positions_;
+    std::vector<uint32_t> obstacle_indices_;
 
     gl::GlslProgRef density_prog_;
     gl::GlslProgRef update_prog_;
+    gl::GlslProgRef density_tiled_prog_;
+    gl::GlslProgRef update_tiled_prog_;
+    // compiled once cell tiling is first switched on
+    std::vector<std::string> tiled_defines_;
+    gl::GlslProgRef pair_prog_;
     gl::GlslProgRef render_particles_prog_;
     gl::GlslProgRef advect_prog_;
+    gl::GlslProgRef timestep_prog_;
+    gl::GlslProgRef pcisph_predict_prog_;
+    gl::GlslProgRef pcisph_correct_prog_;
+    gl::GlslProgRef pcisph_pressure_prog_;
 
     SortRef sort_;
+    NeighborListRef neighbor_list_;
+    ActivityRef activity_;
+    // live count and the sinks and injections that change it, only in the dynamic mode
+    PopulationRef population_;
+    ProfilerRef profiler_;
+    // streams the stepped particles to disk while recording
+    RecorderRef recorder_;
+    CpuSolverRef cpu_solver_;
+    std::vector<Particle> cpu_particles_;
 
     GLuint particle_buffer1_;
     GLuint particle_buffer2_;
     GLuint vao1_, vao2_;
+    // render snapshot of the pipelined mode, fenced so the CPU stays at most a frame ahead
+    GLuint particle_buffer3_, vao3_;
+    GLsync snapshot_fence_;
+    // barriers owed by the last update pass, issued right before the next reader
+    GLbitfield pending_barriers_;
     GLuint debug_buffer_;
+    GLuint pair_force_buffer_;
+    GLuint timestep_buffer_;
+    GLuint solver_particle_buffer_;
+    GLuint solver_state_buffer_;
+    // copies of the solver state, read back once their fence has passed
+    GLuint pressure_stats_buffer_;
+    std::vector<GLsync> pressure_stats_fences_;
+    // copies of the timestep buffer and the adaptive step count of each
+    GLuint timestep_readback_buffer_;
+    std::vector<GLsync> timestep_fences_;
+    std::vector<int64_t> timestep_slot_steps_;
+    // the parameters last written to sim_params_buffer_
+    SimParams sim_params_;
+    GLuint sim_params_buffer_;
+    GLuint boundary_texture_;
 
     params::InterfaceGlRef params_;
 };
@@ -0,0 +1,351 @@
+#include "./NeighborList.h"
+
+#include <cstring>
+
+using namespace core;
+
+namespace {
+
+// steps of copies in flight, the copy of the step before last is waited on if it hasn't landed
+const int READBACK_RING = 3;
+// displacement bits and list total
+const GLsizeiptr READBACK_SIZE = 2 * sizeof(uint32_t);
+// longest wait for an older copy, a stalled GPU just keeps the lists another step
+const GLuint64 READBACK_TIMEOUT_NS = 100000000;
+
+} // namespace
+
+NeighborList::NeighborList()
+    : num_items_(0), grid_res_(1), cell_indexing_(grid::ROW_MAJOR_INDEXING),
+      particle_layout_(AOS_LAYOUT), initial_neighbors_(32), capacity_(0), num_rebuilds_(0),
+      num_steps_(0), num_neighbors_(0), max_displacement2_(0), bin_size_(1), kernel_radius_(1),
+      skin_(0), valid_(false), dynamic_particles_(false), specialize_(false),
+      neighbor_count_buffer_(0), neighbor_offset_buffer_(0), neighbor_index_buffer_(0),
+      reference_position_buffer_(0), displacement_buffer_(0), total_buffer_(0),
+      readback_buffer_(0), readback_slot_(0) {}
+
+NeighborList::~NeighborList() {
+    for (GLsync fence : readback_fences_) {
+        if (fence) {
+            glDeleteSync(fence);
+        }
+    }
+    glDeleteBuffers(1, &readback_buffer_);
+    glDeleteBuffers(1, &neighbor_count_buffer_);
+    glDeleteBuffers(1, &neighbor_offset_buffer_);
+    glDeleteBuffers(1, &neighbor_index_buffer_);
+    glDeleteBuffers(1, &reference_position_buffer_);
+    glDeleteBuffers(1, &displacement_buffer_);
+    glDeleteBuffers(1, &total_buffer_);
+}
+
+NeighborListRef NeighborList::numItems(int n) {
+    num_items_ = n;
+    return thisRef();
+}
+
+NeighborListRef NeighborList::gridRes(int r) {
+    grid_res_ = r;
+    return thisRef();
+}
+
+NeighborListRef NeighborList::binSize(float s) {
+    bin_size_ = s;
+    return thisRef();
+}
+
+NeighborListRef NeighborList::kernelRadius(float r) {
+    kernel_radius_ = r;
+    return thisRef();
+}
+
+NeighborListRef NeighborList::skin(float s) {
+    skin_ = s;
+    return thisRef();
+}
+
+NeighborListRef NeighborList::cellIndexing(int i) {
+    cell_indexing_ = i;
+    return thisRef();
+}
+
+NeighborListRef NeighborList::particleLayout(int l) {
+    particle_layout_ = l;
+    return thisRef();
+}
+
+NeighborListRef NeighborList::dynamicParticles(bool enabled) {
+    dynamic_particles_ = enabled;
+    return thisRef();
+}
+
+NeighborListRef NeighborList::specialize(bool enabled) {
+    specialize_ = enabled;
+    return thisRef();
+}
+
+NeighborListRef NeighborList::initialNeighbors(int n) {
+    initial_neighbors_ = n;
+    return thisRef();
+}
+
+/**
+ * Prepares shared memory buffers
+ */
+void NeighborList::prepareBuffers() {
+    util::log("preparing neighbor list buffers");
+
+    // the lists are gathered from the 27 surrounding bins so they can't reach further
+    const float max_skin = bin_size_ - kernel_radius_;
+    if (skin_ > max_skin) {
+        util::log("\tclamping skin %f to %f", skin_, max_skin);
+        skin_ = max_skin;
+    }
+
+    // one extra count so the scanned offsets end with the total
+    std::vector<uint32_t> zeros(num_items_ + 1, 0);
+    glCreateBuffers(1, &neighbor_count_buffer_);
+    glNamedBufferStorage(neighbor_count_buffer_, zeros.size() * sizeof(uint32_t), zeros.data(),
+                         0);
+    glCreateBuffers(1, &neighbor_offset_buffer_);
+    glNamedBufferStorage(neighbor_offset_buffer_, zeros.size() * sizeof(uint32_t), zeros.data(),
+                         0);
+
+    glCreateBuffers(1, &reference_position_buffer_);
+    glNamedBufferStorage(reference_position_buffer_, num_items_ * sizeof(vec4), nullptr, 0);
+
+    glCreateBuffers(1, &displacement_buffer_);
+    glNamedBufferStorage(displacement_buffer_, sizeof(uint32_t), zeros.data(), 0);
+
+    glCreateBuffers(1, &total_buffer_);
+    glNamedBufferStorage(total_buffer_, sizeof(uint32_t), zeros.data(), 0);
+
+    glCreateBuffers(1, &readback_buffer_);
+    glNamedBufferStorage(readback_buffer_, READBACK_RING * READBACK_SIZE, zeros.data(), 0);
+    readback_fences_.assign(READBACK_RING, nullptr);
+    readback_builds_.assign(READBACK_RING, -1);
+    readback_slot_ = 0;
+
+    num_neighbors_ = num_items_ * initial_neighbors_;
+    growIndexBuffer(num_neighbors_);
+
+    scan_ = Scan::create()->numItems(num_items_ + 1);
+    scan_->prepareBuffers();
+
+    valid_ = false;
+}
+
+/**
+ * Compiles and prepares shader programs
+ */
+void NeighborList::compileShaders() {
+    util::log("compiling neighbor list shaders");
+    const int num_bins = grid::numCells(grid_res_, cell_indexing_, num_items_);
+    std::vector<std::string> defines = {grid::indexingDefine(cell_indexing_, num_bins),
+                                        layout::layoutDefine(particle_layout_)};
+    if (dynamic_particles_) {
+        defines.push_back("DYNAMIC_PARTICLES");
+    }
+    if (specialize_) {
+        defines.push_back(util::constantDefine("GRID_RES", grid_res_));
+    }
+
+    util::log("\tcompiling neighbor count shader");
+    count_prog_ = util::compileComputeShader("fluid/neighbors.comp", defines);
+
+    util::log("\tcompiling neighbor fill shader");
+    defines.push_back("FILL_NEIGHBORS");
+    fill_prog_ = util::compileComputeShader("fluid/neighbors.comp", defines);
+
+    scan_->compileShaders();
+}
+
+/**
+ * Reallocate the index buffer if the lists no longer fit
+ */
+void NeighborList::growIndexBuffer(int num_neighbors) {
+    if (num_neighbors <= capacity_) {
+        return;
+    }
+
+    capacity_ = std::max(num_neighbors + num_neighbors / 2, 1);
+    util::log("\tgrowing neighbor index buffer to %d", capacity_);
+
+    glDeleteBuffers(1, &neighbor_index_buffer_);
+    glCreateBuffers(1, &neighbor_index_buffer_);
+    glNamedBufferStorage(neighbor_index_buffer_, capacity_ * sizeof(uint32_t), nullptr, 0);
+}
+
+/**
+ * Bind the particle positions, the whole buffer for the AOS layout
+ */
+void NeighborList::bindPositions(GLuint binding, GLuint particle_buffer) {
+    if (particle_layout_ == SOA_LAYOUT) {
+        util::bindParticleStream(binding, particle_buffer, POSITION_STREAM, num_items_);
+    } else {
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, particle_buffer);
+    }
+}
+
+/**
+ * Run neighbor count compute shader
+ */
+void NeighborList::runCountProg(GLuint particle_buffer, GLuint count_buffer,
+                                GLuint offset_buffer) {
+    gl::ScopedGlslProg prog(count_prog_);
+    bindPositions(0, particle_buffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, count_buffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, offset_buffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, neighbor_count_buffer_);
+
+    count_prog_->uniform("binSize", bin_size_);
+    count_prog_->uniform("gridRes", grid_res_);
+    count_prog_->uniform("numParticles", num_items_);
+    count_prog_->uniform("searchRadius", kernel_radius_ + skin_);
+
+    runProg();
+    util::memoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+/**
+ * Run neighbor fill compute shader
+ */
+void NeighborList::runFillProg(GLuint particle_buffer, GLuint count_buffer,
+                               GLuint offset_buffer) {
+    gl::ScopedGlslProg prog(fill_prog_);
+    bindPositions(0, particle_buffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, count_buffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, offset_buffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, neighbor_offset_buffer_);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, neighbor_index_buffer_);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, reference_position_buffer_);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, displacement_buffer_);
+
+    fill_prog_->uniform("binSize", bin_size_);
+    fill_prog_->uniform("gridRes", grid_res_);
+    fill_prog_->uniform("numParticles", num_items_);
+    fill_prog_->uniform("searchRadius", kernel_radius_ + skin_);
+    fill_prog_->uniform("neighborCapacity", uint32_t(capacity_));
+
+    runProg();
+    util::memoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+/**
+ * Check whether any particle moved more than half the skin since the last build, from the
+ * displacement of the last step if its copy landed and of the step before otherwise. A step late
+ * is still inside the skin unless a particle crosses half of it in a single step.
+ */
+bool NeighborList::expired() {
+    num_steps_++;
+    if (!valid_) {
+        return true;
+    }
+
+    readBack();
+    const float half_skin = skin_ * 0.5f;
+    return max_displacement2_ > half_skin * half_skin;
+}
+
+/**
+ * Read the copies whose fence has passed, oldest first. The copy of the step before last is
+ * waited on, it bounds the lag to a step and has almost always landed already.
+ */
+void NeighborList::readBack() {
+    for (int i = 0; i < READBACK_RING; i++) {
+        const int slot = (readback_slot_ + i) % READBACK_RING;
+        GLsync& fence = readback_fences_[slot];
+        if (!fence) {
+            continue;
+        }
+        const GLuint64 timeout = i == READBACK_RING - 1 ? 0 : READBACK_TIMEOUT_NS;
+        if (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, timeout) == GL_TIMEOUT_EXPIRED) {
+            break;
+        }
+
+        uint32_t values[2] = {0, 0};
+        glGetNamedBufferSubData(readback_buffer_, slot * READBACK_SIZE, READBACK_SIZE, values);
+        glDeleteSync(fence);
+        fence = nullptr;
+        num_neighbors_ = std::max(num_neighbors_, int(values[1]));
+        if (readback_builds_[slot] == num_rebuilds_) {
+            std::memcpy(&max_displacement2_, &values[0], sizeof(float));
+        }
+    }
+}
+
+/**
+ * main logic - build the lists from the sorted particles and their grid. The index buffer is
+ * sized from the largest total read back so far. Lists that don't fit are cut off by the fill
+ * pass, which then marks the lists expired, and the total read back a step later grows the
+ * buffer before the next build.
+ */
+void NeighborList::build(GLuint particle_buffer, GLuint count_buffer, GLuint offset_buffer) {
+    runCountProg(particle_buffer, count_buffer, offset_buffer);
+    scan_->run(neighbor_count_buffer_, neighbor_offset_buffer_);
+    growIndexBuffer(num_neighbors_);
+
+    // keep the total, the fill pass clamps the last offset when the lists overflow
+    util::memoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+    glCopyNamedBufferSubData(neighbor_offset_buffer_, total_buffer_,
+                             num_items_ * sizeof(uint32_t), 0, sizeof(uint32_t));
+
+    const std::uint32_t clear_value = 0;
+    glClearNamedBufferData(displacement_buffer_, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT,
+                           &clear_value);
+    util::memoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+
+    runFillProg(particle_buffer, count_buffer, offset_buffer);
+
+    num_rebuilds_++;
+    max_displacement2_ = 0;
+    valid_ = true;
+}
+
+/**
+ * Copy the displacement and the list total for a later readback
+ */
+void NeighborList::track() {
+    const int slot = readback_slot_;
+    if (readback_fences_[slot]) {
+        glDeleteSync(readback_fences_[slot]);
+    }
+
+    util::memoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+    glCopyNamedBufferSubData(displacement_buffer_, readback_buffer_, 0, slot * READBACK_SIZE,
+                             sizeof(uint32_t));
+    glCopyNamedBufferSubData(total_buffer_, readback_buffer_, 0,
+                             slot * READBACK_SIZE + sizeof(uint32_t), sizeof(uint32_t));
+    readback_fences_[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    readback_builds_[slot] = num_rebuilds_;
+    readback_slot_ = (slot + 1) % READBACK_RING;
+}
+
+/**
+ * Bind the lists for the density and update passes
+ */
+void NeighborList::bindLists() {
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 11, neighbor_offset_buffer_);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 12, neighbor_index_buffer_);
+}
+
+/**
+ * Bind the displacement tracking buffers for the update pass
+ */
+void NeighborList::bindDisplacement() {
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 13, reference_position_buffer_);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 14, displacement_buffer_);
+}
+
+/**
+ * Bytes held by the lists, including the unused tail of the grown index buffer
+ */
+size_t NeighborList::memoryUsage() {
+    size_t bytes = util::bufferSize(neighbor_count_buffer_) +
+                   util::bufferSize(neighbor_offset_buffer_) +
+                   util::bufferSize(neighbor_index_buffer_) +
+                   util::bufferSize(reference_position_buffer_) +
+                   util::bufferSize(displacement_buffer_) +
+                   util::bufferSize(total_buffer_) + util::bufferSize(readback_buffer_);
+    return scan_ ? bytes + scan_->memoryUsage() : bytes;
+}
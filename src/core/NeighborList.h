@@ -0,0 +1,103 @@
+#pragma once
+
+#include <Windows.h>
+#include <memory>
+#include <vector>
+
+#include "cinder/app/App.h"
+#include "cinder/gl/Shader.h"
+#include "cinder/gl/gl.h"
+
+#include "./Scan.h"
+#include "./grid.h"
+#include "./util.h"
+
+using namespace ci;
+using namespace ci::app;
+
+namespace core {
+
+typedef std::shared_ptr<class NeighborList> NeighborListRef;
+
+/**
+ * Verlet neighbor lists in compressed sparse row form, reused across steps
+ * until some particle has moved more than half the skin distance. The displacement and the list
+ * total are read back through a ring of fenced copies, so the rebuild decision lags a step
+ * behind the GPU instead of waiting for it.
+ */
+class NeighborList {
+public:
+    NeighborList();
+    ~NeighborList();
+
+    NeighborListRef numItems(int n);
+    NeighborListRef gridRes(int r);
+    NeighborListRef binSize(float s);
+    NeighborListRef kernelRadius(float r);
+    NeighborListRef skin(float s);
+    NeighborListRef cellIndexing(int i);
+    NeighborListRef particleLayout(int l);
+    // only the live particles at the front of the buffers get lists
+    NeighborListRef dynamicParticles(bool enabled);
+    // fold gridRes into the shader variants instead of passing it as a uniform
+    NeighborListRef specialize(bool enabled);
+    // neighbors per item the index buffer starts with, it grows once the lists overflow it
+    NeighborListRef initialNeighbors(int n);
+
+    void prepareBuffers();
+    void compileShaders();
+    bool expired();
+    void build(GLuint particle_buffer, GLuint count_buffer, GLuint offset_buffer);
+    // copy the displacement the update pass wrote for a later expired, once per step
+    void track();
+    void bindLists();
+    void bindDisplacement();
+    void invalidate() { valid_ = false; }
+
+    float getSkin() { return skin_; }
+    int numRebuilds() { return num_rebuilds_; }
+    int numSteps() { return num_steps_; }
+    int getCapacity() { return capacity_; }
+    size_t memoryUsage();
+
+    static NeighborListRef create() { return std::make_shared<NeighborList>(); }
+
+protected:
+    void bindPositions(GLuint binding, GLuint particle_buffer);
+    void growIndexBuffer(int num_neighbors);
+    void runCountProg(GLuint particle_buffer, GLuint count_buffer, GLuint offset_buffer);
+    void runFillProg(GLuint particle_buffer, GLuint count_buffer, GLuint offset_buffer);
+    void readBack();
+
+    void runProg() { util::runProg(int(ceil(float(num_items_) / float(WORK_GROUP_SIZE)))); }
+
+    NeighborListRef thisRef() { return std::make_shared<NeighborList>(*this); }
+
+    int num_items_, grid_res_, cell_indexing_, particle_layout_;
+    int initial_neighbors_, capacity_, num_rebuilds_, num_steps_;
+    // from the newest copy read back, the displacement only counts for the lists it was
+    // tracked for
+    int num_neighbors_;
+    float max_displacement2_;
+    float bin_size_, kernel_radius_, skin_;
+    bool valid_;
+    bool dynamic_particles_;
+    bool specialize_;
+
+    ScanRef scan_;
+
+    gl::GlslProgRef count_prog_, fill_prog_;
+
+    GLuint neighbor_count_buffer_, neighbor_offset_buffer_, neighbor_index_buffer_;
+    GLuint reference_position_buffer_, displacement_buffer_;
+    // the scanned list total before the fill pass clamps the last offset to the capacity
+    GLuint total_buffer_;
+
+    // displacement bits and list total of each step, with the build they belong to
+    GLuint readback_buffer_;
+    int readback_slot_;
+    std::vector<GLsync> readback_fences_;
+    std::vector<int> readback_builds_;
+};
+
+} // namespace core
@@ -0,0 +1,82 @@
+#include "./Particle.h"
+
+using namespace core;
+
+void ParticleStreams::resize(int n) {
+    positions.resize(n, glm::vec4(0));
+    velocities.resize(n, glm::vec4(0));
+    densities.resize(n, 0.0f);
+    pressures.resize(n, 0.0f);
+}
+
+Particle ParticleStreams::get(int i) const {
+    Particle p;
+    p.position = glm::vec3(positions[i].x, positions[i].y, positions[i].z);
+    p.velocity = glm::vec3(velocities[i].x, velocities[i].y, velocities[i].z);
+    p.density = densities[i];
+    p.pressure = pressures[i];
+    return p;
+}
+
+void ParticleStreams::set(int i, const Particle& p) {
+    positions[i] = glm::vec4(p.position, 0.0f);
+    velocities[i] = glm::vec4(p.velocity, 0.0f);
+    densities[i] = p.density;
+    pressures[i] = p.pressure;
+}
+
+ParticleStreams ParticleStreams::fromParticles(const std::vector<Particle>& particles) {
+    ParticleStreams streams;
+    streams.resize(int(particles.size()));
+    for (int i = 0; i < int(particles.size()); i++) {
+        streams.set(i, particles[i]);
+    }
+    return streams;
+}
+
+std::vector<Particle> ParticleStreams::toParticles() const {
+    std::vector<Particle> particles(size());
+    for (int i = 0; i < size(); i++) {
+        particles[i] = get(i);
+    }
+    return particles;
+}
+
+int layout::streamCapacity(int num_particles) {
+    const int alignment = 64;
+    return ((num_particles + alignment - 1) / alignment) * alignment;
+}
+
+size_t layout::streamStride(ParticleStream stream) {
+    switch (stream) {
+    case POSITION_STREAM:
+    case VELOCITY_STREAM:
+        return sizeof(glm::vec4);
+    default:
+        return sizeof(float);
+    }
+}
+
+size_t layout::streamOffset(ParticleStream stream, int num_particles) {
+    const size_t capacity = size_t(streamCapacity(num_particles));
+    size_t offset = 0;
+    for (int s = 0; s < int(stream); s++) {
+        offset += capacity * streamStride(ParticleStream(s));
+    }
+    return offset;
+}
+
+size_t layout::streamSize(ParticleStream stream, int num_particles) {
+    return size_t(num_particles) * streamStride(stream);
+}
+
+size_t layout::particleBufferSize(int num_particles, int particle_layout) {
+    if (particle_layout == SOA_LAYOUT) {
+        return streamOffset(NUM_PARTICLE_STREAMS, num_particles);
+    }
+    return size_t(num_particles) * sizeof(Particle);
+}
+
+const char* layout::layoutDefine(int particle_layout) {
+    return particle_layout == SOA_LAYOUT ? "SOA_LAYOUT" : "AOS_LAYOUT";
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+namespace core {
+
+/**
+ * Particle representation, mirrors the std430 Particle struct in the shaders
+ */
+struct Particle {
+    Particle() : position(0), density(0), velocity(0), pressure(0) {}
+    glm::vec3 position;
+    float density;
+    glm::vec3 velocity;
+    float pressure;
+};
+
+/**
+ * How particle state is stored in a particle buffer
+ */
+enum ParticleLayout {
+    // interleaved Particle structs
+    AOS_LAYOUT = 0,
+    // one stream per attribute, selected in the shaders with SOA_LAYOUT
+    SOA_LAYOUT = 1,
+};
+
+/**
+ * Attribute streams of the SOA layout, stored back to back in a single buffer
+ */
+enum ParticleStream {
+    POSITION_STREAM = 0,
+    VELOCITY_STREAM,
+    DENSITY_STREAM,
+    PRESSURE_STREAM,
+    NUM_PARTICLE_STREAMS,
+};
+
+/**
+ * CPU side structure of arrays particle state, vectors are padded to vec4 like on the GPU
+ */
+struct ParticleStreams {
+    std::vector<glm::vec4> positions;
+    std::vector<glm::vec4> velocities;
+    std::vector<float> densities;
+    std::vector<float> pressures;
+
+    int size() const { return int(positions.size()); }
+    void resize(int n);
+
+    Particle get(int i) const;
+    void set(int i, const Particle& p);
+
+    static ParticleStreams fromParticles(const std::vector<Particle>& particles);
+    std::vector<Particle> toParticles() const;
+};
+
+namespace layout {
+
+// particles per stream rounded up so every stream starts on a 256 byte boundary
+int streamCapacity(int num_particles);
+
+size_t streamStride(ParticleStream stream);
+
+size_t streamOffset(ParticleStream stream, int num_particles);
+
+size_t streamSize(ParticleStream stream, int num_particles);
+
+size_t particleBufferSize(int num_particles, int particle_layout);
+
+const char* layoutDefine(int particle_layout);
+
+} // namespace layout
+
+} // namespace core
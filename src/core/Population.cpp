@@ -0,0 +1,251 @@
+#include "./Population.h"
+
+#include <algorithm>
+
+using namespace core;
+
+namespace {
+
+// live count copies in flight before the oldest one is read back
+const int COUNT_RING = 4;
+// dispatch size, live count, draw arguments and the draw arguments of the snapshot
+const int POPULATION_SIZE = 12;
+const GLintptr LIVE_COUNT_OFFSET = 3 * sizeof(uint32_t);
+const GLintptr DRAW_OFFSET = 4 * sizeof(uint32_t);
+const GLintptr SNAPSHOT_DRAW_OFFSET = 8 * sizeof(uint32_t);
+const GLsizeiptr DRAW_SIZE = 4 * sizeof(uint32_t);
+
+} // namespace
+
+Population::Population()
+    : capacity_(0), particle_layout_(AOS_LAYOUT), num_live_(0), count_slot_(0),
+      num_queued_total_(0), live_queued_total_(0), injection_capacity_(0),
+      population_buffer_(0), injection_buffer_(0), count_buffer_(0) {}
+
+Population::~Population() {
+    for (GLsync fence : count_fences_) {
+        if (fence) {
+            glDeleteSync(fence);
+        }
+    }
+    glDeleteBuffers(1, &population_buffer_);
+    glDeleteBuffers(1, &injection_buffer_);
+    glDeleteBuffers(1, &count_buffer_);
+}
+
+PopulationRef Population::capacity(int n) {
+    capacity_ = n;
+    return thisRef();
+}
+
+PopulationRef Population::particleLayout(int l) {
+    particle_layout_ = l;
+    return thisRef();
+}
+
+PopulationRef Population::sink(vec3 min, vec3 max) {
+    if (int(sink_min_.size()) == MAX_SINKS) {
+        util::log("at most %d sinks, ignoring the sink", MAX_SINKS);
+        return thisRef();
+    }
+    sink_min_.push_back(glm::min(min, max));
+    sink_max_.push_back(glm::max(min, max));
+    return thisRef();
+}
+
+/**
+ * Prepares shared memory buffers, the first num_live particles are live
+ */
+void Population::prepareBuffers(int num_live) {
+    util::log("preparing population buffers");
+    const uint32_t live = uint32_t(std::min(num_live, capacity_));
+    const uint32_t groups = (live + WORK_GROUP_SIZE - 1) / WORK_GROUP_SIZE;
+    const uint32_t population[POPULATION_SIZE] = {groups, 1, 1, live, live, 1, 0, 0,
+                                                  live,   1, 0, 0};
+    glCreateBuffers(1, &population_buffer_);
+    glNamedBufferStorage(population_buffer_, sizeof(population), population, 0);
+
+    const std::vector<uint32_t> zeros(COUNT_RING, 0);
+    glCreateBuffers(1, &count_buffer_);
+    glNamedBufferStorage(count_buffer_, COUNT_RING * sizeof(uint32_t), zeros.data(), 0);
+    count_fences_.assign(COUNT_RING, nullptr);
+    count_queued_totals_.assign(COUNT_RING, 0);
+    num_live_ = int(live);
+}
+
+/**
+ * Compiles and prepares shader programs
+ */
+void Population::compileShaders() {
+    util::log("compiling population shaders");
+    std::vector<std::string> defines = {layout::layoutDefine(particle_layout_)};
+
+    util::log("\tcompiling population inject shader");
+    defines.push_back("POPULATION_INJECT");
+    inject_prog_ = util::compileComputeShader("fluid/population.comp", defines);
+
+    util::log("\tcompiling population resize shader");
+    defines.back() = "POPULATION_RESIZE";
+    resize_prog_ = util::compileComputeShader("fluid/population.comp", defines);
+
+    util::log("\tcompiling population count shader");
+    defines.back() = "POPULATION_COUNT";
+    count_prog_ = util::compileComputeShader("fluid/population.comp", defines);
+}
+
+/**
+ * The queue is kept between injections so steady inflow doesn't reallocate it
+ */
+void Population::queue(EmitterRef emitter) {
+    const int first = int(queued_.size());
+    const int n = emitter->count();
+    queued_.resize(first + n);
+    emitter->emit(queued_.data(), first, first + n, AOS_LAYOUT);
+    num_queued_total_ += n;
+}
+
+int Population::maxLive() {
+    return num_live_ + int(num_queued_total_ - live_queued_total_);
+}
+
+void Population::inject(GLuint particle_buffer) {
+    if (queued_.empty()) {
+        return;
+    }
+
+    const int n = int(queued_.size());
+    if (n > injection_capacity_) {
+        glDeleteBuffers(1, &injection_buffer_);
+        injection_capacity_ = std::max(n, injection_capacity_ * 2);
+        glCreateBuffers(1, &injection_buffer_);
+        glNamedBufferStorage(injection_buffer_, injection_capacity_ * sizeof(Particle), nullptr,
+                             GL_DYNAMIC_STORAGE_BIT);
+    }
+    glNamedBufferSubData(injection_buffer_, 0, n * sizeof(Particle), queued_.data());
+    util::memoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+
+    {
+        gl::ScopedGlslProg prog(inject_prog_);
+        if (particle_layout_ == SOA_LAYOUT) {
+            util::bindParticleStream(0, particle_buffer, POSITION_STREAM, capacity_);
+            util::bindParticleStream(3, particle_buffer, VELOCITY_STREAM, capacity_);
+            util::bindParticleStream(4, particle_buffer, DENSITY_STREAM, capacity_);
+            util::bindParticleStream(5, particle_buffer, PRESSURE_STREAM, capacity_);
+        } else {
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, particle_buffer);
+        }
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 20, population_buffer_);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 21, injection_buffer_);
+
+        inject_prog_->uniform("capacity", capacity_);
+        inject_prog_->uniform("numInjected", n);
+
+        util::runProg(int(ceil(float(n) / float(WORK_GROUP_SIZE))));
+        util::memoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    }
+
+    runResizeProg(n);
+    queued_.clear();
+}
+
+/**
+ * Move the live count past the injected particles once they are written
+ */
+void Population::runResizeProg(int num_injected) {
+    gl::ScopedGlslProg prog(resize_prog_);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 20, population_buffer_);
+
+    resize_prog_->uniform("capacity", capacity_);
+    resize_prog_->uniform("numInjected", num_injected);
+
+    util::runProg(1);
+    util::memoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+}
+
+void Population::count(GLuint count_buffer, GLuint offset_buffer, int num_bins) {
+    gl::ScopedGlslProg prog(count_prog_);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, count_buffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, offset_buffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 20, population_buffer_);
+
+    count_prog_->uniform("capacity", capacity_);
+    count_prog_->uniform("numBins", num_bins);
+
+    util::runProg(1);
+    util::memoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+
+    copyLiveCount();
+}
+
+/**
+ * Copy the live count for a later readback, a slot still pending after a full ring of steps
+ * is dropped
+ */
+void Population::copyLiveCount() {
+    readLiveCount();
+
+    const int slot = count_slot_;
+    if (count_fences_[slot]) {
+        glDeleteSync(count_fences_[slot]);
+    }
+    glCopyNamedBufferSubData(population_buffer_, count_buffer_, LIVE_COUNT_OFFSET,
+                             slot * sizeof(uint32_t), sizeof(uint32_t));
+    count_fences_[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    count_queued_totals_[slot] = num_queued_total_;
+    count_slot_ = (slot + 1) % COUNT_RING;
+}
+
+/**
+ * Read the live count copies whose fence has passed, oldest first, without waiting
+ */
+void Population::readLiveCount() {
+    for (int i = 0; i < COUNT_RING; i++) {
+        const int slot = (count_slot_ + i) % COUNT_RING;
+        GLsync& fence = count_fences_[slot];
+        if (!fence) {
+            continue;
+        }
+        if (glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED) {
+            break;
+        }
+
+        uint32_t count = 0;
+        glGetNamedBufferSubData(count_buffer_, slot * sizeof(uint32_t), sizeof(uint32_t), &count);
+        glDeleteSync(fence);
+        fence = nullptr;
+        num_live_ = int(count);
+        live_queued_total_ = count_queued_totals_[slot];
+    }
+}
+
+void Population::bind() {
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 20, population_buffer_);
+}
+
+void Population::bindSinks(const gl::GlslProgRef& prog) {
+    prog->uniform("numSinks", int(sink_min_.size()));
+    if (!sink_min_.empty()) {
+        prog->uniform("sinkMin", sink_min_.data(), int(sink_min_.size()));
+        prog->uniform("sinkMax", sink_max_.data(), int(sink_max_.size()));
+    }
+}
+
+void Population::dispatch() { util::runProgIndirect(population_buffer_); }
+
+void Population::draw(bool snapshot) {
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, population_buffer_);
+    glDrawArraysIndirect(GL_POINTS,
+                         reinterpret_cast<const void*>(snapshot ? SNAPSHOT_DRAW_OFFSET
+                                                                : DRAW_OFFSET));
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
+
+void Population::takeSnapshot() {
+    glCopyNamedBufferSubData(population_buffer_, population_buffer_, DRAW_OFFSET,
+                             SNAPSHOT_DRAW_OFFSET, DRAW_SIZE);
+}
+
+size_t Population::memoryUsage() {
+    return util::bufferSize(population_buffer_) + util::bufferSize(injection_buffer_) +
+           util::bufferSize(count_buffer_);
+}
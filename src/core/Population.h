@@ -0,0 +1,101 @@
+#pragma once
+
+#include <Windows.h>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "cinder/app/App.h"
+#include "cinder/gl/Shader.h"
+#include "cinder/gl/gl.h"
+
+#include "./Emitter.h"
+#include "./util.h"
+
+using namespace ci;
+using namespace ci::app;
+
+namespace core {
+
+typedef std::shared_ptr<class Population> PopulationRef;
+
+/**
+ * Live particle count of the dynamic particle mode. The particle buffers are sized for a
+ * capacity and hold the live particles at the front. The count lives on the GPU next to the
+ * indirect dispatch and draw arguments derived from it, so removing particles never needs a
+ * readback. Particles are injected behind the live ones, and the sort leaves out the particles
+ * inside a sink, so its counts give the surviving count.
+ */
+class Population {
+public:
+    static const int MAX_SINKS = 4;
+
+    Population();
+    ~Population();
+
+    PopulationRef capacity(int n);
+    PopulationRef particleLayout(int l);
+    PopulationRef sink(vec3 min, vec3 max);
+
+    void prepareBuffers(int num_live);
+    void compileShaders();
+
+    // generate the emitter's particles, they are injected with the next inject
+    void queue(EmitterRef emitter);
+    int numQueued() { return int(queued_.size()); }
+    // live count the GPU could reach once the queue is injected, from the last count read back
+    int maxLive();
+    // append the queued particles behind the live ones, dropped past the capacity
+    void inject(GLuint particle_buffer);
+    // take the live count from the sort's counts once it left out the removed particles
+    void count(GLuint count_buffer, GLuint offset_buffer, int num_bins);
+
+    // the count buffer every pass compiled with DYNAMIC_PARTICLES reads
+    void bind();
+    void bindSinks(const gl::GlslProgRef& prog);
+    // run the bound program over the live particles
+    void dispatch();
+    // draw the live particles, or the ones of the last snapshot
+    void draw(bool snapshot);
+    // keep the draw arguments of the state just copied for the pipelined render
+    void takeSnapshot();
+
+    int getCapacity() { return capacity_; }
+    // after the particle buffers grew, unlike capacity() this keeps the buffers of this instance
+    void setCapacity(int n) { capacity_ = n; }
+    // live particles of a recent step, read back without stalling
+    int numLive() { return num_live_; }
+    size_t memoryUsage();
+
+    static PopulationRef create() { return std::make_shared<Population>(); }
+
+protected:
+    void runResizeProg(int num_injected);
+    void readLiveCount();
+    void copyLiveCount();
+
+    PopulationRef thisRef() { return std::make_shared<Population>(*this); }
+
+    int capacity_;
+    int particle_layout_;
+    int num_live_;
+    int count_slot_;
+    // particles queued since setup, and that total when each count copy was taken
+    int64_t num_queued_total_;
+    int64_t live_queued_total_;
+    std::vector<int64_t> count_queued_totals_;
+
+    std::vector<vec3> sink_min_;
+    std::vector<vec3> sink_max_;
+    std::vector<Particle> queued_;
+    int injection_capacity_;
+
+    gl::GlslProgRef inject_prog_, resize_prog_, count_prog_;
+
+    GLuint population_buffer_;
+    GLuint injection_buffer_;
+    GLuint count_buffer_;
+    std::vector<GLsync> count_fences_;
+};
+
+} // namespace core
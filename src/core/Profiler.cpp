@@ -0,0 +1,236 @@
+#include "./Profiler.h"
+
+#include "./util.h"
+
+using namespace core;
+
+Profiler::Profiler()
+    : ring_size_(4), num_dropped_frames_(0), frame_number_(0), smoothing_(0.05f), enabled_(true),
+      record_csv_(false) {}
+
+Profiler::~Profiler() {
+    for (auto& frame : frames_) {
+        if (!frame.queries.empty()) {
+            glDeleteQueries(GLsizei(frame.queries.size()), frame.queries.data());
+        }
+    }
+}
+
+ProfilerRef Profiler::ringSize(int n) {
+    ring_size_ = std::max(n, 2);
+    return thisRef();
+}
+
+ProfilerRef Profiler::smoothing(float s) {
+    smoothing_ = s;
+    return thisRef();
+}
+
+/**
+ * Show the moving averages and the recording toggles in the params panel
+ */
+void Profiler::addParams(params::InterfaceGlRef params) {
+    params_ = params;
+    params_->addSeparator();
+    params_->addParam("Profile GPU", &enabled_);
+    params_->addParam("Dropped Frames", &num_dropped_frames_, true);
+    params_->addParam<bool>(
+        "Record Profile CSV", [this](bool record) { record ? startCsv("profile.csv") : stopCsv(); },
+        [this]() { return record_csv_; });
+    for (auto& average : averages_) {
+        params_->addParam(average.first + " ms", &average.second, true);
+    }
+}
+
+/**
+ * Collect every finished frame in the ring then start a new one in the next slot
+ */
+void Profiler::nextFrame() {
+    if (frames_.empty()) {
+        frames_.resize(ring_size_);
+    }
+
+    for (auto& frame : frames_) {
+        if (frame.pending) {
+            collect(frame);
+        }
+    }
+
+    frame_number_++;
+    Frame& frame = frames_[frame_number_ % ring_size_];
+    if (frame.pending) {
+        num_dropped_frames_++;
+    }
+
+    frame.number = frame_number_;
+    frame.num_queries = 0;
+    frame.pending = false;
+    frame.samples.clear();
+    open_samples_.clear();
+}
+
+/**
+ * Issue a timestamp query from the current frame's pool
+ */
+int Profiler::timestamp(Frame& frame) {
+    if (frame.num_queries == int(frame.queries.size())) {
+        GLuint query = 0;
+        glGenQueries(1, &query);
+        frame.queries.push_back(query);
+    }
+
+    const int index = frame.num_queries++;
+    glQueryCounter(frame.queries[index], GL_TIMESTAMP);
+    return index;
+}
+
+void Profiler::begin(const std::string& pass) {
+    if (!enabled_ || frames_.empty()) {
+        return;
+    }
+
+    Frame& frame = frames_[frame_number_ % ring_size_];
+    open_samples_[pass] = int(frame.samples.size());
+
+    Sample sample;
+    sample.pass = pass;
+    sample.begin_query = timestamp(frame);
+    sample.end_query = -1;
+    frame.samples.push_back(sample);
+}
+
+void Profiler::end(const std::string& pass) {
+    auto open = open_samples_.find(pass);
+    if (!enabled_ || frames_.empty() || open == open_samples_.end()) {
+        return;
+    }
+
+    Frame& frame = frames_[frame_number_ % ring_size_];
+    frame.samples[open->second].end_query = timestamp(frame);
+    frame.pending = true;
+    open_samples_.erase(open);
+}
+
+/**
+ * Read back a frame if all of its queries are done, returns false without waiting otherwise
+ */
+bool Profiler::collect(Frame& frame) {
+    if (frame.num_queries == 0) {
+        frame.pending = false;
+        return true;
+    }
+
+    // queries complete in order so the last one tells about all of them
+    GLint available = 0;
+    glGetQueryObjectiv(frame.queries[frame.num_queries - 1], GL_QUERY_RESULT_AVAILABLE,
+                       &available);
+    if (!available) {
+        return false;
+    }
+
+    std::vector<GLuint64> times(frame.num_queries);
+    for (int i = 0; i < frame.num_queries; i++) {
+        glGetQueryObjectui64v(frame.queries[i], GL_QUERY_RESULT, &times[i]);
+    }
+
+    GLuint64 first = times.front();
+    GLuint64 last = times.front();
+    for (const auto& sample : frame.samples) {
+        if (sample.end_query < 0) {
+            continue;
+        }
+
+        const GLuint64 begin = times[sample.begin_query];
+        const GLuint64 end = times[sample.end_query];
+        first = std::min(first, begin);
+        last = std::max(last, end);
+        record(frame.number, sample.pass, float(double(end - begin) / 1e6));
+    }
+    record(frame.number, "GPU Frame", float(double(last - first) / 1e6));
+
+    frame.pending = false;
+    return true;
+}
+
+/**
+ * Wait for the GPU and collect every pending frame, for benchmarks that need all the samples
+ */
+void Profiler::finish() {
+    glFinish();
+    for (auto& frame : frames_) {
+        if (frame.pending) {
+            collect(frame);
+        }
+    }
+}
+
+/**
+ * Update the moving average and run total of a pass and append it to the CSV
+ */
+void Profiler::record(int64_t frame_number, const std::string& pass, float ms) {
+    auto average = averages_.find(pass);
+    if (average == averages_.end()) {
+        average = averages_.insert(std::make_pair(pass, ms)).first;
+        if (params_) {
+            params_->addParam(pass + " ms", &average->second, true);
+        }
+    } else {
+        average->second += (ms - average->second) * smoothing_;
+    }
+
+    Total& total = totals_[pass];
+    total.ms += ms;
+    total.count++;
+
+    if (record_csv_) {
+        *csv_ << frame_number << "," << pass << "," << ms << "\n";
+    }
+}
+
+/**
+ * Write one frame,pass,ms row per timed pass until stopCsv
+ */
+bool Profiler::startCsv(const std::string& path) {
+    stopCsv();
+
+    csv_ = std::make_shared<std::ofstream>(path, std::ios::out | std::ios::trunc);
+    if (!csv_->is_open()) {
+        util::log("could not open profile csv %s", path.c_str());
+        csv_ = nullptr;
+        return false;
+    }
+
+    util::log("recording profile to %s", path.c_str());
+    *csv_ << "frame,pass,ms\n";
+    record_csv_ = true;
+    return true;
+}
+
+void Profiler::stopCsv() {
+    if (csv_) {
+        csv_->close();
+        csv_ = nullptr;
+    }
+    record_csv_ = false;
+}
+
+float Profiler::getAverage(const std::string& pass) {
+    auto average = averages_.find(pass);
+    return average == averages_.end() ? 0.0f : average->second;
+}
+
+float Profiler::getMean(const std::string& pass) {
+    auto total = totals_.find(pass);
+    if (total == totals_.end() || total->second.count == 0) {
+        return 0.0f;
+    }
+    return float(total->second.ms / total->second.count);
+}
+
+std::vector<std::string> Profiler::getPasses() {
+    std::vector<std::string> passes;
+    for (const auto& total : totals_) {
+        passes.push_back(total.first);
+    }
+    return passes;
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <Windows.h>
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "cinder/app/App.h"
+#include "cinder/gl/gl.h"
+#include "cinder/params/Params.h"
+
+using namespace ci;
+using namespace ci::app;
+
+namespace core {
+
+typedef std::shared_ptr<class Profiler> ProfilerRef;
+
+/**
+ * GPU pass timings from GL_TIMESTAMP queries. Each frame's queries live in a ring slot and are
+ * only read once the driver reports them available, so reading never stalls the pipeline.
+ * Frames still pending when their slot comes around again are dropped.
+ */
+class Profiler {
+public:
+    Profiler();
+    ~Profiler();
+
+    ProfilerRef ringSize(int n);
+    ProfilerRef smoothing(float s);
+
+    void setEnabled(bool enabled) { enabled_ = enabled; }
+    bool isEnabled() { return enabled_; }
+
+    void addParams(params::InterfaceGlRef params);
+    void nextFrame();
+    void begin(const std::string& pass);
+    void end(const std::string& pass);
+
+    bool startCsv(const std::string& path);
+    void stopCsv();
+
+    void finish();
+    void resetTotals() { totals_.clear(); }
+
+    float getAverage(const std::string& pass);
+    // plain mean over every frame collected since the last resetTotals
+    float getMean(const std::string& pass);
+    std::vector<std::string> getPasses();
+    int numDroppedFrames() { return num_dropped_frames_; }
+
+    static ProfilerRef create() { return std::make_shared<Profiler>(); }
+
+protected:
+    struct Sample {
+        std::string pass;
+        int begin_query;
+        int end_query;
+    };
+
+    struct Frame {
+        Frame() : number(0), num_queries(0), pending(false) {}
+        int64_t number;
+        int num_queries;
+        bool pending;
+        std::vector<GLuint> queries;
+        std::vector<Sample> samples;
+    };
+
+    struct Total {
+        Total() : ms(0), count(0) {}
+        double ms;
+        int count;
+    };
+
+    int timestamp(Frame& frame);
+    bool collect(Frame& frame);
+    void record(int64_t frame_number, const std::string& pass, float ms);
+
+    ProfilerRef thisRef() { return std::make_shared<Profiler>(*this); }
+
+    int ring_size_;
+    int num_dropped_frames_;
+    int64_t frame_number_;
+    float smoothing_;
+    bool enabled_;
+    bool record_csv_;
+
+    std::vector<Frame> frames_;
+    std::map<std::string, int> open_samples_;
+    // map nodes don't move so the params panel can point at the averages
+    std::map<std::string, float> averages_;
+    std::map<std::string, Total> totals_;
+
+    params::InterfaceGlRef params_;
+    std::shared_ptr<std::ofstream> csv_;
+};
+
+/**
+ * Times the GPU commands issued during its lifetime, does nothing without a profiler
+ */
+class ScopedTimer {
+public:
+    ScopedTimer(ProfilerRef profiler, const std::string& pass) : profiler_(profiler), pass_(pass) {
+        if (profiler_) {
+            profiler_->begin(pass_);
+        }
+    }
+
+    ~ScopedTimer() {
+        if (profiler_) {
+            profiler_->end(pass_);
+        }
+    }
+
+private:
+    ProfilerRef profiler_;
+    std::string pass_;
+};
+
+} // namespace core
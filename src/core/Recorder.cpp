@@ -0,0 +1,268 @@
+#include "./Recorder.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "./Particle.h"
+#include "./util.h"
+
+using namespace core;
+
+namespace {
+
+const uint32_t RECORDER_VERSION = 1;
+
+Recorder::ChunkHeader chunkHeader(const char* tag, int64_t frame, double time, uint64_t bytes) {
+    Recorder::ChunkHeader header;
+    std::memcpy(header.tag, tag, sizeof(header.tag));
+    header.reserved = 0;
+    header.frame = frame;
+    header.time = time;
+    header.bytes = bytes;
+    return header;
+}
+
+} // namespace
+
+Recorder::Recorder()
+    : queue_depth_(4), num_particles_(0), particle_layout_(AOS_LAYOUT), num_captured_(0),
+      num_dropped_(0), num_written_(0) {}
+
+/**
+ * Waits for the writers, only at exit
+ */
+Recorder::~Recorder() {
+    stop();
+    for (auto& stream : closing_streams_) {
+        {
+            std::lock_guard<std::mutex> lock(stream->mutex);
+            stream->stopping = true;
+        }
+        stream->ready.notify_all();
+        if (stream->writer.joinable()) {
+            stream->writer.join();
+        }
+    }
+}
+
+RecorderRef Recorder::queueDepth(int n) {
+    queue_depth_ = std::max(n, 1);
+    return thisRef();
+}
+
+void Recorder::setParticleFormat(int num_particles, int particle_layout) {
+    num_particles_ = num_particles;
+    particle_layout_ = particle_layout;
+}
+
+/**
+ * Show the recording toggle and the frame counts in the params panel
+ */
+void Recorder::addParams(params::InterfaceGlRef params) {
+    params->addSeparator();
+    params->addParam<bool>(
+        "Record Frames", [this](bool record) { record ? (void)start("frames.wcrec") : stop(); },
+        [this]() { return isRecording(); });
+    params->addParam("Recorded Frames", &num_written_, true);
+    params->addParam("Dropped Record Frames", &num_dropped_, true);
+}
+
+/**
+ * Open the file, map the readback buffers and start the writer thread
+ */
+bool Recorder::start(const std::string& path) {
+    stop();
+    if (num_particles_ <= 0) {
+        util::log("recorder has no particle format");
+        return false;
+    }
+
+    auto stream = std::make_shared<Stream>();
+    stream->file = std::fopen(path.c_str(), "wb");
+    if (!stream->file) {
+        util::log("could not open %s", path.c_str());
+        return false;
+    }
+
+    stream->frame_bytes = uint64_t(layout::particleBufferSize(num_particles_, particle_layout_));
+    FileHeader header;
+    std::memcpy(header.magic, "WCRC", sizeof(header.magic));
+    header.version = RECORDER_VERSION;
+    header.num_particles = uint32_t(num_particles_);
+    header.particle_layout = uint32_t(particle_layout_);
+    header.frame_bytes = stream->frame_bytes;
+    std::fwrite(&header, sizeof(header), 1, stream->file);
+
+    // client storage keeps the copies in memory the CPU reads quickly
+    const GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    stream->slots.resize(queue_depth_);
+    for (Slot& slot : stream->slots) {
+        glCreateBuffers(1, &slot.buffer);
+        glNamedBufferStorage(slot.buffer, GLsizeiptr(stream->frame_bytes), nullptr,
+                             flags | GL_CLIENT_STORAGE_BIT);
+        slot.data =
+            glMapNamedBufferRange(slot.buffer, 0, GLsizeiptr(stream->frame_bytes), flags);
+    }
+
+    stream->writer = std::thread(&Recorder::writeFrames, stream.get());
+    stream_ = stream;
+    num_captured_ = 0;
+    num_dropped_ = 0;
+    num_written_ = 0;
+    util::log("recording %d particles to %s, %d buffers", num_particles_, path.c_str(),
+              queue_depth_);
+    return true;
+}
+
+void Recorder::stop() {
+    if (!stream_) {
+        return;
+    }
+
+    util::log("stopping recording after %d frames, %d dropped", num_captured_, num_dropped_);
+    closing_streams_.push_back(stream_);
+    stream_ = nullptr;
+}
+
+void Recorder::capture(GLuint particle_buffer, double time) {
+    update();
+    if (!stream_) {
+        return;
+    }
+
+    Slot& slot = stream_->slots[stream_->next_slot];
+    {
+        std::lock_guard<std::mutex> lock(stream_->mutex);
+        if (slot.state != FREE_SLOT) {
+            num_dropped_++;
+            return;
+        }
+        slot.state = COPYING_SLOT;
+    }
+
+    slot.frame = num_captured_++;
+    slot.time = time;
+    glCopyNamedBufferSubData(particle_buffer, slot.buffer, 0, 0,
+                             GLsizeiptr(stream_->frame_bytes));
+    slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    stream_->next_slot = (stream_->next_slot + 1) % int(stream_->slots.size());
+}
+
+/**
+ * Queue the copies whose fence has passed for the writer, oldest first
+ */
+void Recorder::poll(Stream& stream) {
+    const int n = int(stream.slots.size());
+    for (int i = 0; i < n; i++) {
+        Slot& slot = stream.slots[(stream.next_slot + i) % n];
+        if (!slot.fence) {
+            continue;
+        }
+        if (glClientWaitSync(slot.fence, 0, 0) == GL_TIMEOUT_EXPIRED) {
+            break;
+        }
+
+        glDeleteSync(slot.fence);
+        slot.fence = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(stream.mutex);
+            slot.state = QUEUED_SLOT;
+            stream.queue.push_back(int(&slot - stream.slots.data()));
+        }
+        stream.ready.notify_one();
+    }
+}
+
+/**
+ * Once a closing stream has nothing in flight let the writer finish the file, and once the
+ * writer is done free the buffers. Returns true when the stream can be forgotten.
+ */
+bool Recorder::release(const std::shared_ptr<Stream>& stream) {
+    bool idle = true;
+    {
+        std::lock_guard<std::mutex> lock(stream->mutex);
+        for (const Slot& slot : stream->slots) {
+            idle = idle && slot.state == FREE_SLOT;
+        }
+        stream->stopping = idle;
+    }
+    if (!idle) {
+        return false;
+    }
+
+    stream->ready.notify_all();
+    if (!stream->done) {
+        return false;
+    }
+
+    stream->writer.join();
+    for (Slot& slot : stream->slots) {
+        glUnmapNamedBuffer(slot.buffer);
+        glDeleteBuffers(1, &slot.buffer);
+    }
+    return true;
+}
+
+void Recorder::update() {
+    if (stream_) {
+        poll(*stream_);
+        num_written_ = stream_->written;
+    }
+
+    for (auto& stream : closing_streams_) {
+        poll(*stream);
+    }
+    closing_streams_.erase(std::remove_if(closing_streams_.begin(), closing_streams_.end(),
+                                          [this](const std::shared_ptr<Stream>& stream) {
+                                              return release(stream);
+                                          }),
+                           closing_streams_.end());
+}
+
+/**
+ * Writer thread, appends queued frames until the stream is stopped, then writes the index
+ */
+void Recorder::writeFrames(Stream* stream) {
+    uint64_t offset = sizeof(FileHeader);
+    while (true) {
+        int index = -1;
+        {
+            std::unique_lock<std::mutex> lock(stream->mutex);
+            stream->ready.wait(lock,
+                               [stream]() { return !stream->queue.empty() || stream->stopping; });
+            if (stream->queue.empty()) {
+                break;
+            }
+            index = stream->queue.front();
+            stream->queue.pop_front();
+        }
+
+        // the slot stays queued while it is written so the GL thread leaves it alone
+        Slot& slot = stream->slots[index];
+        const ChunkHeader header = chunkHeader("FRME", slot.frame, slot.time, stream->frame_bytes);
+        std::fwrite(&header, sizeof(header), 1, stream->file);
+        std::fwrite(slot.data, 1, size_t(stream->frame_bytes), stream->file);
+        stream->index.push_back({slot.frame, offset});
+        offset += sizeof(header) + stream->frame_bytes;
+        stream->written++;
+
+        std::lock_guard<std::mutex> lock(stream->mutex);
+        slot.state = FREE_SLOT;
+    }
+
+    const uint64_t index_bytes = stream->index.size() * sizeof(IndexEntry);
+    const ChunkHeader header = chunkHeader("INDX", int64_t(stream->index.size()), 0, index_bytes);
+    std::fwrite(&header, sizeof(header), 1, stream->file);
+    if (!stream->index.empty()) {
+        std::fwrite(stream->index.data(), sizeof(IndexEntry), stream->index.size(),
+                    stream->file);
+    }
+
+    Trailer trailer;
+    trailer.index_offset = offset;
+    std::memcpy(trailer.magic, "WEND", sizeof(trailer.magic));
+    trailer.reserved = 0;
+    std::fwrite(&trailer, sizeof(trailer), 1, stream->file);
+    std::fclose(stream->file);
+    stream->done = true;
+}
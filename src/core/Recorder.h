@@ -0,0 +1,142 @@
+#pragma once
+
+#include <Windows.h>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "cinder/app/App.h"
+#include "cinder/gl/gl.h"
+#include "cinder/params/Params.h"
+
+using namespace ci;
+using namespace ci::app;
+
+namespace core {
+
+typedef std::shared_ptr<class Recorder> RecorderRef;
+
+/**
+ * Streams the particle buffer of every captured step to disk without stalling the pipeline.
+ * Each capture is copied into one of queueDepth persistently mapped buffers and fenced. Once
+ * the fence has passed, a writer thread appends the mapped bytes to the file. When every buffer
+ * is still in flight the capture is dropped instead of waiting.
+ *
+ * File layout, little endian:
+ *   FileHeader
+ *   one ChunkHeader tagged FRME per frame, followed by the raw particle buffer in its layout
+ *   a ChunkHeader tagged INDX followed by an IndexEntry per frame
+ *   a Trailer holding the offset of the index chunk
+ */
+class Recorder {
+public:
+    struct FileHeader {
+        char magic[4]; // WCRC
+        uint32_t version;
+        uint32_t num_particles;
+        uint32_t particle_layout;
+        uint64_t frame_bytes;
+    };
+
+    struct ChunkHeader {
+        char tag[4];
+        uint32_t reserved;
+        int64_t frame;
+        double time;
+        uint64_t bytes;
+    };
+
+    struct IndexEntry {
+        int64_t frame;
+        uint64_t offset;
+    };
+
+    struct Trailer {
+        uint64_t index_offset;
+        char magic[4]; // WEND
+        uint32_t reserved;
+    };
+
+    Recorder();
+    ~Recorder();
+
+    RecorderRef queueDepth(int n);
+
+    void setParticleFormat(int num_particles, int particle_layout);
+    void addParams(params::InterfaceGlRef params);
+
+    bool start(const std::string& path);
+    // the file is finished in the background once the frames in flight are written
+    void stop();
+    bool isRecording() { return stream_ != nullptr; }
+
+    // queue a copy of the particle buffer, dropped if every buffer is still in flight
+    void capture(GLuint particle_buffer, double time);
+    // hand finished copies to the writer and release closed streams, never waits
+    void update();
+
+    int numCaptured() { return num_captured_; }
+    int numDropped() { return num_dropped_; }
+    int numWritten() { return num_written_; }
+
+    static RecorderRef create() { return std::make_shared<Recorder>(); }
+
+protected:
+    enum SlotState { FREE_SLOT, COPYING_SLOT, QUEUED_SLOT };
+
+    struct Slot {
+        Slot() : buffer(0), data(nullptr), fence(nullptr), frame(0), time(0), state(FREE_SLOT) {}
+        GLuint buffer;
+        const void* data;
+        GLsync fence;
+        int64_t frame;
+        double time;
+        // guarded by the stream mutex, the writer only frees queued slots
+        SlotState state;
+    };
+
+    // an open file with its buffers and writer, outlives stop() until the writer is done
+    struct Stream {
+        Stream()
+            : file(nullptr), frame_bytes(0), next_slot(0), stopping(false), done(false),
+              written(0) {}
+        std::FILE* file;
+        uint64_t frame_bytes;
+        std::vector<Slot> slots;
+        // slot of the next capture, so the oldest copy in flight is the one after it
+        int next_slot;
+        std::vector<IndexEntry> index;
+        std::mutex mutex;
+        std::condition_variable ready;
+        std::deque<int> queue;
+        bool stopping;
+        std::atomic<bool> done;
+        std::atomic<int> written;
+        std::thread writer;
+    };
+
+    static void writeFrames(Stream* stream);
+    void poll(Stream& stream);
+    bool release(const std::shared_ptr<Stream>& stream);
+
+    RecorderRef thisRef() { return std::make_shared<Recorder>(*this); }
+
+    int queue_depth_;
+    int num_particles_;
+    int particle_layout_;
+    int num_captured_;
+    int num_dropped_;
+    int num_written_;
+
+    std::shared_ptr<Stream> stream_;
+    std::vector<std::shared_ptr<Stream>> closing_streams_;
+};
+
+} // namespace core
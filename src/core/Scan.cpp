@@ -0,0 +1,145 @@
+#include "./Scan.h"
+
+using namespace core;
+
+Scan::Scan() : num_items_(0) {}
+
+Scan::~Scan() {
+    if (!block_sums_.empty()) {
+        glDeleteBuffers(GLsizei(block_sums_.size()), block_sums_.data());
+    }
+}
+
+ScanRef Scan::numItems(int n) {
+    num_items_ = n;
+    return thisRef();
+}
+
+/**
+ * Prepares one block sum buffer per level, the last level holds a single total
+ */
+void Scan::prepareBuffers() {
+    util::log("\tcreating scan block sum buffers");
+
+    level_sizes_.clear();
+    block_sums_.clear();
+
+    int size = std::max(num_items_, 1);
+    do {
+        const int blocks = numBlocks(size);
+        std::vector<uint32_t> zeros(blocks, 0);
+
+        GLuint buffer;
+        glCreateBuffers(1, &buffer);
+        glNamedBufferStorage(buffer, blocks * sizeof(uint32_t), zeros.data(), 0);
+
+        level_sizes_.push_back(size);
+        block_sums_.push_back(buffer);
+        size = blocks;
+    } while (size > 1);
+
+    util::log("\tscan levels: %d", numLevels());
+}
+
+/**
+ * Compiles and prepares shader programs
+ */
+void Scan::compileShaders() {
+    util::log("\tcompiling scan shader");
+    scan_prog_ = util::compileComputeShader("scan/scan.comp");
+
+    util::log("\tcompiling scan add block sums shader");
+    add_prog_ = util::compileComputeShader("scan/addBlockSums.comp");
+}
+
+/**
+ * Scan each tile of a level, then recursively scan the tile sums and add them back
+ */
+void Scan::scanLevel(GLuint in_buffer, GLuint out_buffer, int level) {
+    const int n = level_sizes_[level];
+    runScanProg(in_buffer, out_buffer, block_sums_[level], n);
+
+    if (level + 1 < numLevels()) {
+        scanLevel(block_sums_[level], block_sums_[level], level + 1);
+        runAddProg(out_buffer, block_sums_[level], n);
+    }
+}
+
+/**
+ * Run tile scan compute shader
+ */
+void Scan::runScanProg(GLuint in_buffer, GLuint out_buffer, GLuint block_sums, int n) {
+    gl::ScopedGlslProg prog(scan_prog_);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, in_buffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, out_buffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, block_sums);
+
+    scan_prog_->uniform("numItems", n);
+
+    util::runProg(numBlocks(n));
+    util::memoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+/**
+ * Run add block sums compute shader
+ */
+void Scan::runAddProg(GLuint buffer, GLuint block_sums, int n) {
+    gl::ScopedGlslProg prog(add_prog_);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, buffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, block_sums);
+
+    add_prog_->uniform("numItems", n);
+
+    util::runProg(numBlocks(n));
+    util::memoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+/**
+ * main logic - store the exclusive prefix sum of in_buffer in out_buffer
+ */
+void Scan::run(GLuint in_buffer, GLuint out_buffer) { scanLevel(in_buffer, out_buffer, 0); }
+
+/**
+ * Compare the GPU result against a CPU reference scan, returns true if they match
+ */
+bool Scan::check(GLuint in_buffer, GLuint out_buffer) {
+    std::vector<uint32_t> in = util::getUints(in_buffer, num_items_);
+    std::vector<uint32_t> out = util::getUints(out_buffer, num_items_);
+    const uint32_t total = util::getUints(getTotalBuffer(), 1)[0];
+
+    int mismatches = 0;
+    int first_mismatch = -1;
+    uint32_t prefix = 0;
+    for (int i = 0; i < num_items_; i++) {
+        if (out[i] != prefix) {
+            if (first_mismatch < 0) {
+                first_mismatch = i;
+            }
+            mismatches++;
+        }
+        prefix += in[i];
+    }
+
+    if (total != prefix) {
+        util::log("scan check: total %u, expected %u", total, prefix);
+    }
+
+    if (mismatches > 0) {
+        util::log("scan check: %d of %d offsets wrong, first at %d (got %u)", mismatches,
+                  num_items_, first_mismatch, out[first_mismatch]);
+        return false;
+    }
+
+    return total == prefix;
+}
+
+/**
+ * Bytes held by the block sum buffers of every level
+ */
+size_t Scan::memoryUsage() {
+    size_t bytes = 0;
+    for (GLuint buffer : block_sums_) {
+        bytes += util::bufferSize(buffer);
+    }
+    return bytes;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <Windows.h>
+#include <memory>
+#include <vector>
+
+#include "cinder/app/App.h"
+#include "cinder/gl/Shader.h"
+#include "cinder/gl/gl.h"
+
+#include "./util.h"
+
+using namespace ci;
+using namespace ci::app;
+
+namespace core {
+
+typedef std::shared_ptr<class Scan> ScanRef;
+
+// number of items each scan work group reduces in shared memory
+const int SCAN_TILE_SIZE = WORK_GROUP_SIZE * 2;
+
+/**
+ * Multi level parallel exclusive prefix sum over a buffer of uints
+ */
+class Scan {
+public:
+    Scan();
+    ~Scan();
+
+    ScanRef numItems(int n);
+
+    void prepareBuffers();
+    void compileShaders();
+    void run(GLuint in_buffer, GLuint out_buffer);
+    bool check(GLuint in_buffer, GLuint out_buffer);
+
+    int numItems() { return num_items_; }
+    int numLevels() { return int(level_sizes_.size()); }
+    size_t memoryUsage();
+
+    // single element buffer holding the sum of all items after run
+    GLuint getTotalBuffer() { return block_sums_.back(); }
+
+    static ScanRef create() { return std::make_shared<Scan>(); }
+
+protected:
+    void scanLevel(GLuint in_buffer, GLuint out_buffer, int level);
+    void runScanProg(GLuint in_buffer, GLuint out_buffer, GLuint block_sums, int n);
+    void runAddProg(GLuint buffer, GLuint block_sums, int n);
+
+    static int numBlocks(int n) { return int(ceil(float(n) / float(SCAN_TILE_SIZE))); }
+
+    ScanRef thisRef() { return std::make_shared<Scan>(*this); }
+
+    int num_items_;
+
+    std::vector<int> level_sizes_;
+    std::vector<GLuint> block_sums_;
+
+    gl::GlslProgRef scan_prog_, add_prog_;
+};
+
+} // namespace core
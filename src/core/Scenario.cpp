@@ -0,0 +1,100 @@
+#include "./Scenario.h"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+using namespace core;
+
+namespace {
+
+/**
+ * Fill a lattice of the given footprint from the floor up, the spacing shrinks
+ * when that many particles wouldn't fit under the lid
+ */
+std::vector<Particle> fillLattice(int n, glm::vec3 origin, float width, float size,
+                                  float spacing, float jitter, std::mt19937& rng) {
+    const float height = size - origin.y;
+    spacing = std::min(spacing, std::cbrt(width * width * height / float(std::max(n, 1))));
+    const int d = std::max(1, int(width / spacing));
+
+    std::uniform_real_distribution<float> offset(-jitter * spacing / 2.0f,
+                                                 jitter * spacing / 2.0f);
+
+    std::vector<Particle> particles(n);
+    for (int i = 0; i < n; i++) {
+        const glm::vec3 lattice(float(i % d), float(i / (d * d)), float((i / d) % d));
+        const glm::vec3 position =
+            origin + (lattice + glm::vec3(0.5f)) * spacing +
+            glm::vec3(offset(rng), offset(rng), offset(rng));
+        particles[i].position = glm::clamp(position, glm::vec3(0), glm::vec3(size));
+    }
+    return particles;
+}
+
+} // namespace
+
+/**
+ * Generate n particles for a scenario in a cube of the given size
+ */
+std::vector<Particle> scenario::generate(int scenario, int n, float size, float particle_radius,
+                                         unsigned seed) {
+    std::mt19937 rng(seed);
+    const float rest_spacing = particle_radius * 1.75f;
+
+    if (scenario == DENSE_COLUMN) {
+        // packed tighter than rest so the column starts under pressure
+        const float width = size * 0.25f;
+        const glm::vec3 origin(size * 0.375f, 0.0f, size * 0.375f);
+        return fillLattice(n, origin, width, size, rest_spacing * 0.8f, 0.25f, rng);
+    }
+
+    if (scenario == SPARSE_SPLASH) {
+        std::uniform_real_distribution<float> coord(0.0f, size);
+        std::uniform_real_distribution<float> speed(0.5f, 2.0f);
+        const glm::vec3 center(size / 2.0f);
+
+        std::vector<Particle> particles(n);
+        for (auto& p : particles) {
+            p.position = glm::vec3(coord(rng), coord(rng), coord(rng));
+            const glm::vec3 away = p.position - center;
+            const float dist = glm::length(away);
+            p.velocity = dist > 0.0f ? away / dist * speed(rng) : glm::vec3(0, speed(rng), 0);
+        }
+        return particles;
+    }
+
+    // dam break, a cube with half a spacing of jitter
+    const int d = int(std::ceil(std::cbrt(double(n))));
+    const float spacing = std::min(rest_spacing, size / float(std::max(d, 1)));
+    const float jitter = spacing * 0.5f;
+    std::uniform_real_distribution<float> offset(-jitter / 2.0f, jitter / 2.0f);
+
+    std::vector<Particle> particles(n);
+    for (int i = 0; i < n; i++) {
+        const glm::vec3 lattice(float(i % d), float((i / d) % d), float(i / (d * d)));
+        particles[i].position =
+            lattice * spacing + glm::vec3(offset(rng), offset(rng), offset(rng));
+    }
+    return particles;
+}
+
+std::string scenario::name(int scenario) {
+    switch (scenario) {
+    case DENSE_COLUMN:
+        return "dense-column";
+    case SPARSE_SPLASH:
+        return "sparse-splash";
+    default:
+        return "dam-break";
+    }
+}
+
+int scenario::fromName(const std::string& name) {
+    for (int s = 0; s < NUM_SCENARIOS; s++) {
+        if (scenario::name(s) == name) {
+            return s;
+        }
+    }
+    return -1;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "./Particle.h"
+
+namespace core {
+
+namespace scenario {
+
+/**
+ * Seeded initial particle states, shared by the app and the benchmarks
+ */
+enum ScenarioType {
+    // jittered block in the lower corner, the original initial state
+    DAM_BREAK = 0,
+    // tall packed column on a small footprint, many neighbors per particle
+    DENSE_COLUMN = 1,
+    // particles scattered over the whole box flying away from its center, few neighbors
+    SPARSE_SPLASH = 2,
+    NUM_SCENARIOS,
+};
+
+std::vector<Particle> generate(int scenario, int n, float size, float particle_radius,
+                               unsigned seed);
+
+std::string name(int scenario);
+
+// -1 for unknown names
+int fromName(const std::string& name);
+
+} // namespace scenario
+
+} // namespace core
@@ -0,0 +1,293 @@
+#include "./ShaderCache.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#include "cinder/Utilities.h"
+
+#include "./util.h"
+
+using namespace core;
+
+namespace {
+
+const uint32_t BINARY_VERSION = 1;
+const int MAX_INCLUDE_DEPTH = 8;
+
+// linked by the base constructor and replaced by the binary right after
+const char* STUB_SOURCE = "#version 460 core\n"
+                          "layout(local_size_x = 1) in;\n"
+                          "void main() {}\n";
+
+/**
+ * FNV-1a, only has to tell variants apart
+ */
+uint64_t hash(const std::string& s, uint64_t h = 14695981039346656037ull) {
+    for (unsigned char c : s) {
+        h ^= c;
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+float elapsedMs(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start)
+        .count();
+}
+
+/**
+ * A program restored from a binary. GlslProg only links from source, so a stub is linked first
+ * and its executable replaced. The interface the base constructor cached belongs to the stub and
+ * is queried again.
+ */
+class BinaryGlslProg : public gl::GlslProg {
+public:
+    BinaryGlslProg(GLenum format, const std::vector<char>& binary)
+        : gl::GlslProg(gl::GlslProg::Format().compute(STUB_SOURCE)), valid_(false) {
+        glProgramBinary(mHandle, format, binary.data(), GLsizei(binary.size()));
+        GLint status = GL_FALSE;
+        glGetProgramiv(mHandle, GL_LINK_STATUS, &status);
+        valid_ = status == GL_TRUE;
+        if (valid_) {
+            mAttributes.clear();
+            mUniforms.clear();
+            mUniformBlocks.clear();
+            cacheActiveAttribs();
+            cacheActiveUniforms();
+            cacheActiveUniformBlocks();
+        }
+    }
+
+    // false once the driver rejects the binary, after an update for example
+    bool isValid() { return valid_; }
+
+private:
+    bool valid_;
+};
+
+} // namespace
+
+ShaderCache::ShaderCache()
+    : directory_("shader_cache"), disk_cache_(true), num_compiled_(0), num_loaded_(0),
+      num_reused_(0), compile_ms_(0), load_ms_(0) {}
+
+ShaderCacheRef ShaderCache::directory(const std::string& path) {
+    directory_ = path;
+    return thisRef();
+}
+
+ShaderCacheRef ShaderCache::diskCache(bool enabled) {
+    disk_cache_ = enabled;
+    return thisRef();
+}
+
+ShaderCacheRef ShaderCache::get() {
+    static ShaderCacheRef cache = create();
+    return cache;
+}
+
+gl::GlslProgRef ShaderCache::compute(const std::string& filename,
+                                     const std::vector<std::string>& defines) {
+    std::vector<std::string> all_defines = defines;
+    all_defines.push_back("WORK_GROUP_SIZE " + std::to_string(WORK_GROUP_SIZE));
+
+    auto format = gl::GlslProg::Format().compute(loadAsset(filename));
+    for (const auto& define : all_defines) {
+        format.define(define);
+    }
+    return program(variantKey({expandSource(filename, 0)}, all_defines), format);
+}
+
+gl::GlslProgRef ShaderCache::render(const std::string& vertex, const std::string& fragment,
+                                    const std::vector<std::string>& defines,
+                                    const std::map<std::string, GLint>& attrib_locations) {
+    auto format = gl::GlslProg::Format().vertex(loadAsset(vertex)).fragment(loadAsset(fragment));
+    std::vector<std::string> key_defines = defines;
+    for (const auto& define : defines) {
+        format.define(define);
+    }
+    // attribute locations are linked into the binary, so they are part of the variant
+    for (const auto& attrib : attrib_locations) {
+        format.attribLocation(attrib.first, attrib.second);
+        key_defines.push_back(attrib.first + "@" + std::to_string(attrib.second));
+    }
+    return program(variantKey({expandSource(vertex, 0), expandSource(fragment, 0)}, key_defines),
+                   format);
+}
+
+/**
+ * Reuse, load or compile the variant, in that order
+ */
+gl::GlslProgRef ShaderCache::program(uint64_t key, const gl::GlslProg::Format& format) {
+    auto found = programs_.find(key);
+    if (found != programs_.end()) {
+        num_reused_++;
+        return found->second;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    gl::GlslProgRef prog = disk_cache_ ? loadBinary(key) : nullptr;
+    if (prog) {
+        load_ms_ += elapsedMs(start);
+        num_loaded_++;
+    } else {
+        start = std::chrono::steady_clock::now();
+        prog = gl::GlslProg::create(format);
+        compile_ms_ += elapsedMs(start);
+        num_compiled_++;
+        if (disk_cache_) {
+            saveBinary(key, prog->getHandle());
+        }
+    }
+    programs_[key] = prog;
+    return prog;
+}
+
+/**
+ * The source with its includes pasted in, so editing an include changes the key of every shader
+ * that uses it
+ */
+std::string ShaderCache::expandSource(const fs::path& path, int depth) {
+    std::istringstream lines(loadString(loadAsset(path)));
+    std::string expanded, line;
+    while (std::getline(lines, line)) {
+        const std::string directive = "#include \"";
+        const size_t start = line.find(directive);
+        const size_t end = start == std::string::npos
+                               ? std::string::npos
+                               : line.find('"', start + directive.size());
+        if (end != std::string::npos && depth < MAX_INCLUDE_DEPTH) {
+            const std::string include =
+                line.substr(start + directive.size(), end - start - directive.size());
+            expanded += expandSource(path.parent_path() / include, depth + 1);
+        } else {
+            expanded += line;
+            expanded += '\n';
+        }
+    }
+    return expanded;
+}
+
+uint64_t ShaderCache::variantKey(const std::vector<std::string>& sources,
+                                 const std::vector<std::string>& defines) {
+    if (driver_.empty()) {
+        driver_ = std::string(reinterpret_cast<const char*>(glGetString(GL_VENDOR))) + "|" +
+                  reinterpret_cast<const char*>(glGetString(GL_RENDERER)) + "|" +
+                  reinterpret_cast<const char*>(glGetString(GL_VERSION));
+    }
+
+    uint64_t key = hash(driver_);
+    for (const auto& source : sources) {
+        key = hash(source, hash("\x1e", key));
+    }
+    for (const auto& define : defines) {
+        key = hash(define, hash("\x1f", key));
+    }
+    return key;
+}
+
+fs::path ShaderCache::binaryPath(uint64_t key) {
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx.bin", static_cast<unsigned long long>(key));
+    return fs::path(directory_) / name;
+}
+
+/**
+ * Null when there is no binary for the key or the driver rejects it, then the variant is
+ * compiled and the binary rewritten
+ */
+gl::GlslProgRef ShaderCache::loadBinary(uint64_t key) {
+    std::ifstream file(binaryPath(key).string(), std::ios::binary);
+    if (!file) {
+        return nullptr;
+    }
+
+    BinaryHeader header = {};
+    file.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if (!file || std::memcmp(header.magic, "WCSB", sizeof(header.magic)) != 0 ||
+        header.version != BINARY_VERSION || header.key != key) {
+        return nullptr;
+    }
+
+    std::vector<char> binary(header.size);
+    file.read(binary.data(), header.size);
+    if (!file) {
+        return nullptr;
+    }
+
+    auto prog = std::make_shared<BinaryGlslProg>(GLenum(header.format), binary);
+    if (!prog->isValid()) {
+        util::log("\tprogram binary %016llx is stale, recompiling",
+                  static_cast<unsigned long long>(key));
+        return nullptr;
+    }
+    return prog;
+}
+
+void ShaderCache::saveBinary(uint64_t key, GLuint program) {
+    // GlslProg links in its constructor, before the hint can be set, so link once more with it.
+    // The sources and the driver are the same, so the locations GlslProg cached still hold.
+    glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    glLinkProgram(program);
+    GLint linked = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    if (!linked) {
+        util::log("\tprogram %016llx failed to relink for its binary",
+                  static_cast<unsigned long long>(key));
+        return;
+    }
+
+    GLint size = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &size);
+    if (size <= 0) {
+        // the variant is compiled again next run
+        util::log("\tdriver returned no binary for program %016llx",
+                  static_cast<unsigned long long>(key));
+        return;
+    }
+
+    BinaryHeader header = {};
+    std::memcpy(header.magic, "WCSB", sizeof(header.magic));
+    header.version = BINARY_VERSION;
+    header.key = key;
+    std::vector<char> binary(size);
+    GLenum format = 0;
+    GLsizei length = 0;
+    glGetProgramBinary(program, size, &length, &format, binary.data());
+    header.format = uint32_t(format);
+    header.size = uint32_t(length);
+
+    fs::create_directories(directory_);
+    std::ofstream file(binaryPath(key).string(), std::ios::binary | std::ios::trunc);
+    if (!file) {
+        util::log("could not write %s", binaryPath(key).string().c_str());
+        return;
+    }
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(binary.data(), length);
+}
+
+void ShaderCache::clear() { programs_.clear(); }
+
+void ShaderCache::resetStats() {
+    num_compiled_ = num_loaded_ = num_reused_ = 0;
+    compile_ms_ = load_ms_ = 0;
+}
+
+/**
+ * A cold start compiles every variant, a warm one loads them or reuses them after a reset
+ */
+void ShaderCache::logStats() {
+    util::log("shaders: %d compiled in %.1f ms, %d loaded in %.1f ms, %d reused", num_compiled_,
+              compile_ms_, num_loaded_, load_ms_, num_reused_);
+}
+
+void ShaderCache::addParams(params::InterfaceGlRef params) {
+    params->addParam("Shaders Compiled", &num_compiled_, true);
+    params->addParam("Shader Compile ms", &compile_ms_, true);
+    params->addParam("Shaders Loaded", &num_loaded_, true);
+    params->addParam("Shader Load ms", &load_ms_, true);
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <Windows.h>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "cinder/Filesystem.h"
+#include "cinder/app/App.h"
+#include "cinder/gl/GlslProg.h"
+#include "cinder/gl/gl.h"
+#include "cinder/params/Params.h"
+
+using namespace ci;
+using namespace ci::app;
+
+namespace core {
+
+typedef std::shared_ptr<class ShaderCache> ShaderCacheRef;
+
+/**
+ * Linked programs keyed by a variant: the hash of the sources with their includes expanded, the
+ * injected defines and the driver. A variant built earlier in the run is reused as is, one built
+ * by an earlier run is loaded from its program binary on disk, and anything else is compiled and
+ * its binary saved. Defines are how the repo picks variants, so constants folded into a variant
+ * are just more defines, see specialize.glsl. Every compute shader also gets WORK_GROUP_SIZE so
+ * the shaders and the dispatch sizes can't disagree.
+ */
+class ShaderCache {
+public:
+    ShaderCache();
+
+    // where the program binaries go, relative to the working directory
+    ShaderCacheRef directory(const std::string& path);
+    // without the disk cache every variant not built yet in this run is compiled
+    ShaderCacheRef diskCache(bool enabled);
+
+    gl::GlslProgRef compute(const std::string& filename, const std::vector<std::string>& defines);
+    gl::GlslProgRef render(const std::string& vertex, const std::string& fragment,
+                           const std::vector<std::string>& defines,
+                           const std::map<std::string, GLint>& attrib_locations = {});
+
+    // release the programs of this run while the context is still current, the disk cache stays
+    void clear();
+    void resetStats();
+    void logStats();
+    void addParams(params::InterfaceGlRef params);
+
+    int numCompiled() { return num_compiled_; }
+    int numLoaded() { return num_loaded_; }
+    int numReused() { return num_reused_; }
+    // CPU time spent building programs since the last resetStats
+    float compileMs() { return compile_ms_; }
+    float loadMs() { return load_ms_; }
+
+    // shared by every util::compile* call
+    static ShaderCacheRef get();
+    static ShaderCacheRef create() { return std::make_shared<ShaderCache>(); }
+
+protected:
+    struct BinaryHeader {
+        char magic[4];
+        uint32_t version;
+        uint64_t key;
+        uint32_t format;
+        uint32_t size;
+    };
+
+    gl::GlslProgRef program(uint64_t key, const gl::GlslProg::Format& format);
+    std::string expandSource(const fs::path& path, int depth);
+    uint64_t variantKey(const std::vector<std::string>& sources,
+                        const std::vector<std::string>& defines);
+    fs::path binaryPath(uint64_t key);
+    gl::GlslProgRef loadBinary(uint64_t key);
+    void saveBinary(uint64_t key, GLuint program);
+
+    ShaderCacheRef thisRef() { return std::make_shared<ShaderCache>(*this); }
+
+    std::string directory_;
+    std::string driver_;
+    bool disk_cache_;
+
+    std::map<uint64_t, gl::GlslProgRef> programs_;
+
+    int num_compiled_;
+    int num_loaded_;
+    int num_reused_;
+    float compile_ms_;
+    float load_ms_;
+};
+
+} // namespace core
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstdint>
+
+#include <glm/glm.hpp>
+
+namespace core {
+
+// uniform buffer binding point of the SimParams block, see params.glsl
+const uint32_t SIM_PARAMS_BINDING = 0;
+
+/**
+ * Parameters every fluid pass reads, mirrors the std140 SimParams block in params.glsl. Members
+ * are ordered so std140 adds no padding besides the tail, a vec3 followed by a scalar fills a
+ * 16 byte slot.
+ */
+struct SimParams {
+    glm::vec3 gravity;
+    float size;
+    float bin_size;
+    int32_t grid_res;
+    int32_t num_particles;
+    float particle_mass;
+    float kernel_radius;
+    float stiffness;
+    float rest_density;
+    float rest_pressure;
+    float viscosity_coefficient;
+    float poly6_kernel_const;
+    float spiky_kernel_const;
+    float viscosity_kernel_const;
+    float pressure_delta;
+    float pressure_tolerance;
+    int32_t min_pressure_iterations;
+    float cfl_number;
+    float force_number;
+    float min_dt;
+    float max_dt;
+    float pad;
+};
+
+static_assert(sizeof(SimParams) == 96, "SimParams has to match the std140 block");
+
+} // namespace core
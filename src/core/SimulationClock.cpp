@@ -0,0 +1,91 @@
+#include "./SimulationClock.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace core;
+
+namespace {
+
+// frame time beyond this is dropped, a stalled frame must not trigger a burst of catch up steps
+const double MAX_FRAME_SECONDS = 0.25;
+// weight of the newest frame in the step cost average
+const double STEP_MS_SMOOTHING = 0.1;
+
+} // namespace
+
+SimulationClock::SimulationClock()
+    : mode_(REAL_TIME_CLOCK), max_substeps_(8), render_every_(10), substeps_(0), num_steps_(0),
+      fixed_step_(1.0 / 120.0), time_budget_ms_(12.0), accumulator_(0), step_ms_(0),
+      simulated_time_(0), dropped_time_(0) {}
+
+SimulationClockRef SimulationClock::fixedStep(double seconds) {
+    fixed_step_ = seconds;
+    return thisRef();
+}
+
+SimulationClockRef SimulationClock::timeBudget(double ms) {
+    time_budget_ms_ = ms;
+    return thisRef();
+}
+
+SimulationClockRef SimulationClock::maxSubsteps(int n) {
+    max_substeps_ = std::max(n, 1);
+    return thisRef();
+}
+
+SimulationClockRef SimulationClock::renderEvery(int k) {
+    render_every_ = std::max(k, 1);
+    return thisRef();
+}
+
+/**
+ * Switching modes starts the accumulator over so the throughput run's frames aren't paid back
+ */
+void SimulationClock::setMode(int mode) {
+    if (mode != mode_) {
+        accumulator_ = 0;
+    }
+    mode_ = mode;
+}
+
+/**
+ * Add the frame time to the accumulator and take out whole fixed steps, at most as many as fit
+ * the time budget at the measured cost per step. Time left over once the budget ran out is
+ * dropped, so the simulation slows down instead of falling further behind every frame.
+ */
+int SimulationClock::beginFrame(double frame_seconds) {
+    if (mode_ == THROUGHPUT_CLOCK) {
+        substeps_ = render_every_;
+        return substeps_;
+    }
+
+    const double frame_time = std::min(std::max(frame_seconds, 0.0), MAX_FRAME_SECONDS);
+    dropped_time_ += std::max(frame_seconds, 0.0) - frame_time;
+    accumulator_ += frame_time;
+
+    int budget_steps = max_substeps_;
+    if (step_ms_ > 0) {
+        budget_steps = std::min(budget_steps, std::max(1, int(time_budget_ms_ / step_ms_)));
+    }
+
+    const int due = int(std::floor(accumulator_ / fixed_step_));
+    substeps_ = std::min(due, budget_steps);
+    accumulator_ -= substeps_ * fixed_step_;
+
+    if (substeps_ < due) {
+        // keep the fraction of a step that is still due, drop the rest
+        const double keep = std::fmod(accumulator_, fixed_step_);
+        dropped_time_ += accumulator_ - keep;
+        accumulator_ = keep;
+    }
+    return substeps_;
+}
+
+void SimulationClock::endFrame(int steps, double step_ms) {
+    num_steps_ += steps;
+    simulated_time_ += steps * fixed_step_;
+    if (steps > 0 && step_ms > 0) {
+        step_ms_ = step_ms_ > 0 ? step_ms_ + (step_ms - step_ms_) * STEP_MS_SMOOTHING : step_ms;
+    }
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+
+namespace core {
+
+typedef std::shared_ptr<class SimulationClock> SimulationClockRef;
+
+/**
+ * Decouples simulation steps from rendered frames. In real time mode the frame time is
+ * accumulated and paid out in fixed substeps, as many per frame as the time budget allows.
+ * In throughput mode every frame runs a fixed batch of steps and renders once at its end.
+ */
+class SimulationClock {
+public:
+    enum ClockMode {
+        REAL_TIME_CLOCK = 0,
+        // as many steps as possible, rendering every renderEvery-th step
+        THROUGHPUT_CLOCK = 1,
+    };
+
+    SimulationClock();
+
+    SimulationClockRef fixedStep(double seconds);
+    SimulationClockRef timeBudget(double ms);
+    SimulationClockRef maxSubsteps(int n);
+    SimulationClockRef renderEvery(int k);
+
+    void setMode(int mode);
+    int getMode() { return mode_; }
+
+    // number of steps to run for a frame that took frame_seconds
+    int beginFrame(double frame_seconds);
+    // wall time the frame's steps took, per step, used to fit the next frames into the budget
+    void endFrame(int steps, double step_ms);
+
+    double getFixedStep() { return fixed_step_; }
+    double getStepMs() { return step_ms_; }
+    double getSimulatedTime() { return simulated_time_; }
+    // frame time that was dropped instead of simulated because the budget ran out
+    double getDroppedTime() { return dropped_time_; }
+    int getSubsteps() { return substeps_; }
+    int64_t numSteps() { return num_steps_; }
+
+    static SimulationClockRef create() { return std::make_shared<SimulationClock>(); }
+
+protected:
+    SimulationClockRef thisRef() { return std::make_shared<SimulationClock>(*this); }
+
+    int mode_;
+    int max_substeps_;
+    int render_every_;
+    int substeps_;
+    int64_t num_steps_;
+    double fixed_step_;
+    double time_budget_ms_;
+    double accumulator_;
+    double step_ms_;
+    double simulated_time_;
+    double dropped_time_;
+};
+
+} // namespace core
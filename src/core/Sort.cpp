@@ -2,12 +2,16 @@
 
 using namespace core;
 
-Sort::Sort(): num_items_(0), num_bins_(1) {}
+Sort::Sort()
+    : num_items_(0), num_bins_(1), grid_res_(1), cell_indexing_(grid::ROW_MAJOR_INDEXING),
+      particle_layout_(AOS_LAYOUT), validate_scan_(false), specialize_(false), fused_(false),
+      count_buffer_(0), offset_buffer_(0), sorted_buffer_(0), rank_buffer_(0) {}
 
 Sort::~Sort() {
     glDeleteBuffers(1, &count_buffer_);
     glDeleteBuffers(1, &offset_buffer_);
     glDeleteBuffers(1, &sorted_buffer_);
+    glDeleteBuffers(1, &rank_buffer_);
 }
 
 SortRef Sort::numItems(int n) {
@@ -17,7 +21,18 @@ SortRef Sort::numItems(int n) {
 
 SortRef Sort::gridRes(int r) {
     grid_res_ = r;
-    num_bins_ = int(pow(grid_res_, 3));
+    num_bins_ = grid::numCells(grid_res_, cell_indexing_, num_items_);
+    return thisRef();
+}
+
+SortRef Sort::cellIndexing(int i) {
+    cell_indexing_ = i;
+    num_bins_ = grid::numCells(grid_res_, cell_indexing_, num_items_);
+    return thisRef();
+}
+
+SortRef Sort::particleLayout(int l) {
+    particle_layout_ = l;
     return thisRef();
 }
 
@@ -26,6 +41,21 @@ SortRef Sort::binSize(float s) {
     return thisRef();
 }
 
+SortRef Sort::profiler(ProfilerRef p) {
+    profiler_ = p;
+    return thisRef();
+}
+
+SortRef Sort::population(PopulationRef p) {
+    population_ = p;
+    return thisRef();
+}
+
+SortRef Sort::specialize(bool enabled) {
+    specialize_ = enabled;
+    return thisRef();
+}
+
 SortRef Sort::positionBuffer(gl::SsboRef buffer) {
     position_buffer_ = buffer;
     return thisRef();
@@ -36,7 +66,8 @@ SortRef Sort::positionBuffer(gl::SsboRef buffer) {
  */
 void Sort::prepareGridParticles() {
     util::log("\tcreating grid particles");
-    grid_particles_.resize(int(pow(grid_res_, 3)));
+    grid_particles_.clear();
+    grid_particles_.reserve(grid_res_ * grid_res_ * grid_res_);
     for (int z = 0; z < grid_res_; z++) {
         for (int y = 0; y < grid_res_; y++) {
             for (int x = 0; x < grid_res_; x++) {
@@ -64,8 +95,9 @@ void Sort::prepareGridParticles() {
 /**
  * Prepares shared memory buffers
  */
-void Sort::prepareBuffers() {
+void Sort::prepareBuffers(const uint32_t* offsets) {
     util::log("preparing sort buffers");
+    num_bins_ = grid::numCells(grid_res_, cell_indexing_, num_items_);
 
     util::log("\tcreating count buffer");
     global_count_buffer_ = gl::Ssbo::create(sizeof(int), nullptr, GL_DYNAMIC_STORAGE_BIT);
@@ -73,15 +105,24 @@ void Sort::prepareBuffers() {
     global_count_buffer_->bindBase(8);
 
     util::log("\tcreating count and offset grids");
-    std::vector<uint32_t> zeros(num_items_, 0);
+    std::vector<uint32_t> zeros(std::max(num_items_, num_bins_), 0);
     glCreateBuffers(1, &count_buffer_);
-    glNamedBufferStorage(count_buffer_, num_items_ * sizeof(uint32_t), zeros.data(), 0);
+    glNamedBufferStorage(count_buffer_, num_bins_ * sizeof(uint32_t), zeros.data(), 0);
     glCreateBuffers(1, &offset_buffer_);
-    glNamedBufferStorage(offset_buffer_, num_items_ * sizeof(uint32_t), zeros.data(), 0);
+    glNamedBufferStorage(offset_buffer_, num_bins_ * sizeof(uint32_t),
+                         offsets ? offsets : zeros.data(), 0);
     glCreateBuffers(1, &sorted_buffer_);
     glNamedBufferStorage(sorted_buffer_, num_items_ * sizeof(uint32_t), zeros.data(), 0);
+    glCreateBuffers(1, &rank_buffer_);
+    glNamedBufferStorage(rank_buffer_, num_items_ * sizeof(uvec2), nullptr, 0);
+
+    scan_ = Scan::create()->numItems(num_bins_);
+    scan_->prepareBuffers();
 
-    prepareGridParticles();
+    // the debug grid is dense, skip it when hashing lets the grid outgrow the particles
+    if (cell_indexing_ != grid::HASHED_INDEXING) {
+        prepareGridParticles();
+    }
 
     util::log("\tcreating id map");
     std::vector<uint32_t> sids(num_items_);
@@ -90,7 +131,7 @@ void Sort::prepareBuffers() {
     auto id_format = gl::Texture1d::Format().internalFormat(GL_R32UI);
     id_map_ = gl::Texture1d::create(sids.data(), GL_R32F, num_items_, id_format);
 
-    gl::memoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT);
+    util::memoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT);
 }
 
 /**
@@ -98,24 +139,41 @@ void Sort::prepareBuffers() {
  */
 void Sort::compileShaders() {
     util::log("compiling sort shaders");
+    std::vector<std::string> defines = {grid::indexingDefine(cell_indexing_, num_bins_),
+                                        layout::layoutDefine(particle_layout_)};
+    if (population_) {
+        defines.push_back("DYNAMIC_PARTICLES");
+    }
+    if (specialize_) {
+        defines.push_back(util::constantDefine("GRID_RES", grid_res_));
+    }
 
     util::log("\tcompiling sorter count shader");
-    count_prog_ = util::compileComputeShader("sort/count.comp");
+    count_prog_ = util::compileComputeShader("sort/count.comp", defines);
 
-    util::log("\tcompiling sorter linear scan shader");
-    linear_scan_prog_ = util::compileComputeShader("sort/linearScan.comp");
+    util::log("\tcompiling sorter fused count shader");
+    std::vector<std::string> fused_defines = defines;
+    fused_defines.push_back("LOCAL_HISTOGRAM");
+    fused_count_prog_ = util::compileComputeShader("sort/count.comp", fused_defines);
+
+    scan_->compileShaders();
 
     util::log("\tcompiling sorter reorder shader");
-    reorder_prog_ = util::compileComputeShader("sort/reorder.comp");
+    reorder_prog_ = util::compileComputeShader("sort/reorder.comp", defines);
+
+    util::log("\tcompiling sorter fused reorder shader");
+    fused_reorder_prog_ = util::compileComputeShader("sort/reorder.comp", fused_defines);
 
     util::log("\tcompiling sorter shader");
-    sort_prog_ = util::compileComputeShader("sort/sort.comp");
+    sort_prog_ = util::compileComputeShader("sort/sort.comp", defines);
 
     util::log("\tcompiling render grid shader");
-    render_grid_prog_ = gl::GlslProg::create(gl::GlslProg::Format()
-                                                 .vertex(loadAsset("sort/grid.vert"))
-                                                 .fragment(loadAsset("sort/grid.frag"))
-                                                 .attribLocation("gridID", 0));
+    std::vector<std::string> render_defines = {defines[0]};
+    if (specialize_) {
+        render_defines.push_back(defines.back());
+    }
+    render_grid_prog_ = util::compileRenderShader("sort/grid.vert", "sort/grid.frag",
+                                                  render_defines, {{"gridID", 0}});
 }
 
 /**
@@ -126,29 +184,18 @@ void Sort::clearCount() {
     gl::ScopedBuffer count_buffer(global_count_buffer_);
     glClearBufferData(global_count_buffer_->getTarget(), GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT,
                       &clear_value);
-    gl::memoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+    util::memoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
 }
 
 /**
  * clear counter buffer
  */
 void Sort::clearCountBuffer() {
-    std::vector<uint32_t> initial(num_items_, 0);
+    const std::uint32_t clear_value = 0;
     gl::ScopedBuffer buffer(GL_SHADER_STORAGE_BUFFER, count_buffer_);
     glClearNamedBufferData(count_buffer_, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT,
-                           initial.data());
-    gl::memoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
-}
-
-/**
- * clear offset buffer
- */
-void Sort::clearOffsetBuffer() {
-    std::vector<uint32_t> initial(num_items_, 0);
-    gl::ScopedBuffer buffer(GL_SHADER_STORAGE_BUFFER, count_buffer_);
-    glClearNamedBufferData(offset_buffer_, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT,
-                           initial.data());
-    gl::memoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+                           &clear_value);
+    util::memoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
 }
 
 /**
@@ -159,7 +206,18 @@ void Sort::clearSortedBuffer() {
     gl::ScopedBuffer buffer(GL_SHADER_STORAGE_BUFFER, sorted_buffer_);
     glClearNamedBufferData(sorted_buffer_, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT,
                            initial.data());
-    gl::memoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+    util::memoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+}
+
+/**
+ * Bind the particle positions, the whole buffer for the AOS layout
+ */
+void Sort::bindPositions(GLuint binding, GLuint particle_buffer) {
+    if (particle_layout_ == SOA_LAYOUT) {
+        util::bindParticleStream(binding, particle_buffer, POSITION_STREAM, num_items_);
+    } else {
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, particle_buffer);
+    }
 }
 
 /**
@@ -167,30 +225,50 @@ void Sort::clearSortedBuffer() {
  */
 void Sort::runCountProg(GLuint particle_buffer) {
     gl::ScopedGlslProg prog(count_prog_);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, particle_buffer);
+    bindPositions(0, particle_buffer);
     glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, count_buffer_);
 
     count_prog_->uniform("binSize", bin_size_);
     count_prog_->uniform("numItems", num_items_);
     count_prog_->uniform("gridRes", grid_res_);
+    if (population_) {
+        population_->bindSinks(count_prog_);
+    }
 
     runProg();
-    gl::memoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    util::memoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
 }
 
 /**
- * Run a single shader to scan the counts and compute prefix sums (offsets)
- * PERFORMANCE BOTTLENECK
+ * Run bucket count compute shader with work group histograms, which also ranks each particle
+ * within its bin
  */
-void Sort::runLinearScanProg() {
-    gl::ScopedGlslProg prog(linear_scan_prog_);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, count_buffer_);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, offset_buffer_);
+void Sort::runFusedCountProg(GLuint particle_buffer) {
+    gl::ScopedGlslProg prog(fused_count_prog_);
+    bindPositions(0, particle_buffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, count_buffer_);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, rank_buffer_);
+
+    fused_count_prog_->uniform("binSize", bin_size_);
+    fused_count_prog_->uniform("numItems", num_items_);
+    fused_count_prog_->uniform("gridRes", grid_res_);
+    if (population_) {
+        population_->bindSinks(fused_count_prog_);
+    }
+
+    runProg();
+    util::memoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+}
 
-    linear_scan_prog_->uniform("gridRes", grid_res_);
+/**
+ * Scan the counts in parallel to compute prefix sums (offsets)
+ */
+void Sort::runScanProg() {
+    scan_->run(count_buffer_, offset_buffer_);
 
-    util::runProg(1);
-    gl::memoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    if (validate_scan_) {
+        scan_->check(count_buffer_, offset_buffer_);
+    }
 }
 
 /**
@@ -199,17 +277,45 @@ void Sort::runLinearScanProg() {
 void Sort::runReorderProg(GLuint in_particles, GLuint out_particles) {
     gl::ScopedGlslProg prog(reorder_prog_);
 
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, in_particles);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, out_particles);
+    bindPositions(0, in_particles);
+    bindPositions(1, out_particles);
+    if (particle_layout_ == SOA_LAYOUT) {
+        util::bindParticleStream(4, in_particles, VELOCITY_STREAM, num_items_);
+        util::bindParticleStream(5, out_particles, VELOCITY_STREAM, num_items_);
+    }
     glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, count_buffer_);
     glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, offset_buffer_);
 
     reorder_prog_->uniform("binSize", bin_size_);
     reorder_prog_->uniform("numItems", num_items_);
     reorder_prog_->uniform("gridRes", grid_res_);
+    if (population_) {
+        population_->bindSinks(reorder_prog_);
+    }
 
     runProg();
-    gl::memoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    util::memoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+/**
+ * Run reorder compute shader on the ranks of the fused count, the counts are left as they are
+ */
+void Sort::runFusedReorderProg(GLuint in_particles, GLuint out_particles) {
+    gl::ScopedGlslProg prog(fused_reorder_prog_);
+
+    bindPositions(0, in_particles);
+    bindPositions(1, out_particles);
+    if (particle_layout_ == SOA_LAYOUT) {
+        util::bindParticleStream(4, in_particles, VELOCITY_STREAM, num_items_);
+        util::bindParticleStream(5, out_particles, VELOCITY_STREAM, num_items_);
+    }
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, offset_buffer_);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, rank_buffer_);
+
+    fused_reorder_prog_->uniform("numItems", num_items_);
+
+    runProg();
+    util::memoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
 }
 
 /**
@@ -218,7 +324,7 @@ void Sort::runReorderProg(GLuint in_particles, GLuint out_particles) {
 void Sort::runSortProg(GLuint particle_buffer) {
     gl::ScopedGlslProg prog(sort_prog_);
 
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, particle_buffer);
+    bindPositions(0, particle_buffer);
     glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, count_buffer_);
     glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, offset_buffer_);
     glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, sorted_buffer_);
@@ -228,7 +334,7 @@ void Sort::runSortProg(GLuint particle_buffer) {
     sort_prog_->uniform("gridRes", grid_res_);
 
     runProg();
-    gl::memoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    util::memoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
 }
 
 /**
@@ -252,24 +358,71 @@ void Sort::printGrids() {
  * main logic - sort in_particles and store result in out_particles
  */
 void Sort::run(GLuint in_particles, GLuint out_particles) {
-    clearCountBuffer();
-    runCountProg(in_particles);
+    if (fused_) {
+        runFused(in_particles, out_particles);
+        return;
+    }
+
+    {
+        ScopedTimer timer(profiler_, "Count");
+        clearCountBuffer();
+        runCountProg(in_particles);
+    }
 
-    clearOffsetBuffer();
-    runLinearScanProg();
+    {
+        ScopedTimer timer(profiler_, "Scan");
+        runScanProg();
+    }
     // util::log("counted");
     // printGrids();
 
-    clearCountBuffer();
-    runReorderProg(in_particles, out_particles);
+    {
+        ScopedTimer timer(profiler_, "Reorder");
+        clearCountBuffer();
+        runReorderProg(in_particles, out_particles);
+    }
+
+    if (population_) {
+        population_->count(count_buffer_, offset_buffer_, num_bins_);
+    }
     // util::log("reordered");
     // printGrids();
 }
 
+/**
+ * Like run, but the counts are cleared once and the reorder pass reads the ranks the count
+ * pass wrote, so it neither clears nor touches the counts
+ */
+void Sort::runFused(GLuint in_particles, GLuint out_particles) {
+    {
+        ScopedTimer timer(profiler_, "Count");
+        clearCountBuffer();
+        runFusedCountProg(in_particles);
+    }
+
+    {
+        ScopedTimer timer(profiler_, "Scan");
+        runScanProg();
+    }
+
+    {
+        ScopedTimer timer(profiler_, "Reorder");
+        runFusedReorderProg(in_particles, out_particles);
+    }
+
+    if (population_) {
+        population_->count(count_buffer_, offset_buffer_, num_bins_);
+    }
+}
+
 /**
  * render debugging grid
  */
 void Sort::renderGrid(float size) {
+    if (!grid_buffer_) {
+        return;
+    }
+
     gl::pointSize(10);
 
     gl::ScopedGlslProg render(render_grid_prog_);
@@ -289,3 +442,17 @@ void Sort::renderGrid(float size) {
     gl::context()->setDefaultShaderVars();
     gl::drawArrays(GL_POINTS, 0, int(grid_particles_.size()));
 }
+
+/**
+ * Bytes held by the bin, scan and debug grid buffers
+ */
+size_t Sort::memoryUsage() {
+    size_t bytes = util::bufferSize(count_buffer_) + util::bufferSize(offset_buffer_) +
+                   util::bufferSize(sorted_buffer_) + util::bufferSize(rank_buffer_);
+    for (const auto& buffer : {global_count_buffer_, grid_buffer_}) {
+        if (buffer) {
+            bytes += buffer->getSize();
+        }
+    }
+    return scan_ ? bytes + scan_->memoryUsage() : bytes;
+}
@@ -8,6 +8,10 @@
 #include "cinder/gl/Ssbo.h"
 #include "cinder/gl/gl.h"
 
+#include "./Population.h"
+#include "./Profiler.h"
+#include "./Scan.h"
+#include "./grid.h"
 #include "./util.h"
 
 using namespace ci;
@@ -25,49 +29,73 @@ public:
     SortRef numItems(int n);
     SortRef gridRes(int r);
     SortRef binSize(float s);
+    SortRef profiler(ProfilerRef p);
+    // leave out the particles in its sinks and hand it the surviving count after each run
+    SortRef population(PopulationRef p);
+    // fold gridRes into the shader variants instead of passing it as a uniform
+    SortRef specialize(bool enabled);
+    SortRef cellIndexing(int i);
+    SortRef particleLayout(int l);
     SortRef positionBuffer(gl::SsboRef buffer);
 
-    void prepareBuffers();
+    // offsets of a checkpoint, num_bins_ of them, are uploaded as the initial offset grid
+    void prepareBuffers(const uint32_t* offsets = nullptr);
     void compileShaders();
     void run(GLuint in_particles, GLuint out_particles);
     void renderGrid(float size);
 
+    void setValidateScan(bool v) { validate_scan_ = v; }
+    // count with work group histograms and let the reorder pass take the ranks from the count
+    void setFused(bool f) { fused_ = f; }
+
     GLuint getCountBuffer() { return count_buffer_; }
     GLuint getOffsetBuffer() { return offset_buffer_; }
     GLuint getSortedBuffer() { return sorted_buffer_; }
+    int numBins() { return num_bins_; }
+    size_t memoryUsage();
 
     static SortRef create() { return std::make_shared<Sort>(); }
 
 protected:
     void clearCount();
     void clearCountBuffer();
-    void clearOffsetBuffer();
     void clearSortedBuffer();
+    void bindPositions(GLuint binding, GLuint particle_buffer);
     void printGrids();
     void prepareGridParticles();
 
     void runProg() { util::runProg(int(ceil(float(num_items_) / float(WORK_GROUP_SIZE)))); }
     void runCountProg(GLuint particle_buffer);
-    void runLinearScanProg();
+    void runFusedCountProg(GLuint particle_buffer);
     void runScanProg();
     void runReorderProg(GLuint in_particles, GLuint out_particles);
+    void runFusedReorderProg(GLuint in_particles, GLuint out_particles);
     void runSortProg(GLuint particle_buffer);
+    void runFused(GLuint in_particles, GLuint out_particles);
 
     SortRef thisRef() { return std::make_shared<Sort>(*this); }
 
-    int num_items_, num_bins_, grid_res_;
+    int num_items_, num_bins_, grid_res_, cell_indexing_, particle_layout_;
     float bin_size_;
+    bool validate_scan_;
+    bool specialize_;
+    bool fused_;
 
     std::vector<ivec4> grid_particles_;
 
-    gl::GlslProgRef count_prog_, linear_scan_prog_;
-    gl::GlslProgRef reorder_prog_, sort_prog_, render_grid_prog_;
+    ScanRef scan_;
+    ProfilerRef profiler_;
+    PopulationRef population_;
+
+    gl::GlslProgRef count_prog_, fused_count_prog_;
+    gl::GlslProgRef reorder_prog_, fused_reorder_prog_, sort_prog_, render_grid_prog_;
     gl::SsboRef position_buffer_, global_count_buffer_, grid_buffer_;
     gl::Texture1dRef id_map_;
     gl::VboRef grid_ids_vbo_;
     gl::VaoRef grid_attributes_;
 
-    GLuint count_buffer_, offset_buffer_, sorted_buffer_;
+    // cell and rank of every particle from the fused count
+    GLuint count_buffer_, offset_buffer_, sorted_buffer_, rank_buffer_;
 };
 
 } // namespace core
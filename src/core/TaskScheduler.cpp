@@ -0,0 +1,217 @@
+#include "./TaskScheduler.h"
+
+#include <algorithm>
+#include <chrono>
+
+using namespace core;
+
+namespace {
+
+typedef std::chrono::high_resolution_clock Clock;
+
+// set while a thread runs tasks so nested runs don't wait on the pool they are part of
+thread_local bool in_task = false;
+thread_local int current_worker = 0;
+
+double elapsedMs(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+} // namespace
+
+TaskScheduler::TaskScheduler(int num_threads)
+    : num_threads_(std::max(1, num_threads)), stopping_(false), generation_(0), wall_ms_(0),
+      active_workers_(0), remaining_(0), task_(nullptr) {
+    stats_.resize(num_threads_);
+    for (int w = 0; w < num_threads_; w++) {
+        queues_.emplace_back(new Queue());
+    }
+}
+
+TaskScheduler::~TaskScheduler() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    wake_.notify_all();
+    for (auto& thread : threads_) {
+        thread.join();
+    }
+}
+
+/**
+ * Threads are only started on the first run so unused schedulers stay cheap
+ */
+void TaskScheduler::start() {
+    if (!threads_.empty()) {
+        return;
+    }
+
+    for (int w = 1; w < num_threads_; w++) {
+        threads_.emplace_back(&TaskScheduler::workerLoop, this, w);
+    }
+}
+
+void TaskScheduler::run(int num_tasks, const std::function<void(int, int)>& task) {
+    if (num_tasks <= 0) {
+        return;
+    }
+
+    if (in_task) {
+        for (int i = 0; i < num_tasks; i++) {
+            task(i, current_worker);
+        }
+        return;
+    }
+
+    const auto start_time = Clock::now();
+    start();
+
+    for (int w = 0; w < num_threads_; w++) {
+        Queue& queue = *queues_[w];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.tasks.clear();
+        const int begin = int(int64_t(num_tasks) * w / num_threads_);
+        const int end = int(int64_t(num_tasks) * (w + 1) / num_threads_);
+        for (int i = begin; i < end; i++) {
+            queue.tasks.push_back(i);
+        }
+    }
+
+    remaining_ = num_tasks;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        task_ = &task;
+        active_workers_ = num_threads_ - 1;
+        generation_++;
+    }
+    wake_.notify_all();
+
+    work(0);
+
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_.wait(lock, [this]() { return active_workers_ == 0; });
+        task_ = nullptr;
+    }
+    wall_ms_ += elapsedMs(start_time);
+}
+
+void TaskScheduler::workerLoop(int worker) {
+    uint64_t seen = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            wake_.wait(lock, [&]() { return stopping_ || generation_ != seen; });
+            if (stopping_) {
+                return;
+            }
+            seen = generation_;
+        }
+
+        work(worker);
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (--active_workers_ == 0) {
+            done_.notify_all();
+        }
+    }
+}
+
+/**
+ * Run tasks from the own queue, then from the others', until every task of the run is done
+ */
+void TaskScheduler::work(int worker) {
+    in_task = true;
+    current_worker = worker;
+    WorkerStats& stats = stats_[worker];
+
+    while (remaining_ > 0) {
+        int task = 0;
+        bool stolen = false;
+        if (!pop(worker, task)) {
+            if (!steal(worker, task)) {
+                // the last tasks are still running elsewhere
+                std::this_thread::yield();
+                continue;
+            }
+            stolen = true;
+        }
+
+        const auto start_time = Clock::now();
+        (*task_)(task, worker);
+        stats.busy_ms += elapsedMs(start_time);
+        stats.tasks++;
+        if (stolen) {
+            stats.steals++;
+        }
+        remaining_--;
+    }
+
+    in_task = false;
+}
+
+bool TaskScheduler::pop(int worker, int& task) {
+    Queue& queue = *queues_[worker];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.tasks.empty()) {
+        return false;
+    }
+
+    task = queue.tasks.front();
+    queue.tasks.pop_front();
+    return true;
+}
+
+/**
+ * Take the last task of the next worker that has any, the owner works from the other end
+ */
+bool TaskScheduler::steal(int worker, int& task) {
+    for (int k = 1; k < num_threads_; k++) {
+        Queue& queue = *queues_[(worker + k) % num_threads_];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (!queue.tasks.empty()) {
+            task = queue.tasks.back();
+            queue.tasks.pop_back();
+            return true;
+        }
+    }
+    return false;
+}
+
+double TaskScheduler::meanUtilization() {
+    if (wall_ms_ <= 0) {
+        return 0;
+    }
+
+    double busy_ms = 0;
+    for (const auto& stats : stats_) {
+        busy_ms += stats.busy_ms;
+    }
+    return busy_ms / (wall_ms_ * num_threads_);
+}
+
+double TaskScheduler::minUtilization() {
+    if (wall_ms_ <= 0) {
+        return 0;
+    }
+
+    double busy_ms = stats_.front().busy_ms;
+    for (const auto& stats : stats_) {
+        busy_ms = std::min(busy_ms, stats.busy_ms);
+    }
+    return busy_ms / wall_ms_;
+}
+
+uint64_t TaskScheduler::numSteals() {
+    uint64_t steals = 0;
+    for (const auto& stats : stats_) {
+        steals += stats.steals;
+    }
+    return steals;
+}
+
+void TaskScheduler::resetStats() {
+    stats_.assign(num_threads_, WorkerStats());
+    wall_ms_ = 0;
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace core {
+
+typedef std::shared_ptr<class TaskScheduler> TaskSchedulerRef;
+
+/**
+ * Time spent and tasks run by one worker since the last resetStats
+ */
+struct WorkerStats {
+    WorkerStats() : busy_ms(0), tasks(0), steals(0) {}
+    double busy_ms;
+    uint64_t tasks;
+    // tasks taken from another worker's queue
+    uint64_t steals;
+};
+
+/**
+ * Work stealing pool of persistent threads. Each run splits its tasks into one contiguous block
+ * per worker, workers pop from the front of their own queue and steal from the back of the
+ * others' once it runs dry. The calling thread takes part as worker 0.
+ */
+class TaskScheduler {
+public:
+    explicit TaskScheduler(int num_threads);
+    ~TaskScheduler();
+
+    TaskScheduler(const TaskScheduler&) = delete;
+    TaskScheduler& operator=(const TaskScheduler&) = delete;
+
+    int numThreads() { return num_threads_; }
+
+    // calls task(index, worker) for every index in [0, num_tasks) and waits for all of them,
+    // runs serially when called from inside a task
+    void run(int num_tasks, const std::function<void(int, int)>& task);
+
+    const std::vector<WorkerStats>& getStats() { return stats_; }
+    // wall clock time spent in run since the last resetStats
+    double getWallMs() { return wall_ms_; }
+    // busy time of each worker over the wall time, 1 is perfectly balanced
+    double meanUtilization();
+    double minUtilization();
+    uint64_t numSteals();
+    void resetStats();
+
+    static TaskSchedulerRef create(int num_threads) {
+        return std::make_shared<TaskScheduler>(num_threads);
+    }
+
+protected:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<int> tasks;
+    };
+
+    void start();
+    void workerLoop(int worker);
+    void work(int worker);
+    bool pop(int worker, int& task);
+    bool steal(int worker, int& task);
+
+    int num_threads_;
+    bool stopping_;
+    uint64_t generation_;
+    double wall_ms_;
+
+    std::vector<std::thread> threads_;
+    std::vector<std::unique_ptr<Queue>> queues_;
+    std::vector<WorkerStats> stats_;
+
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable done_;
+    int active_workers_;
+    std::atomic<int> remaining_;
+    const std::function<void(int, int)>* task_;
+};
+
+} // namespace core
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+
+#include <glm/glm.hpp>
+
+namespace core {
+
+namespace grid {
+
+/**
+ * How a bin coordinate maps to its index in the count and offset buffers
+ */
+enum CellIndexing {
+    ROW_MAJOR_INDEXING = 0,
+    // Z-order curve, neighboring bins end up close together in the sorted particle buffer
+    MORTON_INDEXING = 1,
+    // spatial hash into a table sized by the particle count rather than the grid volume,
+    // bins sharing a slot are told apart by each particle's own coordinate
+    HASHED_INDEXING = 2,
+};
+
+// spread the lower 10 bits of v so there are two zero bits between each
+inline uint32_t expandBits(uint32_t v) {
+    v &= 0x000003ff;
+    v = (v | (v << 16)) & 0xff0000ff;
+    v = (v | (v << 8)) & 0x0300f00f;
+    v = (v | (v << 4)) & 0x030c30c3;
+    v = (v | (v << 2)) & 0x09249249;
+    return v;
+}
+
+inline uint32_t mortonIndex(const glm::ivec3& c) {
+    return expandBits(uint32_t(c.x)) | (expandBits(uint32_t(c.y)) << 1) |
+           (expandBits(uint32_t(c.z)) << 2);
+}
+
+// Teschner et al. 2003, table_size must be a power of two
+inline uint32_t hashIndex(const glm::ivec3& c, uint32_t table_size) {
+    return ((uint32_t(c.x) * 73856093u) ^ (uint32_t(c.y) * 19349663u) ^
+            (uint32_t(c.z) * 83492791u)) &
+           (table_size - 1);
+}
+
+inline int nextPowerOfTwo(int n) {
+    int p = 1;
+    while (p < n) {
+        p <<= 1;
+    }
+    return p;
+}
+
+// num_cells is only used by the hashed indexing, see numCells()
+inline uint32_t cellIndex(const glm::ivec3& c, int grid_res, int indexing, int num_cells = 0) {
+    if (indexing == MORTON_INDEXING) {
+        return mortonIndex(c);
+    } else if (indexing == HASHED_INDEXING) {
+        return hashIndex(c, uint32_t(num_cells));
+    }
+    return uint32_t(c.z * grid_res * grid_res + c.y * grid_res + c.x);
+}
+
+// Morton keys span the next power of two cube, a hash table has a slot per particle
+// since there can't be more occupied bins than that
+inline int numCells(int grid_res, int indexing, int num_particles = 0) {
+    if (indexing == MORTON_INDEXING) {
+        const int res = nextPowerOfTwo(grid_res);
+        return res * res * res;
+    } else if (indexing == HASHED_INDEXING) {
+        return nextPowerOfTwo(std::max(num_particles, 1));
+    }
+    return grid_res * grid_res * grid_res;
+}
+
+// shader define selecting the matching cellIndex() in common/grid.glsl,
+// the hashed indexing carries the table size as its value
+inline std::string indexingDefine(int indexing, int num_cells = 0) {
+    if (indexing == MORTON_INDEXING) {
+        return "MORTON_INDEXING";
+    } else if (indexing == HASHED_INDEXING) {
+        return "HASHED_INDEXING " + std::to_string(num_cells);
+    }
+    return "ROW_MAJOR_INDEXING";
+}
+
+inline std::string indexingName(int indexing) {
+    if (indexing == MORTON_INDEXING) {
+        return "morton";
+    } else if (indexing == HASHED_INDEXING) {
+        return "hashed";
+    }
+    return "row-major";
+}
+
+} // namespace grid
+
+} // namespace core
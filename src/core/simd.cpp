@@ -0,0 +1,221 @@
+#include "./simd.h"
+
+#include <cmath>
+
+#ifdef SIMD_X86
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+using namespace core;
+
+namespace {
+
+struct CpuFeatures {
+    CpuFeatures() : avx2(false), avx512(false) {}
+    bool avx2;
+    bool avx512;
+};
+
+/**
+ * Query cpuid once, the AVX states also have to be enabled by the OS in XCR0
+ */
+CpuFeatures queryFeatures() {
+    CpuFeatures features;
+#if defined(SIMD_X86) && defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) {
+        return features;
+    }
+
+    __cpuid(info, 1);
+    const bool fma = (info[2] & (1 << 12)) != 0;
+    const bool osxsave = (info[2] & (1 << 27)) != 0;
+    if (!osxsave) {
+        return features;
+    }
+
+    const unsigned long long xcr0 = _xgetbv(0);
+    __cpuidex(info, 7, 0);
+    // XMM and YMM state, then opmask and ZMM state
+    features.avx2 = fma && (info[1] & (1 << 5)) != 0 && (xcr0 & 0x6) == 0x6;
+    features.avx512 = (info[1] & (1 << 16)) != 0 && (xcr0 & 0xe6) == 0xe6;
+#elif defined(SIMD_X86)
+    __builtin_cpu_init();
+    features.avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    features.avx512 = __builtin_cpu_supports("avx512f");
+#endif
+    return features;
+}
+
+const CpuFeatures& cpuFeatures() {
+    static const CpuFeatures features = queryFeatures();
+    return features;
+}
+
+// Mirrors cellCoord() and inBin() of CpuSolver for one coordinate
+bool inBin(const simd::Streams& s, const simd::KernelParams& k, uint32_t j,
+           const glm::ivec3& bin) {
+    const glm::ivec3 c = glm::clamp(glm::ivec3(glm::vec3(s.x[j], s.y[j], s.z[j]) / k.bin_size),
+                                    glm::ivec3(0), glm::ivec3(k.grid_res - 1));
+    return c == bin;
+}
+
+} // namespace
+
+void simd::Streams::resize(int n) {
+    num_particles = n;
+    for (auto* stream : {&x, &y, &z, &vx, &vy, &vz, &density, &pressure}) {
+        stream->assign(n + MAX_LANES, 0.0f);
+    }
+}
+
+void simd::Streams::assign(const std::vector<Particle>& particles, int begin, int end) {
+    for (int i = begin; i < end; i++) {
+        const Particle& p = particles[i];
+        x[i] = p.position.x;
+        y[i] = p.position.y;
+        z[i] = p.position.z;
+        vx[i] = p.velocity.x;
+        vy[i] = p.velocity.y;
+        vz[i] = p.velocity.z;
+        density[i] = p.density;
+        pressure[i] = p.pressure;
+    }
+}
+
+bool simd::supported(int isa) {
+    switch (isa) {
+    case SCALAR_KERNELS:
+        return true;
+    case AVX2_KERNELS:
+        return cpuFeatures().avx2;
+    case AVX512_KERNELS:
+        return cpuFeatures().avx512;
+    default:
+        return false;
+    }
+}
+
+int simd::detect() {
+    if (supported(AVX512_KERNELS)) {
+        return AVX512_KERNELS;
+    }
+    return supported(AVX2_KERNELS) ? AVX2_KERNELS : SCALAR_KERNELS;
+}
+
+int simd::resolve(int isa) {
+    if (isa == AUTO_KERNELS) {
+        return detect();
+    }
+    return supported(isa) ? isa : SCALAR_KERNELS;
+}
+
+simd::Kernels simd::kernels(int isa) {
+    Kernels kernels;
+    switch (resolve(isa)) {
+    case AVX512_KERNELS:
+        kernels.density = densityAvx512;
+        kernels.forces = forcesAvx512;
+        break;
+    case AVX2_KERNELS:
+        kernels.density = densityAvx2;
+        kernels.forces = forcesAvx2;
+        break;
+    default:
+        kernels.density = densityScalar;
+        kernels.forces = forcesScalar;
+    }
+    return kernels;
+}
+
+std::string simd::name(int isa) {
+    switch (isa) {
+    case AUTO_KERNELS:
+        return "auto";
+    case AVX2_KERNELS:
+        return "avx2";
+    case AVX512_KERNELS:
+        return "avx512";
+    default:
+        return "scalar";
+    }
+}
+
+int simd::fromName(const std::string& name) {
+    for (int isa = AUTO_KERNELS; isa < NUM_KERNEL_ISAS; isa++) {
+        if (simd::name(isa) == name) {
+            return isa;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Mirrors the neighbor loop of density.comp
+ */
+float simd::densityScalar(const Streams& s, const KernelParams& k, uint32_t i, uint32_t first,
+                          uint32_t last, const glm::ivec3& bin) {
+    const float h = k.kernel_radius;
+    const glm::vec3 p(s.x[i], s.y[i], s.z[i]);
+    float density = 0;
+
+    for (uint32_t j = first; j < last; j++) {
+        if (j == i || (k.check_bin && !inBin(s, k, j, bin))) {
+            continue;
+        }
+
+        const float dist = glm::length(p - glm::vec3(s.x[j], s.y[j], s.z[j]));
+        if (dist >= h) {
+            continue;
+        }
+
+        // Equation (10) from Harada
+        density += k.particle_mass * std::pow(h * h - dist * dist, 3.0f) * k.poly6_kernel_const;
+    }
+
+    return density;
+}
+
+/**
+ * Mirrors the neighbor loop of update.comp
+ */
+uint32_t simd::forcesScalar(const Streams& s, const KernelParams& k, uint32_t i, uint32_t first,
+                            uint32_t last, const glm::ivec3& bin, glm::vec3& pressure_force,
+                            glm::vec3& viscosity_force) {
+    const float m = k.particle_mass;
+    const float h = k.kernel_radius;
+    const glm::vec3 p(s.x[i], s.y[i], s.z[i]);
+    const glm::vec3 v(s.vx[i], s.vy[i], s.vz[i]);
+    uint32_t num_pairs = 0;
+
+    for (uint32_t j = first; j < last; j++) {
+        if (j == i || (k.check_bin && !inBin(s, k, j, bin))) {
+            continue;
+        }
+
+        const glm::vec3 r = p - glm::vec3(s.x[j], s.y[j], s.z[j]);
+        const float dist = glm::length(r);
+        if (dist >= h) {
+            continue;
+        }
+        num_pairs++;
+
+        // Equation (6) and (8) from Harada
+        const float pressure = (s.pressure[i] + s.pressure[j]) / (2.0f * s.density[j]);
+        if (pressure > 0) {
+            const float d = dist + 1e-16f;
+            pressure_force -=
+                m * pressure * std::pow(h - d, 2.0f) * (r / d) * k.spiky_kernel_const;
+        }
+
+        // Equation (7) and (9) from Harada
+        const glm::vec3 velocity_diff = glm::vec3(s.vx[j], s.vy[j], s.vz[j]) - v;
+        viscosity_force +=
+            m * (velocity_diff / s.density[j]) * (h - dist) * k.viscosity_kernel_const;
+    }
+
+    return num_pairs;
+}
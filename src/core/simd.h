@@ -0,0 +1,125 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "./Particle.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define SIMD_X86 1
+#endif
+
+namespace core {
+
+namespace simd {
+
+/**
+ * Instruction sets of the CPU neighbor kernels, picked at runtime
+ */
+enum KernelIsa {
+    // best supported by the running CPU
+    AUTO_KERNELS = -1,
+    SCALAR_KERNELS = 0,
+    // 8 neighbor candidates per iteration, needs AVX2 and FMA
+    AVX2_KERNELS = 1,
+    // 16 neighbor candidates per iteration, needs AVX-512F
+    AVX512_KERNELS = 2,
+    NUM_KERNEL_ISAS,
+};
+
+// lanes of the widest kernel, the streams are padded by this much so full width loads past the
+// last particle stay in bounds
+const int MAX_LANES = 16;
+
+/**
+ * Sorted particle state split into one float array per component so a bin's candidates can be
+ * loaded a vector at a time
+ */
+struct Streams {
+    Streams() : num_particles(0) {}
+
+    std::vector<float> x, y, z;
+    std::vector<float> vx, vy, vz;
+    std::vector<float> density, pressure;
+
+    int num_particles;
+
+    int size() const { return num_particles; }
+    void resize(int n);
+    // copies particles [begin, end), resize first so ranges can be filled in parallel
+    void assign(const std::vector<Particle>& particles, int begin, int end);
+};
+
+/**
+ * Constants of the density and force sums, the CPU counterpart of the shader uniforms they use
+ */
+struct KernelParams {
+    float particle_mass;
+    float kernel_radius;
+    float poly6_kernel_const;
+    float spiky_kernel_const;
+    float viscosity_kernel_const;
+    // hashed bins hold particles of every cell sharing the slot, test each candidate's cell
+    bool check_bin;
+    float bin_size;
+    int grid_res;
+};
+
+/**
+ * Sum of m * poly6 over the particles [first, last) of bin within the kernel radius of
+ * particle i, not counting i itself
+ */
+typedef float (*DensityKernel)(const Streams& s, const KernelParams& k, uint32_t i,
+                               uint32_t first, uint32_t last, const glm::ivec3& bin);
+
+/**
+ * Adds the pressure and viscosity forces of the particles [first, last) of bin on particle i,
+ * returns the number of interacting pairs
+ */
+typedef uint32_t (*ForceKernel)(const Streams& s, const KernelParams& k, uint32_t i,
+                                uint32_t first, uint32_t last, const glm::ivec3& bin,
+                                glm::vec3& pressure_force, glm::vec3& viscosity_force);
+
+struct Kernels {
+    DensityKernel density;
+    ForceKernel forces;
+};
+
+bool supported(int isa);
+
+// best supported instruction set
+int detect();
+
+// resolves AUTO_KERNELS and falls back to scalar for unsupported instruction sets
+int resolve(int isa);
+
+Kernels kernels(int isa);
+
+std::string name(int isa);
+
+// -1 for unknown names, "auto" maps to AUTO_KERNELS
+int fromName(const std::string& name);
+
+// per instruction set implementations, only call the ones supported() allows
+float densityScalar(const Streams& s, const KernelParams& k, uint32_t i, uint32_t first,
+                    uint32_t last, const glm::ivec3& bin);
+uint32_t forcesScalar(const Streams& s, const KernelParams& k, uint32_t i, uint32_t first,
+                      uint32_t last, const glm::ivec3& bin, glm::vec3& pressure_force,
+                      glm::vec3& viscosity_force);
+float densityAvx2(const Streams& s, const KernelParams& k, uint32_t i, uint32_t first,
+                  uint32_t last, const glm::ivec3& bin);
+uint32_t forcesAvx2(const Streams& s, const KernelParams& k, uint32_t i, uint32_t first,
+                    uint32_t last, const glm::ivec3& bin, glm::vec3& pressure_force,
+                    glm::vec3& viscosity_force);
+float densityAvx512(const Streams& s, const KernelParams& k, uint32_t i, uint32_t first,
+                    uint32_t last, const glm::ivec3& bin);
+uint32_t forcesAvx512(const Streams& s, const KernelParams& k, uint32_t i, uint32_t first,
+                      uint32_t last, const glm::ivec3& bin, glm::vec3& pressure_force,
+                      glm::vec3& viscosity_force);
+
+} // namespace simd
+
+} // namespace core
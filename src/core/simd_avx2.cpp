@@ -0,0 +1,179 @@
+/**
+ * AVX2 neighbor kernels, 8 candidates per iteration. Built with AVX2 and FMA code generation
+ * enabled for this file only, callers must check simd::supported(AVX2_KERNELS) first.
+ */
+#include "./simd.h"
+
+#ifdef SIMD_X86
+
+#include <immintrin.h>
+
+using namespace core;
+
+namespace {
+
+const int LANES = 8;
+
+int countLanes(int bits) {
+    int count = 0;
+    for (; bits != 0; bits &= bits - 1) {
+        count++;
+    }
+    return count;
+}
+
+float horizontalSum(__m256 v) {
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+    return _mm_cvtss_f32(sum);
+}
+
+/**
+ * Lanes of candidates j..j+7 that are in [j, last) and not particle i
+ */
+__m256 candidateMask(uint32_t j, uint32_t i, uint32_t last) {
+    const __m256i index = _mm256_add_epi32(_mm256_set1_epi32(int(j)),
+                                           _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+    const __m256i in_range = _mm256_cmpgt_epi32(_mm256_set1_epi32(int(last)), index);
+    const __m256i self = _mm256_cmpeq_epi32(index, _mm256_set1_epi32(int(i)));
+    return _mm256_castsi256_ps(_mm256_andnot_si256(self, in_range));
+}
+
+__m256 axisInBin(__m256 position, const simd::KernelParams& k, int bin) {
+    __m256i cell = _mm256_cvttps_epi32(_mm256_div_ps(position, _mm256_set1_ps(k.bin_size)));
+    cell = _mm256_max_epi32(_mm256_min_epi32(cell, _mm256_set1_epi32(k.grid_res - 1)),
+                            _mm256_setzero_si256());
+    return _mm256_castsi256_ps(_mm256_cmpeq_epi32(cell, _mm256_set1_epi32(bin)));
+}
+
+/**
+ * Vector version of inBin(), lanes whose particle lies in the cell bin
+ */
+__m256 binMask(const simd::Streams& s, const simd::KernelParams& k, uint32_t j,
+               const glm::ivec3& bin) {
+    return _mm256_and_ps(_mm256_and_ps(axisInBin(_mm256_loadu_ps(&s.x[j]), k, bin.x),
+                                       axisInBin(_mm256_loadu_ps(&s.y[j]), k, bin.y)),
+                         axisInBin(_mm256_loadu_ps(&s.z[j]), k, bin.z));
+}
+
+} // namespace
+
+float simd::densityAvx2(const Streams& s, const KernelParams& k, uint32_t i, uint32_t first,
+                        uint32_t last, const glm::ivec3& bin) {
+    const __m256 px = _mm256_set1_ps(s.x[i]);
+    const __m256 py = _mm256_set1_ps(s.y[i]);
+    const __m256 pz = _mm256_set1_ps(s.z[i]);
+    const __m256 h2 = _mm256_set1_ps(k.kernel_radius * k.kernel_radius);
+    __m256 sum = _mm256_setzero_ps();
+
+    for (uint32_t j = first; j < last; j += LANES) {
+        const __m256 dx = _mm256_sub_ps(px, _mm256_loadu_ps(&s.x[j]));
+        const __m256 dy = _mm256_sub_ps(py, _mm256_loadu_ps(&s.y[j]));
+        const __m256 dz = _mm256_sub_ps(pz, _mm256_loadu_ps(&s.z[j]));
+        const __m256 r2 =
+            _mm256_fmadd_ps(dx, dx, _mm256_fmadd_ps(dy, dy, _mm256_mul_ps(dz, dz)));
+
+        __m256 mask = _mm256_and_ps(candidateMask(j, i, last),
+                                    _mm256_cmp_ps(r2, h2, _CMP_LT_OQ));
+        if (k.check_bin) {
+            mask = _mm256_and_ps(mask, binMask(s, k, j, bin));
+        }
+
+        // Equation (10) from Harada without the constants, (h^2 - r^2)^3
+        const __m256 w = _mm256_sub_ps(h2, r2);
+        sum = _mm256_add_ps(sum, _mm256_and_ps(mask, _mm256_mul_ps(_mm256_mul_ps(w, w), w)));
+    }
+
+    return k.particle_mass * k.poly6_kernel_const * horizontalSum(sum);
+}
+
+uint32_t simd::forcesAvx2(const Streams& s, const KernelParams& k, uint32_t i, uint32_t first,
+                          uint32_t last, const glm::ivec3& bin, glm::vec3& pressure_force,
+                          glm::vec3& viscosity_force) {
+    const __m256 px = _mm256_set1_ps(s.x[i]);
+    const __m256 py = _mm256_set1_ps(s.y[i]);
+    const __m256 pz = _mm256_set1_ps(s.z[i]);
+    const __m256 vx = _mm256_set1_ps(s.vx[i]);
+    const __m256 vy = _mm256_set1_ps(s.vy[i]);
+    const __m256 vz = _mm256_set1_ps(s.vz[i]);
+    const __m256 pressure_i = _mm256_set1_ps(s.pressure[i]);
+    const __m256 h = _mm256_set1_ps(k.kernel_radius);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 half = _mm256_set1_ps(0.5f);
+    const __m256 epsilon = _mm256_set1_ps(1e-16f);
+
+    __m256 pfx = zero, pfy = zero, pfz = zero;
+    __m256 vfx = zero, vfy = zero, vfz = zero;
+    uint32_t num_pairs = 0;
+
+    for (uint32_t j = first; j < last; j += LANES) {
+        const __m256 rx = _mm256_sub_ps(px, _mm256_loadu_ps(&s.x[j]));
+        const __m256 ry = _mm256_sub_ps(py, _mm256_loadu_ps(&s.y[j]));
+        const __m256 rz = _mm256_sub_ps(pz, _mm256_loadu_ps(&s.z[j]));
+        const __m256 r2 =
+            _mm256_fmadd_ps(rx, rx, _mm256_fmadd_ps(ry, ry, _mm256_mul_ps(rz, rz)));
+        const __m256 dist = _mm256_sqrt_ps(r2);
+
+        __m256 mask = _mm256_and_ps(candidateMask(j, i, last),
+                                    _mm256_cmp_ps(dist, h, _CMP_LT_OQ));
+        if (k.check_bin) {
+            mask = _mm256_and_ps(mask, binMask(s, k, j, bin));
+        }
+
+        const int bits = _mm256_movemask_ps(mask);
+        if (bits == 0) {
+            continue;
+        }
+        num_pairs += uint32_t(countLanes(bits));
+
+        // masked lanes may divide by the zero density padding, the masks clear them
+        const __m256 inv_density =
+            _mm256_div_ps(_mm256_set1_ps(1.0f), _mm256_loadu_ps(&s.density[j]));
+
+        // Equation (6) and (8) from Harada
+        const __m256 pressure = _mm256_mul_ps(
+            _mm256_mul_ps(_mm256_add_ps(pressure_i, _mm256_loadu_ps(&s.pressure[j])), half),
+            inv_density);
+        const __m256 pressure_mask =
+            _mm256_and_ps(mask, _mm256_cmp_ps(pressure, zero, _CMP_GT_OQ));
+        const __m256 d = _mm256_add_ps(dist, epsilon);
+        const __m256 hd = _mm256_sub_ps(h, d);
+        const __m256 spiky = _mm256_and_ps(
+            pressure_mask, _mm256_div_ps(_mm256_mul_ps(_mm256_mul_ps(hd, hd), pressure), d));
+        pfx = _mm256_fmadd_ps(spiky, rx, pfx);
+        pfy = _mm256_fmadd_ps(spiky, ry, pfy);
+        pfz = _mm256_fmadd_ps(spiky, rz, pfz);
+
+        // Equation (7) and (9) from Harada
+        const __m256 viscosity =
+            _mm256_and_ps(mask, _mm256_mul_ps(_mm256_sub_ps(h, dist), inv_density));
+        vfx = _mm256_fmadd_ps(viscosity, _mm256_sub_ps(_mm256_loadu_ps(&s.vx[j]), vx), vfx);
+        vfy = _mm256_fmadd_ps(viscosity, _mm256_sub_ps(_mm256_loadu_ps(&s.vy[j]), vy), vfy);
+        vfz = _mm256_fmadd_ps(viscosity, _mm256_sub_ps(_mm256_loadu_ps(&s.vz[j]), vz), vfz);
+    }
+
+    const float m = k.particle_mass;
+    pressure_force -= m * k.spiky_kernel_const *
+                      glm::vec3(horizontalSum(pfx), horizontalSum(pfy), horizontalSum(pfz));
+    viscosity_force += m * k.viscosity_kernel_const *
+                       glm::vec3(horizontalSum(vfx), horizontalSum(vfy), horizontalSum(vfz));
+    return num_pairs;
+}
+
+#else
+
+using namespace core;
+
+float simd::densityAvx2(const Streams& s, const KernelParams& k, uint32_t i, uint32_t first,
+                        uint32_t last, const glm::ivec3& bin) {
+    return densityScalar(s, k, i, first, last, bin);
+}
+
+uint32_t simd::forcesAvx2(const Streams& s, const KernelParams& k, uint32_t i, uint32_t first,
+                          uint32_t last, const glm::ivec3& bin, glm::vec3& pressure_force,
+                          glm::vec3& viscosity_force) {
+    return forcesScalar(s, k, i, first, last, bin, pressure_force, viscosity_force);
+}
+
+#endif
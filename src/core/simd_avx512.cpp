@@ -0,0 +1,171 @@
+/**
+ * AVX-512 neighbor kernels, 16 candidates per iteration with the rejected lanes kept in mask
+ * registers. Built with AVX-512F code generation enabled for this file only, callers must check
+ * simd::supported(AVX512_KERNELS) first.
+ */
+#include "./simd.h"
+
+#ifdef SIMD_X86
+
+#include <immintrin.h>
+
+using namespace core;
+
+namespace {
+
+const int LANES = 16;
+
+int countLanes(__mmask16 bits) {
+    int count = 0;
+    for (unsigned b = bits; b != 0; b &= b - 1) {
+        count++;
+    }
+    return count;
+}
+
+/**
+ * Lanes of candidates j..j+15 that are in [j, last) and not particle i
+ */
+__mmask16 candidateMask(uint32_t j, uint32_t i, uint32_t last) {
+    const __m512i index = _mm512_add_epi32(
+        _mm512_set1_epi32(int(j)),
+        _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+    const __mmask16 in_range = _mm512_cmplt_epi32_mask(index, _mm512_set1_epi32(int(last)));
+    return _mm512_mask_cmpneq_epi32_mask(in_range, index, _mm512_set1_epi32(int(i)));
+}
+
+__mmask16 axisInBin(__mmask16 mask, __m512 position, const simd::KernelParams& k, int bin) {
+    __m512i cell = _mm512_cvttps_epi32(_mm512_div_ps(position, _mm512_set1_ps(k.bin_size)));
+    cell = _mm512_max_epi32(_mm512_min_epi32(cell, _mm512_set1_epi32(k.grid_res - 1)),
+                            _mm512_setzero_si512());
+    return _mm512_mask_cmpeq_epi32_mask(mask, cell, _mm512_set1_epi32(bin));
+}
+
+/**
+ * Vector version of inBin(), clears the lanes of mask whose particle is outside the cell bin
+ */
+__mmask16 binMask(__mmask16 mask, const simd::Streams& s, const simd::KernelParams& k,
+                  uint32_t j, const glm::ivec3& bin) {
+    mask = axisInBin(mask, _mm512_loadu_ps(&s.x[j]), k, bin.x);
+    mask = axisInBin(mask, _mm512_loadu_ps(&s.y[j]), k, bin.y);
+    return axisInBin(mask, _mm512_loadu_ps(&s.z[j]), k, bin.z);
+}
+
+} // namespace
+
+float simd::densityAvx512(const Streams& s, const KernelParams& k, uint32_t i, uint32_t first,
+                          uint32_t last, const glm::ivec3& bin) {
+    const __m512 px = _mm512_set1_ps(s.x[i]);
+    const __m512 py = _mm512_set1_ps(s.y[i]);
+    const __m512 pz = _mm512_set1_ps(s.z[i]);
+    const __m512 h2 = _mm512_set1_ps(k.kernel_radius * k.kernel_radius);
+    __m512 sum = _mm512_setzero_ps();
+
+    for (uint32_t j = first; j < last; j += LANES) {
+        const __m512 dx = _mm512_sub_ps(px, _mm512_loadu_ps(&s.x[j]));
+        const __m512 dy = _mm512_sub_ps(py, _mm512_loadu_ps(&s.y[j]));
+        const __m512 dz = _mm512_sub_ps(pz, _mm512_loadu_ps(&s.z[j]));
+        const __m512 r2 =
+            _mm512_fmadd_ps(dx, dx, _mm512_fmadd_ps(dy, dy, _mm512_mul_ps(dz, dz)));
+
+        __mmask16 mask =
+            _mm512_mask_cmp_ps_mask(candidateMask(j, i, last), r2, h2, _CMP_LT_OQ);
+        if (k.check_bin) {
+            mask = binMask(mask, s, k, j, bin);
+        }
+
+        // Equation (10) from Harada without the constants, (h^2 - r^2)^3
+        const __m512 w = _mm512_sub_ps(h2, r2);
+        sum = _mm512_mask_add_ps(sum, mask, sum, _mm512_mul_ps(_mm512_mul_ps(w, w), w));
+    }
+
+    return k.particle_mass * k.poly6_kernel_const * _mm512_reduce_add_ps(sum);
+}
+
+uint32_t simd::forcesAvx512(const Streams& s, const KernelParams& k, uint32_t i, uint32_t first,
+                            uint32_t last, const glm::ivec3& bin, glm::vec3& pressure_force,
+                            glm::vec3& viscosity_force) {
+    const __m512 px = _mm512_set1_ps(s.x[i]);
+    const __m512 py = _mm512_set1_ps(s.y[i]);
+    const __m512 pz = _mm512_set1_ps(s.z[i]);
+    const __m512 vx = _mm512_set1_ps(s.vx[i]);
+    const __m512 vy = _mm512_set1_ps(s.vy[i]);
+    const __m512 vz = _mm512_set1_ps(s.vz[i]);
+    const __m512 pressure_i = _mm512_set1_ps(s.pressure[i]);
+    const __m512 h = _mm512_set1_ps(k.kernel_radius);
+    const __m512 zero = _mm512_setzero_ps();
+    const __m512 half = _mm512_set1_ps(0.5f);
+    const __m512 epsilon = _mm512_set1_ps(1e-16f);
+
+    __m512 pfx = zero, pfy = zero, pfz = zero;
+    __m512 vfx = zero, vfy = zero, vfz = zero;
+    uint32_t num_pairs = 0;
+
+    for (uint32_t j = first; j < last; j += LANES) {
+        const __m512 rx = _mm512_sub_ps(px, _mm512_loadu_ps(&s.x[j]));
+        const __m512 ry = _mm512_sub_ps(py, _mm512_loadu_ps(&s.y[j]));
+        const __m512 rz = _mm512_sub_ps(pz, _mm512_loadu_ps(&s.z[j]));
+        const __m512 r2 =
+            _mm512_fmadd_ps(rx, rx, _mm512_fmadd_ps(ry, ry, _mm512_mul_ps(rz, rz)));
+        const __m512 dist = _mm512_sqrt_ps(r2);
+
+        __mmask16 mask =
+            _mm512_mask_cmp_ps_mask(candidateMask(j, i, last), dist, h, _CMP_LT_OQ);
+        if (k.check_bin) {
+            mask = binMask(mask, s, k, j, bin);
+        }
+        if (mask == 0) {
+            continue;
+        }
+        num_pairs += uint32_t(countLanes(mask));
+
+        // only the unmasked lanes divide, the zero density padding is never touched
+        const __m512 inv_density =
+            _mm512_maskz_div_ps(mask, _mm512_set1_ps(1.0f), _mm512_loadu_ps(&s.density[j]));
+
+        // Equation (6) and (8) from Harada
+        const __m512 pressure = _mm512_mul_ps(
+            _mm512_mul_ps(_mm512_add_ps(pressure_i, _mm512_loadu_ps(&s.pressure[j])), half),
+            inv_density);
+        const __mmask16 pressure_mask = _mm512_mask_cmp_ps_mask(mask, pressure, zero, _CMP_GT_OQ);
+        const __m512 d = _mm512_add_ps(dist, epsilon);
+        const __m512 hd = _mm512_sub_ps(h, d);
+        const __m512 spiky = _mm512_maskz_div_ps(
+            pressure_mask, _mm512_mul_ps(_mm512_mul_ps(hd, hd), pressure), d);
+        pfx = _mm512_fmadd_ps(spiky, rx, pfx);
+        pfy = _mm512_fmadd_ps(spiky, ry, pfy);
+        pfz = _mm512_fmadd_ps(spiky, rz, pfz);
+
+        // Equation (7) and (9) from Harada
+        const __m512 viscosity = _mm512_mul_ps(_mm512_sub_ps(h, dist), inv_density);
+        vfx = _mm512_fmadd_ps(viscosity, _mm512_sub_ps(_mm512_loadu_ps(&s.vx[j]), vx), vfx);
+        vfy = _mm512_fmadd_ps(viscosity, _mm512_sub_ps(_mm512_loadu_ps(&s.vy[j]), vy), vfy);
+        vfz = _mm512_fmadd_ps(viscosity, _mm512_sub_ps(_mm512_loadu_ps(&s.vz[j]), vz), vfz);
+    }
+
+    const float m = k.particle_mass;
+    pressure_force -= m * k.spiky_kernel_const *
+                      glm::vec3(_mm512_reduce_add_ps(pfx), _mm512_reduce_add_ps(pfy),
+                                _mm512_reduce_add_ps(pfz));
+    viscosity_force += m * k.viscosity_kernel_const *
+                       glm::vec3(_mm512_reduce_add_ps(vfx), _mm512_reduce_add_ps(vfy),
+                                 _mm512_reduce_add_ps(vfz));
+    return num_pairs;
+}
+
+#else
+
+using namespace core;
+
+float simd::densityAvx512(const Streams& s, const KernelParams& k, uint32_t i, uint32_t first,
+                          uint32_t last, const glm::ivec3& bin) {
+    return densityScalar(s, k, i, first, last, bin);
+}
+
+uint32_t simd::forcesAvx512(const Streams& s, const KernelParams& k, uint32_t i, uint32_t first,
+                            uint32_t last, const glm::ivec3& bin, glm::vec3& pressure_force,
+                            glm::vec3& viscosity_force) {
+    return forcesScalar(s, k, i, first, last, bin, pressure_force, viscosity_force);
+}
+
+#endif
@@ -3,9 +3,16 @@
 #include <glm/gtx/string_cast.hpp>
 
 #include "util.h"
+#include "ShaderCache.h"
 
 using namespace core;
 
+namespace {
+
+CommandCounts command_counts;
+
+} // namespace
+
 void util::log(char* format, ...) {
     va_list vl;
 
@@ -31,12 +38,91 @@ void util::log(char* format, ...) {
  */
 void util::runProg(ivec3 work_groups) {
     gl::dispatchCompute(work_groups.x, work_groups.y, work_groups.z);
+    command_counts.dispatches++;
 }
 
 void util::runProg(int work_groups) { runProg(ivec3(work_groups, 1, 1)); }
 
+void util::runProgIndirect(GLuint buffer) {
+    glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, buffer);
+    glDispatchComputeIndirect(0);
+    glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, 0);
+    command_counts.dispatches++;
+}
+
+/**
+ * Every barrier of a step goes through here so the step can report how many it waited on
+ */
+void util::memoryBarrier(GLbitfield barriers) {
+    gl::memoryBarrier(barriers);
+    command_counts.barriers++;
+}
+
+CommandCounts util::commandCounts() { return command_counts; }
+
+void util::resetCommandCounts() { command_counts = CommandCounts(); }
+
+/**
+ * GPU time in milliseconds of the commands issued by func, waits for the result
+ */
+double util::timeGpu(const std::function<void()>& func) {
+    GLuint query = 0;
+    glGenQueries(1, &query);
+
+    glBeginQuery(GL_TIME_ELAPSED, query);
+    func();
+    glEndQuery(GL_TIME_ELAPSED);
+
+    GLuint64 elapsed = 0;
+    glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+    glDeleteQueries(1, &query);
+    return double(elapsed) / 1e6;
+}
+
+/**
+ * Allocated size of a buffer object in bytes, 0 for the null buffer
+ */
+size_t util::bufferSize(GLuint buffer) {
+    if (buffer == 0) {
+        return 0;
+    }
+
+    GLint64 size = 0;
+    glGetNamedBufferParameteri64v(buffer, GL_BUFFER_SIZE, &size);
+    return size_t(size);
+}
+
 gl::GlslProgRef util::compileComputeShader(char* filename) {
-    return gl::GlslProg::create(gl::GlslProg::Format().compute(loadAsset(filename)));
+    return ShaderCache::get()->compute(filename, {});
+}
+
+/**
+ * Compile a compute shader with each define injected after the version directive, or take the
+ * variant from the shader cache
+ */
+gl::GlslProgRef util::compileComputeShader(char* filename,
+                                           const std::vector<std::string>& defines) {
+    return ShaderCache::get()->compute(filename, defines);
+}
+
+gl::GlslProgRef util::compileRenderShader(char* vertex, char* fragment,
+                                          const std::vector<std::string>& defines,
+                                          const std::map<std::string, GLint>& attrib_locations) {
+    return ShaderCache::get()->render(vertex, fragment, defines, attrib_locations);
+}
+
+/**
+ * Define that folds a constant into a shader variant, see common/specialize.glsl
+ */
+std::string util::constantDefine(const char* name, int value) {
+    return std::string(name) + " " + std::to_string(value);
+}
+
+std::string util::constantDefine(const char* name, float value) {
+    // exponent notation is always a float literal, and 9 digits round trip
+    char literal[32];
+    std::snprintf(literal, sizeof(literal), "%.8e", value);
+    return std::string(name) + " " + literal;
 }
 
 std::vector<Particle> util::getParticles(gl::SsboRef particle_buffer, int num_items) {
@@ -62,6 +148,88 @@ void util::setParticles(gl::SsboRef particle_buffer, std::vector<Particle> parti
     glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
 }
 
+/**
+ * Read particles from a buffer in either layout, num_items must be the count the buffer holds
+ */
+std::vector<Particle> util::getParticles(GLuint buffer, int num_items, int particle_layout) {
+    if (particle_layout == SOA_LAYOUT) {
+        return getParticleStreams(buffer, num_items).toParticles();
+    }
+    return getParticles(buffer, num_items);
+}
+
+/**
+ * Write particles to a buffer in either layout, the buffer needs GL_DYNAMIC_STORAGE_BIT
+ */
+void util::setParticles(GLuint buffer, const std::vector<Particle>& particles,
+                        int particle_layout) {
+    if (particle_layout == SOA_LAYOUT) {
+        setParticleStreams(buffer, ParticleStreams::fromParticles(particles));
+        return;
+    }
+    glNamedBufferSubData(buffer, 0, particles.size() * sizeof(Particle), particles.data());
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+}
+
+/**
+ * Bind one attribute stream of a SOA particle buffer to a shader storage binding
+ */
+void util::bindParticleStream(GLuint binding, GLuint buffer, ParticleStream stream,
+                              int num_particles) {
+    glBindBufferRange(GL_SHADER_STORAGE_BUFFER, binding, buffer,
+                      layout::streamOffset(stream, num_particles),
+                      layout::streamSize(stream, num_particles));
+}
+
+/**
+ * Copy the first num_particles particles between buffers laid out for different capacities, SOA
+ * streams start at offsets that depend on the capacity so each one is copied on its own
+ */
+void util::copyParticles(GLuint from, int from_capacity, GLuint to, int to_capacity,
+                         int num_particles, int particle_layout) {
+    if (particle_layout != SOA_LAYOUT) {
+        glCopyNamedBufferSubData(from, to, 0, 0, num_particles * sizeof(Particle));
+        return;
+    }
+    for (int s = 0; s < NUM_PARTICLE_STREAMS; s++) {
+        const ParticleStream stream = ParticleStream(s);
+        glCopyNamedBufferSubData(from, to, layout::streamOffset(stream, from_capacity),
+                                 layout::streamOffset(stream, to_capacity),
+                                 layout::streamSize(stream, num_particles));
+    }
+}
+
+ParticleStreams util::getParticleStreams(GLuint buffer, int num_particles) {
+    ParticleStreams streams;
+    streams.resize(num_particles);
+    glGetNamedBufferSubData(buffer, layout::streamOffset(POSITION_STREAM, num_particles),
+                            layout::streamSize(POSITION_STREAM, num_particles),
+                            streams.positions.data());
+    glGetNamedBufferSubData(buffer, layout::streamOffset(VELOCITY_STREAM, num_particles),
+                            layout::streamSize(VELOCITY_STREAM, num_particles),
+                            streams.velocities.data());
+    glGetNamedBufferSubData(buffer, layout::streamOffset(DENSITY_STREAM, num_particles),
+                            layout::streamSize(DENSITY_STREAM, num_particles),
+                            streams.densities.data());
+    glGetNamedBufferSubData(buffer, layout::streamOffset(PRESSURE_STREAM, num_particles),
+                            layout::streamSize(PRESSURE_STREAM, num_particles),
+                            streams.pressures.data());
+    return streams;
+}
+
+void util::setParticleStreams(GLuint buffer, const ParticleStreams& streams) {
+    const int n = streams.size();
+    glNamedBufferSubData(buffer, layout::streamOffset(POSITION_STREAM, n),
+                         layout::streamSize(POSITION_STREAM, n), streams.positions.data());
+    glNamedBufferSubData(buffer, layout::streamOffset(VELOCITY_STREAM, n),
+                         layout::streamSize(VELOCITY_STREAM, n), streams.velocities.data());
+    glNamedBufferSubData(buffer, layout::streamOffset(DENSITY_STREAM, n),
+                         layout::streamSize(DENSITY_STREAM, n), streams.densities.data());
+    glNamedBufferSubData(buffer, layout::streamOffset(PRESSURE_STREAM, n),
+                         layout::streamSize(PRESSURE_STREAM, n), streams.pressures.data());
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+}
+
 std::vector<uint32_t> util::getUints(GLuint buffer, int num_items) {
     std::vector<uint32_t> data(num_items, 0);
     gl::ScopedBuffer scoped_buffer(GL_SHADER_STORAGE_BUFFER, buffer);
@@ -2,6 +2,9 @@
 
 #include <Windows.h>
 #include <cstdio>
+#include <functional>
+#include <map>
+#include <string>
 #include <vector>
 
 #include "cinder/Utilities.h"
@@ -10,6 +13,8 @@
 #include "cinder/gl/Shader.h"
 #include "cinder/gl/gl.h"
 
+#include "./Particle.h"
+
 using namespace ci;
 using namespace ci::app;
 
@@ -17,23 +22,19 @@ namespace core {
 
 const int WORK_GROUP_SIZE = 128;
 
+// compute dispatches and memory barriers issued through util since the last reset
+struct CommandCounts {
+    CommandCounts() : dispatches(0), barriers(0) {}
+    int dispatches;
+    int barriers;
+};
+
 struct Plane {
     Plane() : normal(0), point(0) {}
     vec4 normal;
     vec4 point;
 };
 
-/**
- * Particle representation
- */
-struct Particle {
-    Particle() : position(0), density(0), velocity(0), pressure(0) {}
-    vec3 position;
-    float density;
-    vec3 velocity;
-    float pressure;
-};
-
 namespace util {
 
 void log(char* format, ...);
@@ -42,14 +43,50 @@ void runProg(ivec3 work_groups);
 
 void runProg(int work_groups);
 
+// dispatch with the work group counts at the start of buffer
+void runProgIndirect(GLuint buffer);
+
+void memoryBarrier(GLbitfield barriers);
+
+CommandCounts commandCounts();
+
+void resetCommandCounts();
+
+double timeGpu(const std::function<void()>& func);
+
+size_t bufferSize(GLuint buffer);
+
 gl::GlslProgRef compileComputeShader(char* filename);
 
+gl::GlslProgRef compileComputeShader(char* filename, const std::vector<std::string>& defines);
+
+gl::GlslProgRef compileRenderShader(char* vertex, char* fragment,
+                                    const std::vector<std::string>& defines,
+                                    const std::map<std::string, GLint>& attrib_locations = {});
+
+std::string constantDefine(const char* name, int value);
+
+std::string constantDefine(const char* name, float value);
+
 std::vector<Particle> getParticles(gl::SsboRef particle_buffer, int num_items);
 
 std::vector<Particle> getParticles(GLuint buffer, int num_items);
 
 void setParticles(gl::SsboRef particle_buffer, std::vector<Particle> particles);
 
+std::vector<Particle> getParticles(GLuint buffer, int num_items, int particle_layout);
+
+void setParticles(GLuint buffer, const std::vector<Particle>& particles, int particle_layout);
+
+void bindParticleStream(GLuint binding, GLuint buffer, ParticleStream stream, int num_particles);
+
+void copyParticles(GLuint from, int from_capacity, GLuint to, int to_capacity, int num_particles,
+                   int particle_layout);
+
+ParticleStreams getParticleStreams(GLuint buffer, int num_particles);
+
+void setParticleStreams(GLuint buffer, const ParticleStreams& streams);
+
 std::vector<uint32_t> getUints(GLuint buffer, int num_items);
 
 std::vector<uint32_t> getUints(gl::Texture1dRef tex, int num_items);
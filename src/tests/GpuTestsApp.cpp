@@ -0,0 +1,100 @@
+/**
+ * GPU tests - run the compute passes in a hidden window and check what they leave behind.
+ * Needs a GL 4.5 context, so it isn't part of the headless tests. Quits with the number of
+ * failed checks once every test ran in the first frame.
+ */
+#include <Windows.h>
+#include <cstdlib>
+#include <vector>
+
+#include "cinder/app/App.h"
+#include "cinder/app/RendererGl.h"
+#include "cinder/gl/gl.h"
+
+#include "../core/NeighborList.h"
+#include "../core/Scenario.h"
+#include "../core/ShaderCache.h"
+#include "../core/Sort.h"
+#include "check.h"
+
+using namespace ci;
+using namespace ci::app;
+using namespace core;
+
+namespace {
+
+const int NUM_PARTICLES = 20000;
+const int GRID_RES = 21;
+const float PARTICLE_RADIUS = 0.01f;
+
+GLuint createParticleBuffer(const std::vector<Particle>& particles) {
+    GLuint buffer = 0;
+    glCreateBuffers(1, &buffer);
+    glNamedBufferStorage(buffer, layout::particleBufferSize(NUM_PARTICLES, AOS_LAYOUT), nullptr,
+                         GL_DYNAMIC_STORAGE_BIT);
+    util::setParticles(buffer, particles, AOS_LAYOUT);
+    return buffer;
+}
+
+/**
+ * Lists started with a single neighbor per particle overflow on the first build. The total
+ * read back has to grow the index buffer so the second build fits, after that the resting
+ * particles must not rebuild again.
+ */
+void testNeighborListGrows() {
+    const std::vector<Particle> particles =
+        scenario::generate(scenario::DAM_BREAK, NUM_PARTICLES, 1.0f, PARTICLE_RADIUS, 0);
+    GLuint in_particles = createParticleBuffer(particles);
+    GLuint out_particles = createParticleBuffer(particles);
+
+    const float bin_size = 1.0f / float(GRID_RES);
+    SortRef sort = Sort::create()->numItems(NUM_PARTICLES)->gridRes(GRID_RES)->binSize(bin_size);
+    sort->prepareBuffers();
+    sort->compileShaders();
+
+    NeighborListRef neighbor_list = NeighborList::create()
+                                        ->numItems(NUM_PARTICLES)
+                                        ->gridRes(GRID_RES)
+                                        ->binSize(bin_size)
+                                        ->kernelRadius(PARTICLE_RADIUS * 4.0f)
+                                        ->skin(0.004f)
+                                        ->initialNeighbors(1);
+    neighbor_list->prepareBuffers();
+    neighbor_list->compileShaders();
+    const int initial_capacity = neighbor_list->getCapacity();
+
+    for (int step = 0; step < 8; step++) {
+        if (neighbor_list->expired()) {
+            sort->run(in_particles, out_particles);
+            neighbor_list->build(out_particles, sort->getCountBuffer(), sort->getOffsetBuffer());
+        }
+        neighbor_list->track();
+        glFinish();
+    }
+
+    CHECK(neighbor_list->getCapacity() > initial_capacity);
+    CHECK(neighbor_list->numRebuilds() == 2);
+
+    glDeleteBuffers(1, &in_particles);
+    glDeleteBuffers(1, &out_particles);
+}
+
+} // namespace
+
+class GpuTestsApp : public App {
+public:
+    void setup() override { getWindow()->hide(); }
+    void update() override;
+    void draw() override {}
+};
+
+void GpuTestsApp::update() {
+    check::run("neighbor list grows after overflow", testNeighborListGrows);
+    ShaderCache::get()->clear();
+    std::exit(check::failures());
+}
+
+CINDER_APP(GpuTestsApp, RendererGl, [](App::Settings* settings) {
+    settings->setWindowSize(64, 64);
+    settings->setConsoleWindowEnabled();
+})
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdio>
+
+/**
+ * Minimal assertions for the test executables, a failed check is printed and counted and the
+ * test goes on so one run reports every failure. main returns the count, so ctest fails on any.
+ */
+namespace check {
+
+inline int& failures() {
+    static int count = 0;
+    return count;
+}
+
+inline void fail(const char* file, int line, const char* expression) {
+    std::fprintf(stderr, "%s:%d: check failed: %s\n", file, line, expression);
+    failures()++;
+}
+
+// runs one test and prints its name, so a failure can be told apart from the ones before it
+template <typename Test> void run(const char* name, Test test) {
+    const int before = failures();
+    test();
+    std::printf("%s %s\n", failures() == before ? "passed" : "FAILED", name);
+}
+
+} // namespace check
+
+#define CHECK(expression)                                                                      \
+    do {                                                                                       \
+        if (!(expression)) {                                                                   \
+            check::fail(__FILE__, __LINE__, #expression);                                      \
+        }                                                                                      \
+    } while (0)
@@ -0,0 +1,136 @@
+/**
+ * Checkpoint files written the way the writer thread writes them have to map back to the same
+ * header, particles and offsets, and files that aren't whole checkpoints must not open.
+ * Windows only like the checkpoints, the GPU copy of save() isn't covered.
+ */
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "Checkpoint.h"
+#include "Particle.h"
+#include "check.h"
+
+using namespace core;
+
+namespace {
+
+const char* PATH = "test.wcck";
+const int NUM_PARTICLES = 1000;
+const uint32_t NUM_BINS = 64;
+
+/**
+ * Particles followed by the offsets, as the staging buffer holds them
+ */
+std::vector<uint8_t> makeData(Checkpoint::Header& header) {
+    header = Checkpoint::Header();
+    header.num_particles = NUM_PARTICLES;
+    header.particle_layout = AOS_LAYOUT;
+    header.grid_res = 4;
+    header.num_bins = NUM_BINS;
+    header.size = 1.0f;
+    header.simulated_time = 12.5;
+    Checkpoint::layOut(header, NUM_PARTICLES * sizeof(Particle));
+
+    std::vector<Particle> particles(NUM_PARTICLES);
+    for (int i = 0; i < NUM_PARTICLES; i++) {
+        particles[i].position = glm::vec3(i, i * 2, i * 3) * 1e-3f;
+        particles[i].density = float(i);
+    }
+    std::vector<uint32_t> offsets(NUM_BINS);
+    for (uint32_t b = 0; b < NUM_BINS; b++) {
+        offsets[b] = b * (NUM_PARTICLES / NUM_BINS);
+    }
+
+    std::vector<uint8_t> data(size_t(header.particle_bytes + header.offset_bytes));
+    std::memcpy(data.data(), particles.data(), size_t(header.particle_bytes));
+    std::memcpy(data.data() + header.particle_bytes, offsets.data(),
+                size_t(header.offset_bytes));
+    return data;
+}
+
+void writeBytes(const std::vector<uint8_t>& bytes) {
+    std::FILE* file = std::fopen(PATH, "wb");
+    std::fwrite(bytes.data(), 1, bytes.size(), file);
+    std::fclose(file);
+}
+
+std::vector<uint8_t> fileBytes(const Checkpoint::Header& header,
+                               const std::vector<uint8_t>& data) {
+    std::vector<uint8_t> bytes(sizeof(header) + data.size());
+    std::memcpy(bytes.data(), &header, sizeof(header));
+    std::memcpy(bytes.data() + sizeof(header), data.data(), data.size());
+    return bytes;
+}
+
+void testRoundTrip() {
+    Checkpoint::Header header;
+    const std::vector<uint8_t> data = makeData(header);
+    CHECK(Checkpoint::write(PATH, header, data.data()));
+
+    CheckpointRef checkpoint = Checkpoint::create();
+    CHECK(checkpoint->open(PATH));
+    if (!checkpoint->isOpen()) {
+        return;
+    }
+    CHECK(std::memcmp(&checkpoint->header(), &header, sizeof(header)) == 0);
+    CHECK(checkpoint->header().particle_offset % 16 == 0);
+    CHECK(std::memcmp(checkpoint->particles(), data.data(), size_t(header.particle_bytes)) == 0);
+    CHECK(std::memcmp(checkpoint->offsets(), data.data() + header.particle_bytes,
+                      size_t(header.offset_bytes)) == 0);
+    checkpoint->close();
+    CHECK(!checkpoint->isOpen());
+}
+
+void testRejectsBadMagic() {
+    Checkpoint::Header header;
+    const std::vector<uint8_t> data = makeData(header);
+    std::memcpy(header.magic, "WCCX", sizeof(header.magic));
+    writeBytes(fileBytes(header, data));
+    CHECK(!Checkpoint::create()->open(PATH));
+}
+
+void testRejectsOtherVersion() {
+    Checkpoint::Header header;
+    const std::vector<uint8_t> data = makeData(header);
+    header.version = Checkpoint::VERSION + 1;
+    writeBytes(fileBytes(header, data));
+    CHECK(!Checkpoint::create()->open(PATH));
+}
+
+void testRejectsTruncated() {
+    Checkpoint::Header header;
+    const std::vector<uint8_t> data = makeData(header);
+    std::vector<uint8_t> bytes = fileBytes(header, data);
+
+    // the last offset is missing
+    bytes.resize(bytes.size() - sizeof(uint32_t));
+    writeBytes(bytes);
+    CHECK(!Checkpoint::create()->open(PATH));
+
+    // not even a header
+    bytes.resize(sizeof(header) / 2);
+    writeBytes(bytes);
+    CHECK(!Checkpoint::create()->open(PATH));
+}
+
+void testRejectsMismatchedBins() {
+    Checkpoint::Header header;
+    const std::vector<uint8_t> data = makeData(header);
+    header.num_bins = NUM_BINS + 1;
+    writeBytes(fileBytes(header, data));
+    CHECK(!Checkpoint::create()->open(PATH));
+}
+
+} // namespace
+
+int main() {
+    check::run("checkpoint round trip", testRoundTrip);
+    check::run("checkpoint rejects bad magic", testRejectsBadMagic);
+    check::run("checkpoint rejects other version", testRejectsOtherVersion);
+    check::run("checkpoint rejects truncated", testRejectsTruncated);
+    check::run("checkpoint rejects mismatched bins", testRejectsMismatchedBins);
+    std::remove(PATH);
+    return check::failures();
+}
@@ -0,0 +1,397 @@
+/**
+ * Headless tests of the CPU side - the task scheduler, the CPU solver against a serial run, its
+ * SIMD kernels against the scalar ones, the simulation clock's substep accounting and the
+ * emitters. Returns the number of failed checks.
+ */
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#include "CpuSolver.h"
+#include "Emitter.h"
+#include "Scenario.h"
+#include "SimulationClock.h"
+#include "TaskScheduler.h"
+#include "check.h"
+#include "grid.h"
+#include "simd.h"
+
+using namespace core;
+
+namespace {
+
+const double PI = 3.14159265358979323846;
+const float PARTICLE_RADIUS = 0.01f;
+const int NUM_THREADS = 4;
+// a power of two step so the clock's sums are exact
+const double FIXED_STEP = 1.0 / 64.0;
+
+/**
+ * Same parameters as the benchmark
+ */
+SolverParams defaultParams(int grid_res, int cell_indexing) {
+    SolverParams params;
+    params.size = 1.0f;
+    params.grid_res = grid_res;
+    params.cell_indexing = cell_indexing;
+    params.bin_size = params.size / float(grid_res);
+    params.kernel_radius = PARTICLE_RADIUS * 4.0f;
+    params.particle_mass = PARTICLE_RADIUS * 8.0f;
+    params.stiffness = 100.0f;
+    params.rest_density = 500.0f;
+    params.rest_pressure = 0.0f;
+    params.viscosity_coefficient = 200.0f;
+    params.gravity = glm::vec3(0, -900.0f, 0);
+    params.dt = (1.0f / 60.0f) * 0.012f;
+    params.poly6_kernel_const =
+        float(315.0 / (64.0 * PI * std::pow(double(params.kernel_radius), 9)));
+    params.spiky_kernel_const = float(-45.0 / (PI * std::pow(double(params.kernel_radius), 6)));
+    params.viscosity_kernel_const = float(45.0 / (PI * std::pow(double(params.kernel_radius), 6)));
+    params.mouse_origin = glm::vec3(-10.0f);
+    params.mouse_direction = glm::vec3(-1, 0, 0);
+    return params;
+}
+
+bool sameBytes(const std::vector<Particle>& a, const std::vector<Particle>& b) {
+    return a.size() == b.size() &&
+           std::memcmp(a.data(), b.data(), a.size() * sizeof(Particle)) == 0;
+}
+
+void testSchedulerRunsEveryTaskOnce() {
+    TaskSchedulerRef scheduler = TaskScheduler::create(NUM_THREADS);
+    for (int num_tasks : {0, 1, 3, 1000}) {
+        std::vector<std::atomic<int>> runs(num_tasks);
+        for (auto& r : runs) {
+            r = 0;
+        }
+        std::atomic<bool> bad_worker(false);
+        scheduler->run(num_tasks, [&](int index, int worker) {
+            runs[index]++;
+            if (worker < 0 || worker >= NUM_THREADS) {
+                bad_worker = true;
+            }
+        });
+        for (auto& r : runs) {
+            CHECK(r == 1);
+        }
+        CHECK(!bad_worker);
+    }
+}
+
+void testSchedulerNestedRunIsSerial() {
+    TaskSchedulerRef scheduler = TaskScheduler::create(NUM_THREADS);
+    std::atomic<int> total(0);
+    scheduler->run(8, [&](int, int) {
+        int inner = 0;
+        scheduler->run(16, [&](int, int) { inner++; });
+        total += inner;
+    });
+    CHECK(total == 8 * 16);
+}
+
+/**
+ * The parallel passes have to give the particles bit for bit the same as a serial run, for
+ * every cell indexing and both ways of evaluating pairs
+ */
+void testSolverMatchesSerial() {
+    const int n = 4000;
+    const int grid_res = 21;
+    const int steps = 5;
+
+    for (int indexing :
+         {grid::ROW_MAJOR_INDEXING, grid::MORTON_INDEXING, grid::HASHED_INDEXING}) {
+        for (bool symmetric_pairs : {false, true}) {
+            SolverParams params = defaultParams(grid_res, indexing);
+            params.symmetric_pairs = symmetric_pairs;
+            const std::vector<Particle> initial =
+                scenario::generate(scenario::DAM_BREAK, n, params.size, PARTICLE_RADIUS, 0);
+
+            CpuSolverRef serial = CpuSolver::create()->numThreads(1);
+            CpuSolverRef parallel = CpuSolver::create()->numThreads(NUM_THREADS);
+            std::vector<Particle> serial_particles = initial;
+            std::vector<Particle> parallel_particles = initial;
+            for (int i = 0; i < steps; i++) {
+                serial->step(serial_particles, params);
+                parallel->step(parallel_particles, params);
+            }
+
+            CHECK(sameBytes(serial_particles, parallel_particles));
+            CHECK(serial->getCounts() == parallel->getCounts());
+            CHECK(serial->getOffsets() == parallel->getOffsets());
+
+            uint32_t total = 0;
+            for (uint32_t count : parallel->getCounts()) {
+                total += count;
+            }
+            CHECK(total == uint32_t(n));
+        }
+    }
+}
+
+bool closeTo(float a, float b) {
+    return std::abs(a - b) <= 1e-3f * std::max(std::abs(b), 1.0f);
+}
+
+bool closeTo(const glm::vec3& a, const glm::vec3& b) {
+    return glm::length(a - b) <= 1e-3f * std::max(glm::length(b), 1.0f);
+}
+
+glm::ivec3 cellCoord(const glm::vec3& p, const SolverParams& params) {
+    return glm::clamp(glm::ivec3(p / params.bin_size), glm::ivec3(0),
+                      glm::ivec3(params.grid_res - 1));
+}
+
+/**
+ * Sums particle i over [first, last) with the kernels of isa and the scalar ones
+ */
+void checkKernels(int isa, const simd::Streams& streams, const simd::KernelParams& k, uint32_t i,
+                  uint32_t first, uint32_t last, const glm::ivec3& bin) {
+    const simd::Kernels kernels = simd::kernels(isa);
+    CHECK(closeTo(kernels.density(streams, k, i, first, last, bin),
+               simd::densityScalar(streams, k, i, first, last, bin)));
+
+    glm::vec3 pressure(0), viscosity(0), scalar_pressure(0), scalar_viscosity(0);
+    const uint32_t pairs = kernels.forces(streams, k, i, first, last, bin, pressure, viscosity);
+    const uint32_t scalar_pairs = simd::forcesScalar(streams, k, i, first, last, bin,
+                                                     scalar_pressure, scalar_viscosity);
+    CHECK(pairs == scalar_pairs);
+    CHECK(closeTo(pressure, scalar_pressure));
+    CHECK(closeTo(viscosity, scalar_viscosity));
+}
+
+/**
+ * Every supported instruction set has to sum what the scalar kernels sum, over the bins around
+ * a particle and over ranges of every length up to two vectors, which end in a masked tail and
+ * at the end of the streams read into the padding
+ */
+void testSimdKernelsMatchScalar() {
+    const int n = 4000;
+    const int grid_res = 21;
+
+    for (int indexing : {grid::ROW_MAJOR_INDEXING, grid::HASHED_INDEXING}) {
+        const SolverParams params = defaultParams(grid_res, indexing);
+        std::vector<Particle> particles =
+            scenario::generate(scenario::DAM_BREAK, n, params.size, PARTICLE_RADIUS, 0);
+        // the generated particles are at rest, give the force kernels something to sum
+        for (int i = 0; i < n; i++) {
+            particles[i].density = params.rest_density + float(i % 13);
+            particles[i].pressure = float(i % 7) * 10.0f;
+            particles[i].velocity = glm::vec3(i % 3, i % 5, i % 11) * 0.1f;
+        }
+
+        CpuSolverRef solver = CpuSolver::create()->numThreads(1);
+        solver->setup(n, grid_res, indexing);
+        std::vector<Particle> sorted;
+        solver->sort(particles, sorted, params);
+        const std::vector<uint32_t>& counts = solver->getCounts();
+        const std::vector<uint32_t>& offsets = solver->getOffsets();
+
+        simd::Streams streams;
+        streams.resize(n);
+        streams.assign(sorted, 0, n);
+        const simd::KernelParams k = CpuSolver::kernelParams(params);
+
+        for (int isa = simd::AVX2_KERNELS; isa < simd::NUM_KERNEL_ISAS; isa++) {
+            if (!simd::supported(isa)) {
+                continue;
+            }
+
+            for (uint32_t i = 0; i < uint32_t(n); i += 37) {
+                const glm::ivec3 coord = cellCoord(sorted[i].position, params);
+                for (int dz = -1; dz <= 1; dz++) {
+                    for (int dy = -1; dy <= 1; dy++) {
+                        for (int dx = -1; dx <= 1; dx++) {
+                            const glm::ivec3 bin = coord + glm::ivec3(dx, dy, dz);
+                            if (glm::any(glm::lessThan(bin, glm::ivec3(0))) ||
+                                glm::any(glm::greaterThanEqual(bin, glm::ivec3(grid_res)))) {
+                                continue;
+                            }
+                            const uint32_t index =
+                                grid::cellIndex(bin, grid_res, indexing, int(counts.size()));
+                            checkKernels(isa, streams, k, i, offsets[index],
+                                         offsets[index] + counts[index], bin);
+                        }
+                    }
+                }
+            }
+
+            // the particles at the end of the streams sit in one corner of the dam
+            const uint32_t last = uint32_t(n);
+            const glm::ivec3 bin = cellCoord(sorted[n - 1].position, params);
+            for (uint32_t length = 1; length <= uint32_t(2 * simd::MAX_LANES + 1); length++) {
+                checkKernels(isa, streams, k, last - 1, last - length, last, bin);
+                checkKernels(isa, streams, k, last - length, last - length, last, bin);
+            }
+        }
+    }
+}
+
+void testClockPaysOutFixedSteps() {
+    SimulationClockRef clock =
+        SimulationClock::create()->fixedStep(FIXED_STEP)->maxSubsteps(8)->timeBudget(1000);
+
+    // three and a half steps are due, the half is carried into the next frame
+    CHECK(clock->beginFrame(3.5 * FIXED_STEP) == 3);
+    clock->endFrame(3, 0);
+    CHECK(clock->beginFrame(0.5 * FIXED_STEP) == 1);
+    clock->endFrame(1, 0);
+    CHECK(clock->beginFrame(0) == 0);
+    clock->endFrame(0, 0);
+
+    CHECK(clock->numSteps() == 4);
+    CHECK(clock->getSimulatedTime() == 4 * FIXED_STEP);
+    CHECK(clock->getDroppedTime() == 0);
+}
+
+void testClockDropsBeyondMaxSubsteps() {
+    SimulationClockRef clock = SimulationClock::create()->fixedStep(FIXED_STEP)->maxSubsteps(4);
+
+    // ten and a half steps are due, four run, six are dropped and the half is kept
+    CHECK(clock->beginFrame(10.5 * FIXED_STEP) == 4);
+    clock->endFrame(4, 0);
+    CHECK(clock->getDroppedTime() == 6 * FIXED_STEP);
+    CHECK(clock->beginFrame(0.5 * FIXED_STEP) == 1);
+    clock->endFrame(1, 0);
+    CHECK(clock->getSimulatedTime() == 5 * FIXED_STEP);
+}
+
+void testClockClampsStalledFrames() {
+    SimulationClockRef clock = SimulationClock::create()->fixedStep(FIXED_STEP)->maxSubsteps(64);
+
+    // a one second stall only pays out a quarter of a second
+    CHECK(clock->beginFrame(1.0) == 16);
+    clock->endFrame(16, 0);
+    CHECK(clock->getDroppedTime() == 0.75);
+    CHECK(clock->getSimulatedTime() == 0.25);
+}
+
+void testClockFitsTimeBudget() {
+    SimulationClockRef clock =
+        SimulationClock::create()->fixedStep(FIXED_STEP)->maxSubsteps(8)->timeBudget(4);
+
+    // before a step was measured the budget is the substep limit
+    CHECK(clock->beginFrame(FIXED_STEP) == 1);
+    // 2 ms per step leaves room for two steps in 4 ms
+    clock->endFrame(1, 2.0);
+    CHECK(clock->getStepMs() == 2.0);
+    CHECK(clock->beginFrame(5 * FIXED_STEP) == 2);
+    clock->endFrame(2, 2.0);
+    CHECK(clock->getDroppedTime() == 3 * FIXED_STEP);
+
+    // everything that went in came out as simulated or dropped time
+    CHECK(clock->getSimulatedTime() + clock->getDroppedTime() == 6 * FIXED_STEP);
+}
+
+void testClockThroughputMode() {
+    SimulationClockRef clock = SimulationClock::create()->fixedStep(FIXED_STEP)->renderEvery(5);
+    clock->setMode(SimulationClock::THROUGHPUT_CLOCK);
+
+    // the batch doesn't depend on the frame time and nothing is dropped
+    CHECK(clock->beginFrame(0) == 5);
+    clock->endFrame(5, 1.0);
+    CHECK(clock->beginFrame(1.0) == 5);
+    clock->endFrame(5, 1.0);
+    CHECK(clock->numSteps() == 10);
+    CHECK(clock->getSimulatedTime() == 10 * FIXED_STEP);
+    CHECK(clock->getDroppedTime() == 0);
+
+    // switching back doesn't pay out the throughput frames
+    clock->setMode(SimulationClock::REAL_TIME_CLOCK);
+    CHECK(clock->beginFrame(0) == 0);
+}
+
+/**
+ * Emit a shape serially and on the scheduler, the count has to match the particles written and
+ * both runs have to write the same particles
+ */
+void checkEmitter(EmitterRef serial, EmitterRef parallel, glm::vec3 min, glm::vec3 max) {
+    TaskSchedulerRef scheduler = TaskScheduler::create(NUM_THREADS);
+    const int count = serial->count();
+    CHECK(count > 0);
+    CHECK(parallel->count(scheduler) == count);
+
+    // one guard particle on each side of the emitted range
+    const int first = 1;
+    const int capacity = count + 2;
+    Particle guard;
+    guard.density = -1.0f;
+    std::vector<Particle> serial_particles(capacity, guard);
+    std::vector<Particle> parallel_particles(capacity, guard);
+    serial->emit(serial_particles.data(), first, capacity, AOS_LAYOUT);
+    parallel->emit(parallel_particles.data(), first, capacity, AOS_LAYOUT, scheduler);
+
+    CHECK(sameBytes(serial_particles, parallel_particles));
+    CHECK(serial_particles.front().density == -1.0f);
+    CHECK(serial_particles.back().density == -1.0f);
+    for (int i = first; i < first + count; i++) {
+        const Particle& p = serial_particles[i];
+        CHECK(p.density == 0.0f);
+        CHECK(glm::all(glm::greaterThanEqual(p.position, min)));
+        CHECK(glm::all(glm::lessThanEqual(p.position, max)));
+    }
+
+    // the SOA streams hold the same particles
+    std::vector<uint8_t> streams(layout::particleBufferSize(capacity, SOA_LAYOUT));
+    parallel->emit(streams.data(), first, capacity, SOA_LAYOUT, scheduler);
+    const glm::vec4* positions = reinterpret_cast<const glm::vec4*>(
+        streams.data() + layout::streamOffset(POSITION_STREAM, capacity));
+    for (int i = first; i < first + count; i++) {
+        CHECK(glm::vec3(positions[i]) == serial_particles[i].position);
+    }
+}
+
+void testBoxEmitter() {
+    // power of two extents so the lattice size is exact
+    const glm::vec3 min(0.25f, 0.25f, 0.5f);
+    const glm::vec3 max(0.75f, 0.5f, 0.75f);
+    const float spacing = 1.0f / 32.0f;
+    auto make = [&]() {
+        return Emitter::box(min, max)->spacing(spacing)->jitter(0.5f)->seed(7);
+    };
+    checkEmitter(make(), make(), min, max);
+    CHECK(make()->count() == 16 * 8 * 8);
+}
+
+void testSphereEmitter() {
+    const glm::vec3 center(0.5f);
+    const float radius = 0.2f;
+    auto make = [&]() { return Emitter::sphere(center, radius)->spacing(0.02f)->jitter(0); };
+    checkEmitter(make(), make(), center - radius, center + radius);
+
+    // about the volume of the sphere over the volume of a lattice cell
+    const double expected = 4.0 / 3.0 * PI * std::pow(radius / 0.02, 3);
+    CHECK(std::abs(make()->count() - expected) < expected * 0.1);
+}
+
+void testMeshEmitter() {
+    // closed unit cube around the center of the container
+    std::vector<glm::vec3> positions;
+    for (int i = 0; i < 8; i++) {
+        positions.push_back(glm::vec3(i & 1, (i >> 1) & 1, (i >> 2) & 1) * 0.4f + 0.3f);
+    }
+    const std::vector<uint32_t> indices = {0, 2, 1, 1, 2, 3, 4, 5, 6, 5, 7, 6,
+                                           0, 1, 4, 1, 5, 4, 2, 6, 3, 3, 6, 7,
+                                           0, 4, 2, 2, 4, 6, 1, 3, 5, 3, 7, 5};
+    auto make = [&]() { return Emitter::mesh(positions, indices)->spacing(0.02f)->jitter(0); };
+    checkEmitter(make(), make(), glm::vec3(0.3f), glm::vec3(0.7f));
+}
+
+} // namespace
+
+int main() {
+    check::run("scheduler runs every task once", testSchedulerRunsEveryTaskOnce);
+    check::run("scheduler nested run is serial", testSchedulerNestedRunIsSerial);
+    check::run("solver matches serial", testSolverMatchesSerial);
+    check::run("simd kernels match scalar", testSimdKernelsMatchScalar);
+    check::run("clock pays out fixed steps", testClockPaysOutFixedSteps);
+    check::run("clock drops beyond max substeps", testClockDropsBeyondMaxSubsteps);
+    check::run("clock clamps stalled frames", testClockClampsStalledFrames);
+    check::run("clock fits time budget", testClockFitsTimeBudget);
+    check::run("clock throughput mode", testClockThroughputMode);
+    check::run("box emitter", testBoxEmitter);
+    check::run("sphere emitter", testSphereEmitter);
+    check::run("mesh emitter", testMeshEmitter);
+    return check::failures();
+}